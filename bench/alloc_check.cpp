@@ -0,0 +1,264 @@
+// Check: heap allocations per frame of the serial transcode path once it is warmed up. Every
+// call of malloc, calloc, realloc, the aligned allocators and operator new in the process is
+// counted and charged to the stage running at the time: FrameReader, FrameDecoder, Resampler
+// or FrameEncoder. The first kWarmupPackets input packets fill the object pools and the codec
+// buffer pools and are not counted; the rest of the input is, up to the final flush. The input
+// is the given file, or ten minutes of 44.1 kHz stereo tones written to a WAV file in the
+// current directory, so that the resampler converts to the 48 kHz MP3 output.
+//
+// Usage: alloc_check [input_file [max_allocations_per_frame]]
+// Exits with 1 if the allocations per encoded frame are above the maximum.
+
+#include <errno.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "FrameDecoder.h"
+#include "FrameEncoder.h"
+#include "FrameReader.h"
+#include "OutputSpec.h"
+#include "Resampler.h"
+
+enum Stage { kStageRead, kStageDecode, kStageResample, kStageEncode, kStageCount };
+
+static const char* const kStageNames[kStageCount] = {"read", "decode", "resample", "encode"};
+static const int kWarmupPackets = 500;
+static const int kGeneratedSeconds = 600;
+static const int kGeneratedSampleRate = 44100;
+
+// The stage of this thread, -1 while nothing is counted
+static __thread int t_stage = -1;
+static std::atomic<uint64_t> g_mallocs[kStageCount];
+static std::atomic<uint64_t> g_news[kStageCount];
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* pointer, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+}
+
+static void countMalloc() {
+    if (t_stage >= 0) {
+        g_mallocs[t_stage].fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+// The allocator of the process is glibc's, these only count the calls going into it
+extern "C" void* malloc(size_t size) {
+    countMalloc();
+    return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t count, size_t size) {
+    countMalloc();
+    return __libc_calloc(count, size);
+}
+
+extern "C" void* realloc(void* pointer, size_t size) {
+    countMalloc();
+    return __libc_realloc(pointer, size);
+}
+
+extern "C" void* memalign(size_t alignment, size_t size) {
+    countMalloc();
+    return __libc_memalign(alignment, size);
+}
+
+extern "C" void* aligned_alloc(size_t alignment, size_t size) {
+    countMalloc();
+    return __libc_memalign(alignment, size);
+}
+
+extern "C" int posix_memalign(void** pointer, size_t alignment, size_t size) {
+    countMalloc();
+    void* memory = __libc_memalign(alignment, size);
+    if (!memory) {
+        return ENOMEM;
+    }
+    *pointer = memory;
+    return 0;
+}
+
+void* operator new(size_t size) {
+    if (t_stage >= 0) {
+        g_news[t_stage].fetch_add(1, std::memory_order_relaxed);
+    }
+    void* memory = __libc_malloc(size > 0 ? size : 1);
+    if (!memory) {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete(void* pointer) noexcept { free(pointer); }
+void operator delete[](void* pointer) noexcept { free(pointer); }
+void operator delete(void* pointer, size_t) noexcept { free(pointer); }
+void operator delete[](void* pointer, size_t) noexcept { free(pointer); }
+
+// Charges the allocations of its scope to stage, when counting
+class StageScope {
+  public:
+    StageScope(Stage stage, bool counting) : previous_(t_stage) {
+        t_stage = counting ? stage : -1;
+    }
+    ~StageScope() { t_stage = previous_; }
+
+  private:
+    int previous_;
+};
+
+static void putLe(std::ofstream& file, uint32_t value, int bytes) {
+    for (int i = 0; i < bytes; ++i) {
+        file.put(static_cast<char>(value >> (8 * i)));
+    }
+}
+
+// A 16-bit stereo WAV file of two tones
+static bool writeWav(const std::string& path) {
+    std::ofstream file(path.c_str(), std::ios::binary);
+    const uint32_t samples = static_cast<uint32_t>(kGeneratedSeconds) * kGeneratedSampleRate;
+    const uint32_t dataSize = samples * 4;
+    file.write("RIFF", 4);
+    putLe(file, 36 + dataSize, 4);
+    file.write("WAVEfmt ", 8);
+    putLe(file, 16, 4);
+    putLe(file, 1, 2);  // PCM
+    putLe(file, 2, 2);
+    putLe(file, kGeneratedSampleRate, 4);
+    putLe(file, kGeneratedSampleRate * 4, 4);
+    putLe(file, 4, 2);
+    putLe(file, 16, 2);
+    file.write("data", 4);
+    putLe(file, dataSize, 4);
+
+    std::vector<char> block(kGeneratedSampleRate * 4);
+    for (uint32_t offset = 0; offset < samples; offset += kGeneratedSampleRate) {
+        for (int n = 0; n < kGeneratedSampleRate; ++n) {
+            double seconds = (offset + n) / static_cast<double>(kGeneratedSampleRate);
+            int16_t left = static_cast<int16_t>(8000 * std::sin(2 * M_PI * 440 * seconds));
+            int16_t right = static_cast<int16_t>(8000 * std::sin(2 * M_PI * 660 * seconds));
+            block[n * 4] = static_cast<char>(left);
+            block[n * 4 + 1] = static_cast<char>(left >> 8);
+            block[n * 4 + 2] = static_cast<char>(right);
+            block[n * 4 + 3] = static_cast<char>(right >> 8);
+        }
+        file.write(block.data(), block.size());
+    }
+    return static_cast<bool>(file);
+}
+
+int main(int argc, char* argv[]) {
+    std::string inputPath = argc > 1 ? argv[1] : "";
+    double maxPerFrame = argc > 2 ? std::atof(argv[2]) : -1.0;
+    bool generated = inputPath.empty();
+    if (generated) {
+        inputPath = "alloc_check_input.wav";
+        if (!writeWav(inputPath)) {
+            std::cerr << "Could not write " << inputPath << std::endl;
+            return -1;
+        }
+    }
+
+    OutputSpec spec;
+    FrameReader reader;
+    FrameDecoder decoder;
+    FrameEncoder encoder;
+    Resampler resampler;
+    if (reader.openInputFile(inputPath) < 0 ||
+        decoder.initializeDecoder(reader.getFormatContext(), spec.sampleFormat) < 0 ||
+        encoder.initializeEncoder(spec) < 0) {
+        return -1;
+    }
+    resampler.setFrameSize(encoder.getCodecContext()->frame_size);
+    if (resampler.initializeResampler(decoder.getCodecContext(), spec) < 0) {
+        return -1;
+    }
+
+    FramePool framePool(1);
+    FrameHandle decodedFrame = framePool.acquire();
+    int streamIndex = decoder.getStreamIndex();
+    uint64_t countedPackets = 0;
+    uint64_t countedFrames = 0;
+    int packets = 0;
+    for (;;) {
+        bool counting = packets >= kWarmupPackets;
+        PacketHandle packet;
+        {
+            StageScope scope(kStageRead, counting);
+            packet = reader.readFrame();
+        }
+        if (!packet) {
+            break;
+        }
+        if (packet->stream_index != streamIndex) {
+            continue;
+        }
+        packets++;
+        countedPackets += counting;
+
+        StageScope scope(kStageDecode, counting);
+        if (decoder.sendPacket(packet.get()) < 0) {
+            continue;
+        }
+        packet.reset();
+        while (decoder.receiveFrame(decodedFrame.get()) >= 0) {
+            StageScope resampleScope(kStageResample, counting);
+            if (resampler.sendFrame(decodedFrame.get()) < 0) {
+                continue;
+            }
+            AVFrame* resampledFrame;
+            while ((resampledFrame = resampler.receiveFrame())) {
+                StageScope encodeScope(kStageEncode, counting);
+                if (encoder.encodeFrame(resampledFrame) < 0) {
+                    return -1;
+                }
+                while (encoder.hasEncodedPackets()) {
+                    PacketHandle encodedPacket = encoder.getNextEncodedPacket();
+                    countedFrames += counting && encodedPacket;
+                }
+            }
+        }
+    }
+    if (generated) {
+        unlink(inputPath.c_str());
+    }
+    if (countedFrames == 0) {
+        std::cerr << "Input too short, needs more than " << kWarmupPackets << " packets"
+                  << std::endl;
+        return -1;
+    }
+
+    std::cout << countedPackets << " input packets and " << countedFrames
+              << " encoded frames after " << kWarmupPackets << " warm-up packets" << std::endl;
+    uint64_t total = 0;
+    for (int stage = 0; stage < kStageCount; ++stage) {
+        uint64_t mallocs = g_mallocs[stage].load();
+        uint64_t news = g_news[stage].load();
+        total += mallocs + news;
+        std::cout << "  " << std::left << std::setw(10) << kStageNames[stage] << std::right
+                  << std::fixed << std::setprecision(3) << std::setw(8)
+                  << mallocs / static_cast<double>(countedFrames) << " malloc/frame"
+                  << std::setw(8) << news / static_cast<double>(countedFrames) << " new/frame"
+                  << std::endl;
+    }
+    double perFrame = total / static_cast<double>(countedFrames);
+    std::cout << "  total     " << std::setw(8) << perFrame << " allocations/frame" << std::endl;
+
+    if (maxPerFrame >= 0.0 && perFrame > maxPerFrame) {
+        std::cerr << "More than " << maxPerFrame << " allocations per frame" << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,177 @@
+// Benchmark of the FEC layer: the GF(2^8) multiply-add with every kernel the CPU supports,
+// then FecEncoder and FecDecoder throughput per scheme on a stream of 960-byte packets (MP3
+// at 320 kbps and 48 kHz). The decoder run loses as many packets per group as the scheme
+// can rebuild, at random positions, and checks every rebuilt datagram against the original.
+//
+// Usage: fec_bench [packets]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "FecCodec.h"
+#include "GaloisField.h"
+#include "RtpPacket.h"
+
+typedef std::chrono::steady_clock Clock;
+
+static const int kPacketSize = 960;
+static const int kKernelBufferSize = 1500;
+
+static double secondsSince(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static void benchKernel(GaloisField::Kernel kernel, int iterations) {
+    std::vector<uint8_t> src(kKernelBufferSize);
+    std::vector<uint8_t> dst(kKernelBufferSize);
+    std::mt19937 random(1);
+    for (size_t i = 0; i < src.size(); ++i) {
+        src[i] = static_cast<uint8_t>(random());
+    }
+
+    Clock::time_point start = Clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        // Skip 0 and 1, which do not multiply
+        GaloisField::multiplyAdd(static_cast<uint8_t>(2 + i % 254), src.data(), dst.data(),
+                                 src.size(), kernel);
+    }
+    double seconds = secondsSince(start);
+    std::cout << "  " << std::left << std::setw(8) << GaloisField::kernelName(kernel)
+              << std::right << std::fixed << std::setprecision(0) << std::setw(10)
+              << iterations * static_cast<double>(kKernelBufferSize) / seconds / 1e6 << " MB/s"
+              << " (check " << static_cast<int>(dst[0]) << ")" << std::endl;
+}
+
+// A stream of RTP datagrams of about kPacketSize bytes
+static std::vector<std::vector<uint8_t> > makeStream(int packets) {
+    std::vector<std::vector<uint8_t> > stream(packets);
+    std::mt19937 random(2);
+    for (int p = 0; p < packets; ++p) {
+        RtpHeader header;
+        header.marker = false;
+        header.payloadType = kRtpPayloadTypeMpa;
+        header.sequence = static_cast<uint16_t>(p);
+        header.timestamp = static_cast<uint32_t>(p) * 2160;
+        header.ssrc = 0x5eed;
+        stream[p].resize(kRtpMaxHeaderSize + kPacketSize - static_cast<int>(random() % 4));
+        writeRtpHeader(header, stream[p].data());
+        for (size_t i = kRtpMaxHeaderSize; i < stream[p].size(); ++i) {
+            stream[p][i] = static_cast<uint8_t>(random());
+        }
+    }
+    return stream;
+}
+
+static void benchScheme(const std::string& description,
+                        const std::vector<std::vector<uint8_t> >& stream) {
+    FecOptions options;
+    FecOptions::parse(description, options);
+    double mediaBytes = 0.0;
+    for (size_t p = 0; p < stream.size(); ++p) {
+        mediaBytes += stream[p].size();
+    }
+
+    // Encode, keeping the repair datagrams for the decoder run
+    FecEncoder encoder;
+    encoder.init(options);
+    std::vector<std::vector<std::vector<uint8_t> > > repairs;
+    Clock::time_point start = Clock::now();
+    for (size_t p = 0; p < stream.size(); ++p) {
+        bool completed = encoder.add(stream[p].data(), kRtpHeaderSize,
+                                     stream[p].data() + kRtpHeaderSize,
+                                     stream[p].size() - kRtpHeaderSize);
+        if (p + 1 == stream.size() && !completed) {
+            completed = encoder.finish();
+        }
+        if (completed) {
+            repairs.push_back(std::vector<std::vector<uint8_t> >());
+            for (int j = 0; j < encoder.repairCount(); ++j) {
+                repairs.back().push_back(encoder.repair(j));
+            }
+        }
+    }
+    double encodeSeconds = secondsSince(start);
+
+    // Lose parityCount datagrams of every group
+    std::mt19937 random(3);
+    std::vector<bool> lost(stream.size(), false);
+    int lostCount = 0;
+    for (size_t base = 0; base < stream.size(); base += options.groupSize) {
+        int groupSize =
+            static_cast<int>(std::min<size_t>(options.groupSize, stream.size() - base));
+        for (int l = 0; l < std::min(options.parityCount, groupSize); ++l) {
+            size_t p = base + random() % groupSize;
+            lostCount += lost[p] ? 0 : 1;
+            lost[p] = true;
+        }
+    }
+
+    FecDecoder decoder;
+    std::vector<std::vector<uint8_t> > recovered;
+    int mismatches = 0;
+    start = Clock::now();
+    for (size_t group = 0; group < repairs.size(); ++group) {
+        size_t end = std::min(stream.size(), (group + 1) * options.groupSize);
+        for (size_t p = group * options.groupSize; p < end; ++p) {
+            if (!lost[p]) {
+                decoder.addMedia(stream[p].data(), stream[p].size());
+            }
+        }
+        for (size_t j = 0; j < repairs[group].size(); ++j) {
+            recovered.clear();
+            decoder.addRepair(repairs[group][j].data(), repairs[group][j].size(), recovered);
+            for (size_t r = 0; r < recovered.size(); ++r) {
+                size_t sequence = (recovered[r][2] << 8) | recovered[r][3];
+                mismatches += recovered[r] == stream[sequence] ? 0 : 1;
+            }
+        }
+    }
+    double decodeSeconds = secondsSince(start);
+
+    std::cout << "  " << std::left << std::setw(10) << description << std::right << std::fixed
+              << std::setprecision(0) << std::setw(4)
+              << 100 * options.parityCount / options.groupSize << "%" << std::setw(10)
+              << mediaBytes / encodeSeconds / 1e6 << " MB/s"
+              << std::setw(10) << mediaBytes / decodeSeconds / 1e6 << " MB/s" << std::setw(8)
+              << decoder.recovered() << " of " << lostCount << " rebuilt";
+    if (mismatches > 0) {
+        std::cout << ", " << mismatches << " WRONG";
+    }
+    std::cout << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    int packets = 60000;
+    if (argc > 1) {
+        packets = std::atoi(argv[1]);
+    }
+    // One packet per sequence number, the check looks packets up by it
+    if (packets <= 0 || packets > 65536) {
+        std::cerr << "Usage: " << argv[0] << " [packets up to 65536]" << std::endl;
+        return 1;
+    }
+
+    GaloisField::Kernel detected = GaloisField::detectKernel();
+    std::cout << "GF(2^8) multiply-add of " << kKernelBufferSize << " bytes" << std::endl;
+    for (int kernel = GaloisField::kKernelScalar; kernel <= detected; ++kernel) {
+        benchKernel(static_cast<GaloisField::Kernel>(kernel), 400000);
+    }
+
+    std::cout << std::endl
+              << packets << " packets of " << kPacketSize << " bytes, "
+              << GaloisField::kernelName(detected) << " kernel" << std::endl;
+    std::cout << "  scheme     overhead    encode      decode" << std::endl;
+    std::vector<std::vector<uint8_t> > stream = makeStream(packets);
+    const char* schemes[] = {"xor:10", "xor:5", "rs:10:1", "rs:10:2", "rs:20:4", "rs:50:5"};
+    for (size_t i = 0; i < sizeof(schemes) / sizeof(schemes[0]); ++i) {
+        benchScheme(schemes[i], stream);
+    }
+    return 0;
+}
@@ -0,0 +1,158 @@
+// Microbenchmark: FrameEncoder's previous mutex/condvar packet queue against SpscRing.
+// One producer thread pushes timestamped packets, one consumer thread drains them the way
+// AudioProcessor does (hasEncodedPackets() followed by getNextEncodedPacket()). Both queues
+// hold kQueueCapacity packets and the producer yields while one is full, so the latencies
+// compare the queues and not how deep they grow.
+//
+// Usage: packet_queue_bench [packet_count]
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "SpscRing.h"
+
+typedef std::chrono::steady_clock Clock;
+
+// FrameEncoder's packet ring capacity
+static const size_t kQueueCapacity = 256;
+
+struct FakePacket {
+    Clock::time_point enqueued;
+};
+
+// The queue FrameEncoder used before SpscRing, bounded like the ring
+class MutexQueue {
+  public:
+    bool tryPush(FakePacket* packet) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (queue_.size() >= kQueueCapacity) {
+                return false;
+            }
+            queue_.push(packet);
+        }
+        condition_.notify_one();
+        return true;
+    }
+
+    bool hasItems() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return !queue_.empty();
+    }
+
+    FakePacket* waitPop() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        condition_.wait(lock, [this] { return !queue_.empty(); });
+        FakePacket* packet = queue_.front();
+        queue_.pop();
+        return packet;
+    }
+
+  private:
+    std::queue<FakePacket*> queue_;
+    mutable std::mutex mutex_;
+    std::condition_variable condition_;
+};
+
+class RingQueue {
+  public:
+    RingQueue() : ring_(kQueueCapacity) {}
+
+    bool tryPush(FakePacket* packet) { return ring_.tryPush(packet); }
+    bool hasItems() const { return !ring_.empty(); }
+    FakePacket* waitPop() {
+        FakePacket* packet = nullptr;
+        ring_.waitPop(packet);
+        return packet;
+    }
+
+  private:
+    SpscRing<FakePacket*> ring_;
+};
+
+struct Result {
+    double packetsPerSecond;
+    std::vector<int64_t> latenciesNs;
+};
+
+template <typename Queue>
+static Result run(size_t packetCount) {
+    Queue queue;
+    std::vector<FakePacket> packets(packetCount);
+    std::vector<int64_t> latencies;
+    latencies.reserve(packetCount);
+
+    Clock::time_point start = Clock::now();
+    std::thread consumer([&] {
+        for (size_t received = 0; received < packetCount; ++received) {
+            FakePacket* packet = queue.waitPop();
+            latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                    Clock::now() - packet->enqueued)
+                                    .count());
+            // Drain the burst the way AudioProcessor does
+            while (received + 1 < packetCount && queue.hasItems()) {
+                packet = queue.waitPop();
+                latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                        Clock::now() - packet->enqueued)
+                                        .count());
+                ++received;
+            }
+        }
+    });
+
+    for (size_t i = 0; i < packetCount; ++i) {
+        packets[i].enqueued = Clock::now();
+        while (!queue.tryPush(&packets[i])) {
+            std::this_thread::yield();
+        }
+    }
+    consumer.join();
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    Result result;
+    result.packetsPerSecond = packetCount / seconds;
+    result.latenciesNs.swap(latencies);
+    std::sort(result.latenciesNs.begin(), result.latenciesNs.end());
+    return result;
+}
+
+static int64_t percentile(const std::vector<int64_t>& sorted, double p) {
+    if (sorted.empty()) return 0;
+    size_t index = static_cast<size_t>(p * (sorted.size() - 1));
+    return sorted[index];
+}
+
+static void report(const std::string& name, const Result& result) {
+    std::cout << std::left << std::setw(12) << name << std::right << std::fixed
+              << std::setprecision(0) << std::setw(14) << result.packetsPerSecond << " pkt/s"
+              << "  p50 " << std::setw(7) << percentile(result.latenciesNs, 0.50) << " ns"
+              << "  p99 " << std::setw(8) << percentile(result.latenciesNs, 0.99) << " ns"
+              << "  p99.9 " << std::setw(9) << percentile(result.latenciesNs, 0.999) << " ns"
+              << "  max " << std::setw(10) << result.latenciesNs.back() << " ns" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    size_t packetCount = 2000000;
+    if (argc > 1) {
+        packetCount = std::strtoul(argv[1], nullptr, 10);
+    }
+    if (packetCount == 0) {
+        std::cerr << "Usage: " << argv[0] << " [packet_count]" << std::endl;
+        return -1;
+    }
+
+    std::cout << "Packets: " << packetCount << std::endl;
+    report("mutex queue", run<MutexQueue>(packetCount));
+    report("spsc ring", run<RingQueue>(packetCount));
+    return 0;
+}
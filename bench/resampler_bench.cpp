@@ -0,0 +1,227 @@
+// Benchmark and quality check: libswresample against PolyphaseResampler with every kernel the
+// CPU supports, on the same input. The input is a sum of stereo tones at 22050, 32000 and
+// 44100 Hz, converted to 48000 Hz in 1152-sample chunks the way Resampler is fed. Because
+// the tones are known, each output is compared with the ideal 48000 Hz signal: the SNR
+// counts passband error and aliasing, lag is the output offset in samples that fits best
+// (0 means the backend compensates its own filter delay).
+//
+// Usage: resampler_bench [seconds]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <libavutil/channel_layout.h>
+#include <libavutil/opt.h>
+#include <libavutil/samplefmt.h>
+#include <libswresample/swresample.h>
+}
+
+#include "PolyphaseResampler.h"
+
+typedef std::chrono::steady_clock Clock;
+
+static const int kOutSampleRate = 48000;
+static const int kChannels = 2;
+static const int kChunkSamples = 1152;
+static const int kMaxLag = 64;
+
+// Tone frequencies as a fraction of the input rate, up to 16 kHz at 44.1 kHz
+static const double kToneFractions[] = {0.01, 0.07, 0.19, 0.31, 0.36};
+static const double kToneAmplitude = 0.18;
+
+typedef std::vector<std::vector<float> > Planes;
+
+static double toneSample(int inSampleRate, int channel, double seconds) {
+    double value = 0.0;
+    for (size_t i = 0; i < sizeof(kToneFractions) / sizeof(kToneFractions[0]); ++i) {
+        double frequency = kToneFractions[i] * inSampleRate;
+        value += kToneAmplitude * std::sin(2.0 * M_PI * frequency * seconds + channel + i);
+    }
+    return value;
+}
+
+static Planes makeInput(int inSampleRate, int samples) {
+    Planes input(kChannels, std::vector<float>(samples));
+    for (int ch = 0; ch < kChannels; ++ch) {
+        for (int n = 0; n < samples; ++n) {
+            double seconds = n / static_cast<double>(inSampleRate);
+            input[ch][n] = static_cast<float>(toneSample(inSampleRate, ch, seconds));
+        }
+    }
+    return input;
+}
+
+// Converts input chunk by chunk; convert(in, inSamples, out, maxOut) returns the samples
+// written, and is called with in == nullptr once at the end to flush
+typedef std::function<int(const float* const*, int, float* const*, int)> ConvertFunction;
+
+static Planes runChunks(const Planes& input, int inSampleRate, const ConvertFunction& convert,
+                        double& seconds) {
+    int inSamples = static_cast<int>(input[0].size());
+    int maxOut = static_cast<int>((int64_t)inSamples * kOutSampleRate / inSampleRate) + 4096;
+    Planes output(kChannels, std::vector<float>(maxOut));
+
+    int written = 0;
+    const float* in[kChannels];
+    float* out[kChannels];
+    Clock::time_point start = Clock::now();
+    for (int offset = 0; offset < inSamples; offset += kChunkSamples) {
+        int count = std::min(kChunkSamples, inSamples - offset);
+        for (int ch = 0; ch < kChannels; ++ch) {
+            in[ch] = &input[ch][offset];
+            out[ch] = &output[ch][written];
+        }
+        written += convert(in, count, out, maxOut - written);
+    }
+    for (int ch = 0; ch < kChannels; ++ch) {
+        out[ch] = &output[ch][written];
+    }
+    written += convert(nullptr, 0, out, maxOut - written);
+    seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    for (int ch = 0; ch < kChannels; ++ch) {
+        output[ch].resize(written);
+    }
+    return output;
+}
+
+// SNR against the ideal output, at the lag within +-kMaxLag that fits best. The first and
+// last 100 ms are skipped, they hold the filter edges around the start and end of input.
+static double measureSnr(const Planes& output, int inSampleRate, int& bestLag) {
+    int skip = kOutSampleRate / 10;
+    int end = static_cast<int>(output[0].size()) - skip;
+    double bestSnr = -1e9;
+    bestLag = 0;
+    for (int lag = -kMaxLag; lag <= kMaxLag; ++lag) {
+        double signal = 0.0;
+        double noise = 0.0;
+        for (int ch = 0; ch < kChannels; ++ch) {
+            // Coarse pass over every 16th sample to find the lag
+            for (int n = skip; n < end; n += 16) {
+                double ideal = toneSample(inSampleRate, ch, (n - lag) / (double)kOutSampleRate);
+                double error = output[ch][n] - ideal;
+                signal += ideal * ideal;
+                noise += error * error;
+            }
+        }
+        double snr = 10.0 * std::log10(signal / std::max(noise, 1e-30));
+        if (snr > bestSnr) {
+            bestSnr = snr;
+            bestLag = lag;
+        }
+    }
+
+    double signal = 0.0;
+    double noise = 0.0;
+    for (int ch = 0; ch < kChannels; ++ch) {
+        for (int n = skip; n < end; ++n) {
+            double ideal = toneSample(inSampleRate, ch, (n - bestLag) / (double)kOutSampleRate);
+            double error = output[ch][n] - ideal;
+            signal += ideal * ideal;
+            noise += error * error;
+        }
+    }
+    return 10.0 * std::log10(signal / std::max(noise, 1e-30));
+}
+
+static void report(const std::string& name, const Planes& output, int inSampleRate,
+                   double inputSeconds, double seconds) {
+    int lag = 0;
+    double snr = measureSnr(output, inSampleRate, lag);
+    double samplesPerSecond = output[0].size() / seconds;
+    std::cout << "  " << std::left << std::setw(18) << name << std::right << std::fixed
+              << std::setprecision(1) << std::setw(8) << samplesPerSecond / 1e6 << " Msample/s"
+              << std::setw(9) << inputSeconds / seconds << "x realtime" << "  SNR "
+              << std::setw(6) << snr << " dB  lag " << std::setw(3) << lag << std::endl;
+}
+
+static bool runSwr(const Planes& input, int inSampleRate, double inputSeconds) {
+    AVChannelLayout layout;
+    av_channel_layout_default(&layout, kChannels);
+    SwrContext* swr = nullptr;
+    if (swr_alloc_set_opts2(&swr, &layout, AV_SAMPLE_FMT_FLTP, kOutSampleRate, &layout,
+                            AV_SAMPLE_FMT_FLTP, inSampleRate, 0, nullptr) < 0 ||
+        swr_init(swr) < 0) {
+        std::cerr << "Could not initialize swr" << std::endl;
+        swr_free(&swr);
+        return false;
+    }
+
+    double seconds = 0.0;
+    Planes output = runChunks(
+        input, inSampleRate,
+        [swr](const float* const* in, int inSamples, float* const* out, int maxOut) {
+            int ret = swr_convert(swr, reinterpret_cast<uint8_t* const*>(out), maxOut,
+                                  reinterpret_cast<const uint8_t* const*>(in), inSamples);
+            return ret > 0 ? ret : 0;
+        },
+        seconds);
+    swr_free(&swr);
+
+    report("swr", output, inSampleRate, inputSeconds, seconds);
+    return true;
+}
+
+static bool runPolyphase(const Planes& input, int inSampleRate, double inputSeconds,
+                         PolyphaseResampler::Kernel kernel) {
+    PolyphaseResampler resampler;
+    if (resampler.init(inSampleRate, kOutSampleRate, kChannels, kernel) < 0) {
+        std::cerr << "Could not initialize polyphase resampler" << std::endl;
+        return false;
+    }
+
+    double seconds = 0.0;
+    Planes output = runChunks(
+        input, inSampleRate,
+        [&resampler](const float* const* in, int inSamples, float* const* out, int maxOut) {
+            return in ? resampler.process(in, inSamples, out, maxOut)
+                      : resampler.flush(out, maxOut);
+        },
+        seconds);
+
+    report(std::string("polyphase ") + PolyphaseResampler::kernelName(kernel), output,
+           inSampleRate, inputSeconds, seconds);
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    double inputSeconds = 30.0;
+    if (argc > 1) {
+        inputSeconds = std::strtod(argv[1], nullptr);
+    }
+    if (inputSeconds < 1.0) {
+        std::cerr << "Usage: " << argv[0] << " [seconds]" << std::endl;
+        return -1;
+    }
+
+    const int inSampleRates[] = {44100, 32000, 22050};
+    PolyphaseResampler::Kernel fastest = PolyphaseResampler::detectKernel();
+    std::cout << "Input: " << inputSeconds << " s of " << kChannels << " channel tones, "
+              << kChunkSamples << "-sample chunks" << std::endl;
+
+    for (size_t r = 0; r < sizeof(inSampleRates) / sizeof(inSampleRates[0]); ++r) {
+        int inSampleRate = inSampleRates[r];
+        Planes input = makeInput(inSampleRate, static_cast<int>(inputSeconds * inSampleRate));
+
+        std::cout << inSampleRate << " -> " << kOutSampleRate << " Hz" << std::endl;
+        if (!runSwr(input, inSampleRate, inputSeconds)) {
+            return -1;
+        }
+        for (int kernel = PolyphaseResampler::kKernelScalar; kernel <= fastest; ++kernel) {
+            if (!runPolyphase(input, inSampleRate, inputSeconds,
+                              static_cast<PolyphaseResampler::Kernel>(kernel))) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,211 @@
+// Benchmark: the UDP receive path of many concurrent streams over loopback. The baseline is
+// the previous UdpServer loop, a setsockopt(SO_RCVTIMEO) and a recvfrom() into a stack
+// buffer per datagram, then a packet allocated and copied for the muxer; it is compared
+// with DatagramReceiver (poll() and recvmmsg() into its slab) at several batch sizes,
+// handing each datagram to the muxer where it lies. Both look the source address up in a
+// session table as UdpServer does.
+//
+// Each round queues 417-byte datagrams (an MP3 frame at 320 kbps) round-robin from one
+// socket per stream until the server socket's receive buffer is full, then receives them
+// all; only the receiving is timed, in CPU time, so sender and receiver need not run on
+// separate cores. "datagrams/s" is what one core receives at that cost, and "streams/core"
+// how many real-time streams of 48000 / 1152 datagrams per second that is.
+//
+// Usage: udp_recv_bench [streams] [cpu_seconds_per_run]
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <libavcodec/avcodec.h>
+#ifdef __cplusplus
+}
+#endif
+
+#include "DatagramReceiver.h"
+
+static const int kPacketSize = 417;
+static const int kSendBatch = 8;
+static const int kFillDatagrams = 4096;
+static const double kPacketsPerSecond = 48000.0 / 1152.0;
+
+static double threadCpuSeconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t addressKey(const sockaddr_in& address) {
+    return (static_cast<uint64_t>(ntohl(address.sin_addr.s_addr)) << 16) |
+           ntohs(address.sin_port);
+}
+
+struct Result {
+    double cpuSeconds;  // receiving only
+    uint64_t received;
+    uint64_t calls;
+    uint64_t sessions;
+};
+
+// Queues up to kFillDatagrams datagrams on the server socket, kSendBatch per sendmmsg() from
+// every stream socket in turn. What does not fit in its receive buffer is dropped.
+static void fill(const std::vector<int>& sockets) {
+    static std::vector<uint8_t> payload(kPacketSize, 0x5a);
+    std::vector<mmsghdr> messages(kSendBatch);
+    struct iovec iov;
+    iov.iov_base = payload.data();
+    iov.iov_len = payload.size();
+    memset(messages.data(), 0, messages.size() * sizeof(mmsghdr));
+    for (int i = 0; i < kSendBatch; ++i) {
+        messages[i].msg_hdr.msg_iov = &iov;
+        messages[i].msg_hdr.msg_iovlen = 1;
+    }
+    for (int sent = 0; sent < kFillDatagrams;) {
+        for (size_t s = 0; s < sockets.size() && sent < kFillDatagrams; ++s) {
+            sendmmsg(sockets[s], messages.data(), kSendBatch, 0);
+            sent += kSendBatch;
+        }
+    }
+}
+
+// Receives until the socket is empty, with the previous UdpServer loop when batchSize is 0
+// and with receiver otherwise
+static void drain(int socket, DatagramReceiver* receiver, AVPacket* packet,
+                  std::unordered_map<uint64_t, uint64_t>& sessions, Result& result) {
+    double startCpu = threadCpuSeconds();
+    if (!receiver) {
+        char buffer[4096];
+        for (;;) {
+            struct sockaddr_in source;
+            socklen_t length = sizeof(source);
+            struct timeval timeout = {5, 0};
+            setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            ssize_t size = recvfrom(socket, buffer, sizeof(buffer), MSG_DONTWAIT,
+                                    (struct sockaddr*)&source, &length);
+            if (size < 0) {
+                break;
+            }
+            sessions[addressKey(source)]++;
+            AVPacket* copy = av_packet_alloc();
+            av_new_packet(copy, size);
+            memcpy(copy->data, buffer, size);
+            av_packet_free(&copy);
+            result.received++;
+            result.calls++;
+        }
+    } else {
+        for (;;) {
+            int count = receiver->receive(socket, 0);
+            if (count <= 0) {
+                break;
+            }
+            for (int i = 0; i < count; ++i) {
+                sessions[addressKey(receiver->source(i))]++;
+                packet->data = const_cast<uint8_t*>(receiver->data(i));
+                packet->size = static_cast<int>(receiver->size(i));
+            }
+            result.received += count;
+            result.calls++;
+        }
+    }
+    result.cpuSeconds += threadCpuSeconds() - startCpu;
+}
+
+// Fills and drains the server socket for about seconds of receive CPU time
+static Result run(int serverSocket, const std::vector<int>& streamSockets, int batchSize,
+                  double seconds) {
+    Result result;
+    result.cpuSeconds = 0.0;
+    result.received = 0;
+    result.calls = 0;
+    std::unordered_map<uint64_t, uint64_t> sessions;
+    std::unique_ptr<DatagramReceiver> receiver;
+    if (batchSize > 0) {
+        receiver.reset(new DatagramReceiver(batchSize));
+    }
+    AVPacket* packet = av_packet_alloc();
+    while (result.cpuSeconds < seconds) {
+        fill(streamSockets);
+        drain(serverSocket, receiver.get(), packet, sessions, result);
+    }
+    result.sessions = sessions.size();
+    packet->data = nullptr;
+    av_packet_free(&packet);
+    return result;
+}
+
+static void report(const std::string& name, const Result& result) {
+    double cpuPerDatagram = result.cpuSeconds / result.received;
+    std::cout << "  " << std::left << std::setw(14) << name << std::right << std::fixed
+              << std::setprecision(0) << std::setw(10) << 1.0 / cpuPerDatagram
+              << " datagrams/s" << std::setprecision(3) << std::setw(8) << cpuPerDatagram * 1e6
+              << " us CPU/datagram" << std::setprecision(0) << std::setw(9)
+              << 1.0 / (cpuPerDatagram * kPacketsPerSecond) << " streams/core"
+              << std::setprecision(1) << std::setw(7)
+              << static_cast<double>(result.received) / result.calls << " per call"
+              << std::setw(6) << result.sessions << " sessions" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    int streams = argc > 1 ? std::atoi(argv[1]) : 256;
+    double seconds = argc > 2 ? std::atof(argv[2]) : 1.0;
+    if (streams <= 0 || seconds <= 0.0) {
+        std::cerr << "Usage: " << argv[0] << " [streams] [cpu_seconds_per_run]" << std::endl;
+        return -1;
+    }
+
+    int serverSocket = socket(AF_INET, SOCK_DGRAM, 0);
+    int bufferSize = 64 << 20;
+    setsockopt(serverSocket, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    if (serverSocket < 0 || bind(serverSocket, (struct sockaddr*)&address, sizeof(address)) < 0 ||
+        getsockname(serverSocket, (struct sockaddr*)&address, &length) < 0) {
+        std::cerr << "Could not open the receiving socket" << std::endl;
+        return -1;
+    }
+
+    std::vector<int> streamSockets(streams);
+    for (int s = 0; s < streams; ++s) {
+        streamSockets[s] = socket(AF_INET, SOCK_DGRAM, 0);
+        if (streamSockets[s] < 0 ||
+            connect(streamSockets[s], (struct sockaddr*)&address, sizeof(address)) < 0) {
+            std::cerr << "Could not open the sending sockets" << std::endl;
+            return -1;
+        }
+    }
+
+    std::cout << streams << " streams of " << kPacketSize << "-byte datagrams over loopback, "
+              << seconds << " s of receive CPU per run" << std::endl;
+    report("recvfrom", run(serverSocket, streamSockets, 0, seconds));
+    const int batchSizes[] = {1, 8, 32, 64};
+    for (size_t i = 0; i < sizeof(batchSizes) / sizeof(batchSizes[0]); ++i) {
+        report("recvmmsg x" + std::to_string(batchSizes[i]),
+               run(serverSocket, streamSockets, batchSizes[i], seconds));
+    }
+
+    for (int s = 0; s < streams; ++s) {
+        close(streamSockets[s]);
+    }
+    close(serverSocket);
+    return 0;
+}
@@ -0,0 +1,260 @@
+// Benchmark: the UDP send path of many concurrent streams over loopback. The baseline is
+// the previous UdpSink, one sendto() per packet on an unconnected socket; it is compared
+// with the current UdpSink (connected socket, sendmmsg() batches) at several batch sizes,
+// and with several packets aggregated per 1500-byte datagram.
+//
+// One thread writes 417-byte packets (an MP3 frame at 320 kbps) round-robin to every
+// stream, a receiver thread drains the server socket. Sender CPU is the process CPU time
+// minus the receiver thread's, and includes the flush threads. "CPU/stream" is the share of
+// one core a stream needs at its real-time rate of 48000 / 1152 packets per second.
+// Packets and datagrams differ only with aggregation.
+//
+// Usage: udp_send_bench [streams] [packets_per_stream]
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "UdpSink.h"
+
+typedef std::chrono::steady_clock Clock;
+
+static const int kPacketSize = 417;
+static const double kPacketsPerSecond = 48000.0 / 1152.0;
+
+static double cpuSeconds(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Counts the datagrams arriving on a loopback socket until stop is set and the socket
+// has been quiet for a moment
+class Receiver {
+  public:
+    Receiver() : socket_(-1), port_(0), received_(0), cpuSeconds_(0.0), stop_(false) {}
+    ~Receiver() {
+        if (socket_ >= 0) {
+            close(socket_);
+        }
+    }
+
+    int open() {
+        socket_ = socket(AF_INET, SOCK_DGRAM, 0);
+        if (socket_ < 0) {
+            return -1;
+        }
+        int bufferSize = 64 << 20;
+        setsockopt(socket_, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+        struct timeval timeout = {0, 100000};
+        setsockopt(socket_, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        struct sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t length = sizeof(address);
+        if (bind(socket_, (struct sockaddr*)&address, sizeof(address)) < 0 ||
+            getsockname(socket_, (struct sockaddr*)&address, &length) < 0) {
+            return -1;
+        }
+        port_ = ntohs(address.sin_port);
+        return 0;
+    }
+
+    void start() {
+        received_ = 0;
+        stop_ = false;
+        thread_ = std::thread(&Receiver::run, this);
+    }
+
+    // Returns the datagrams received since start(), end markers included
+    uint64_t finish() {
+        stop_ = true;
+        thread_.join();
+        return received_;
+    }
+
+    int port() const { return port_; }
+    double cpuSeconds() const { return cpuSeconds_; }
+
+  private:
+    int socket_;
+    int port_;
+    uint64_t received_;
+    double cpuSeconds_;
+    std::atomic<bool> stop_;
+    std::thread thread_;
+
+    void run() {
+        double startCpu = ::cpuSeconds(CLOCK_THREAD_CPUTIME_ID);
+        uint8_t buffer[2048];
+        for (;;) {
+            ssize_t ret = recv(socket_, buffer, sizeof(buffer), 0);
+            if (ret >= 0) {
+                received_++;
+            } else if (stop_) {
+                break;
+            }
+        }
+        cpuSeconds_ = ::cpuSeconds(CLOCK_THREAD_CPUTIME_ID) - startCpu;
+    }
+};
+
+struct Result {
+    double wallSeconds;
+    double senderCpuSeconds;
+    uint64_t packets;
+    uint64_t sent;
+    uint64_t received;
+    uint64_t sendCalls;
+};
+
+static void report(const std::string& name, const Result& result) {
+    double cpuPerPacket = result.senderCpuSeconds / result.packets;
+    std::cout << "  " << std::left << std::setw(22) << name << std::right << std::fixed
+              << std::setprecision(0) << std::setw(10) << result.packets / result.wallSeconds
+              << " packets/s" << std::setw(10) << result.sent / result.wallSeconds
+              << " datagrams/s" << std::setprecision(2) << std::setw(8) << cpuPerPacket * 1e6
+              << " us CPU/packet" << std::setprecision(4) << std::setw(9)
+              << cpuPerPacket * kPacketsPerSecond * 100.0 << " % CPU/stream"
+              << std::setprecision(1) << std::setw(7)
+              << static_cast<double>(result.sent) / result.sendCalls << " per call"
+              << std::setw(7) << 100.0 * result.received / result.sent << " % received"
+              << std::endl;
+}
+
+// Every stream on its own unconnected socket, one sendto() per packet and per end marker
+static Result runSendto(Receiver& receiver, int streams, int packets) {
+    struct sockaddr_in server;
+    memset(&server, 0, sizeof(server));
+    server.sin_family = AF_INET;
+    server.sin_port = htons(receiver.port());
+    server.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+    std::vector<int> sockets(streams);
+    for (int s = 0; s < streams; ++s) {
+        sockets[s] = socket(AF_INET, SOCK_DGRAM, 0);
+    }
+    std::vector<uint8_t> payload(kPacketSize, 0x5a);
+
+    Result result;
+    result.packets = static_cast<uint64_t>(streams) * packets;
+    result.sent = 0;
+    receiver.start();
+    double startCpu = cpuSeconds(CLOCK_PROCESS_CPUTIME_ID);
+    Clock::time_point start = Clock::now();
+    for (int p = 0; p < packets; ++p) {
+        for (int s = 0; s < streams; ++s) {
+            if (sendto(sockets[s], payload.data(), payload.size(), 0, (struct sockaddr*)&server,
+                       sizeof(server)) >= 0) {
+                result.sent++;
+            }
+        }
+    }
+    for (int s = 0; s < streams; ++s) {
+        if (sendto(sockets[s], "", 0, 0, (struct sockaddr*)&server, sizeof(server)) >= 0) {
+            result.sent++;
+        }
+        close(sockets[s]);
+    }
+    result.wallSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+    double processCpu = cpuSeconds(CLOCK_PROCESS_CPUTIME_ID) - startCpu;
+    result.received = receiver.finish();
+    result.senderCpuSeconds = processCpu - receiver.cpuSeconds();
+    result.sendCalls = result.sent;
+    return result;
+}
+
+static Result runUdpSink(Receiver& receiver, int streams, int packets, int batchSize,
+                         int mtu) {
+    UdpSinkOptions options;
+    options.batchSize = batchSize;
+    options.mtu = mtu;
+    // Opened before the clock starts, like the sendto() sockets: the socket, connect() and
+    // the flush thread are not part of the send path
+    std::vector<std::unique_ptr<UdpSink> > sinks;
+    for (int s = 0; s < streams; ++s) {
+        sinks.push_back(
+            std::unique_ptr<UdpSink>(new UdpSink("127.0.0.1", receiver.port(), options)));
+        sinks[s]->open(nullptr, AVRational{1, 48000});
+    }
+    AVPacket* packet = av_packet_alloc();
+    av_new_packet(packet, kPacketSize);
+    memset(packet->data, 0x5a, kPacketSize);
+
+    Result result;
+    result.packets = static_cast<uint64_t>(streams) * packets;
+    result.sent = 0;
+    result.sendCalls = 0;
+    receiver.start();
+    double startCpu = cpuSeconds(CLOCK_PROCESS_CPUTIME_ID);
+    Clock::time_point start = Clock::now();
+    for (int p = 0; p < packets; ++p) {
+        for (int s = 0; s < streams; ++s) {
+            sinks[s]->write(packet);
+        }
+    }
+    for (int s = 0; s < streams; ++s) {
+        sinks[s]->close();
+        result.sent += sinks[s]->datagramsSent();
+        result.sendCalls += sinks[s]->sendCalls();
+    }
+    result.wallSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+    double processCpu = cpuSeconds(CLOCK_PROCESS_CPUTIME_ID) - startCpu;
+    result.received = receiver.finish();
+    result.senderCpuSeconds = processCpu - receiver.cpuSeconds();
+    av_packet_free(&packet);
+    return result;
+}
+
+int main(int argc, char* argv[]) {
+    int streams = argc > 1 ? std::atoi(argv[1]) : 64;
+    int packets = argc > 2 ? std::atoi(argv[2]) : 5000;
+    if (streams <= 0 || packets <= 0) {
+        std::cerr << "Usage: " << argv[0] << " [streams] [packets_per_stream]" << std::endl;
+        return -1;
+    }
+
+    Receiver receiver;
+    if (receiver.open() < 0) {
+        std::cerr << "Could not open the receiving socket" << std::endl;
+        return -1;
+    }
+
+    // UdpSink prints a line per stream when it opens and closes, keep those out of the table
+    std::streambuf* console = std::cout.rdbuf();
+    std::ostringstream discard;
+
+    std::cout << streams << " streams x " << packets << " packets of " << kPacketSize
+              << " bytes over loopback" << std::endl;
+    report("sendto", runSendto(receiver, streams, packets));
+
+    const int batchSizes[] = {1, 4, 16, 64, 1, 16};
+    const int mtus[] = {0, 0, 0, 0, 1500, 1500};
+    for (size_t i = 0; i < sizeof(batchSizes) / sizeof(batchSizes[0]); ++i) {
+        std::cout.rdbuf(discard.rdbuf());
+        Result result = runUdpSink(receiver, streams, packets, batchSizes[i], mtus[i]);
+        std::cout.rdbuf(console);
+        discard.str("");
+        report("sendmmsg x" + std::to_string(batchSizes[i]) +
+                   (mtus[i] ? " mtu " + std::to_string(mtus[i]) : ""),
+               result);
+    }
+    return 0;
+}
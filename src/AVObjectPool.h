@@ -0,0 +1,119 @@
+#ifndef AV_OBJECT_POOL_H
+#define AV_OBJECT_POOL_H
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <libavcodec/packet.h>
+#include <libavutil/frame.h>
+#ifdef __cplusplus
+}
+#endif
+
+template <typename T>
+struct AVObjectTraits;
+
+template <>
+struct AVObjectTraits<AVPacket> {
+    static AVPacket* alloc() { return av_packet_alloc(); }
+    static void unref(AVPacket* packet) { av_packet_unref(packet); }
+    static void free(AVPacket* packet) { av_packet_free(&packet); }
+};
+
+template <>
+struct AVObjectTraits<AVFrame> {
+    static AVFrame* alloc() { return av_frame_alloc(); }
+    static void unref(AVFrame* frame) { av_frame_unref(frame); }
+    static void free(AVFrame* frame) { av_frame_free(&frame); }
+};
+
+// Free list of AVPacket or AVFrame structs. acquire() returns an empty object in a handle
+// that unrefs it and puts it back on the list when it goes out of scope, so a component that
+// produces one object per iteration stops allocating once the list has warmed up.
+//
+// Handles may be released on any thread and may outlive the pool object itself: the list is
+// shared with every handle and freed with the last one.
+template <typename T>
+class AVObjectPool {
+  private:
+    struct FreeList {
+        std::mutex mutex;
+        std::vector<T*> idle;
+        size_t maxIdle;
+
+        ~FreeList() {
+            for (size_t i = 0; i < idle.size(); ++i) {
+                AVObjectTraits<T>::free(idle[i]);
+            }
+        }
+    };
+
+  public:
+    class Recycler {
+      public:
+        Recycler() {}
+        explicit Recycler(const std::shared_ptr<FreeList>& freeList) : freeList_(freeList) {}
+
+        void operator()(T* object) const {
+            AVObjectTraits<T>::unref(object);
+            if (freeList_) {
+                std::lock_guard<std::mutex> lock(freeList_->mutex);
+                if (freeList_->idle.size() < freeList_->maxIdle) {
+                    freeList_->idle.push_back(object);
+                    return;
+                }
+            }
+            AVObjectTraits<T>::free(object);
+        }
+
+      private:
+        std::shared_ptr<FreeList> freeList_;
+    };
+
+    typedef std::unique_ptr<T, Recycler> Handle;
+
+    // Keeps at most maxIdle released objects, the rest are freed
+    explicit AVObjectPool(size_t maxIdle = kDefaultMaxIdle) : freeList_(new FreeList()) {
+        freeList_->maxIdle = maxIdle;
+        freeList_->idle.reserve(maxIdle);
+    }
+
+    // Returns an empty handle if a new object cannot be allocated
+    Handle acquire() {
+        T* object = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(freeList_->mutex);
+            if (!freeList_->idle.empty()) {
+                object = freeList_->idle.back();
+                freeList_->idle.pop_back();
+            }
+        }
+        if (!object) {
+            object = AVObjectTraits<T>::alloc();
+            if (!object) {
+                return Handle();
+            }
+        }
+        return Handle(object, Recycler(freeList_));
+    }
+
+  private:
+    static const size_t kDefaultMaxIdle = 64;
+
+    std::shared_ptr<FreeList> freeList_;
+
+    AVObjectPool(const AVObjectPool&);
+    AVObjectPool& operator=(const AVObjectPool&);
+};
+
+typedef AVObjectPool<AVPacket> PacketPool;
+typedef PacketPool::Handle PacketHandle;
+typedef AVObjectPool<AVFrame> FramePool;
+typedef FramePool::Handle FrameHandle;
+
+#endif  // AV_OBJECT_POOL_H
@@ -1,7 +1,5 @@
 #include "AudioProcessor.h"
 
-#include <unistd.h>
-
 #include "FrameDecoder.h"
 #include "FrameEncoder.h"
 #include "FrameReader.h"
@@ -11,6 +9,13 @@
 #include <cctype>
 #include <iostream>
 #include <memory>
+#include <thread>
+
+#include "BoundedQueue.h"
+#include "FileSink.h"
+#include "Log.h"
+#include "SegmentedEncoder.h"
+#include "UdpSink.h"
 
 // FFmpeg includes - configured in CMakeLists.txt
 extern "C" {
@@ -59,417 +64,711 @@ size_t write_s16p_frame_to_pcm(std::ofstream& out_file, AVFrame* frame) {
 AudioProcessor::AudioProcessor()
     : frameReader_(new FrameReader()),
       frameDecoder_(new FrameDecoder()),
-      resampler_(new Resampler()),
-      frameEncoder_(new FrameEncoder()),
-      localFormatContext_(nullptr),
-      localOutputFilePath_("local_output.mp3"),
-      udpSocket_(-1) {}
+      pipelined_(false),
+      segmentCount_(0),
+      streamCopyEnabled_(true),
+      streamCopy_(false),
+      resamplerBackend_(Resampler::kBackendSwr) {}
+
+AudioProcessor::~AudioProcessor() {}
+
+int AudioProcessor::addOutput(const OutputSpec& spec) {
+    Rendition rendition;
+    rendition.spec = spec;
+    rendition.stage = 0;
+    rendition.defaultSinks = false;
+    rendition.encodeFailed = false;
+    renditions_.push_back(std::move(rendition));
+    return static_cast<int>(renditions_.size()) - 1;
+}
+
+void AudioProcessor::addSink(std::unique_ptr<PacketSink> sink) {
+    if (renditions_.empty()) {
+        addOutput(OutputSpec());
+    }
+
+    SinkEntry entry;
+    entry.sink = std::move(sink);
+    entry.failed = false;
+    renditions_.back().sinks.push_back(std::move(entry));
+}
+
+void AudioProcessor::setPipelined(bool enabled) { pipelined_ = enabled; }
 
-AudioProcessor::~AudioProcessor() { closeUdpClient(); }
+void AudioProcessor::setSegmentCount(int segmentCount) { segmentCount_ = segmentCount; }
+
+void AudioProcessor::setStreamCopy(bool enabled) { streamCopyEnabled_ = enabled; }
+
+void AudioProcessor::setResamplerBackend(Resampler::Backend backend) {
+    resamplerBackend_ = backend;
+}
+
+void AudioProcessor::setUdpOptions(const UdpSinkOptions& options) { udpOptions_ = options; }
+
+// <name>_<rate>.<ext>, with the bitrate appended when several outputs are written
+static std::string defaultOutputFileName(const std::string& inputFilePath, const OutputSpec& spec,
+                                         bool ladder) {
+    std::string fileName = generateOutputFileName(inputFilePath, spec);
+    if (!ladder) {
+        return fileName;
+    }
+    size_t dotPos = fileName.find_last_of('.');
+    return fileName.substr(0, dotPos) + "_" + std::to_string(spec.bitRate / 1000) + "k" +
+           fileName.substr(dotPos);
+}
 
 int AudioProcessor::processAudio(const std::string& inputFilePath, const std::string& udpServerIp,
                                  int udpServerPort) {
     // Initialize FFmpeg
     avformat_network_init();
 
-    // Initialize UDP client (sending to specified server)
-    if (initUdpClient(udpServerIp, udpServerPort) < 0) {
-        std::cerr << "Warning: Failed to initialize UDP client" << std::endl;
-    }
-
     // Open input file
     if (frameReader_->openInputFile(inputFilePath) < 0) {
         std::cerr << "Failed to open input file" << std::endl;
-        closeUdpClient();
         return -1;
     }
 
-    // Initialize decoder
-    if (frameDecoder_->initializeDecoder(frameReader_->getFormatContext()) < 0) {
+    if (renditions_.empty()) {
+        addOutput(OutputSpec());
+    }
+
+    // Initialize decoder, asking for the sample format the (first) encoder takes
+    if (frameDecoder_->initializeDecoder(frameReader_->getFormatContext(),
+                                         renditions_[0].spec.sampleFormat) < 0) {
         std::cerr << "Failed to initialize decoder" << std::endl;
         frameReader_->closeInput();
-        closeUdpClient();
         return -1;
     }
 
-    // Initialize resampler
-    AVCodecParameters* codecParams = frameDecoder_->getCodecParameters();
-    AVCodecID codecId = frameDecoder_->getCodecId();
-    // Determine target sample format based on output codec
-    AVSampleFormat targetSampleFormat;
-    if (codecId == AV_CODEC_ID_AAC) {
-        targetSampleFormat = AV_SAMPLE_FMT_FLTP;  // AAC requires FLTP
-    } else if (codecId == AV_CODEC_ID_MP2 || codecId == AV_CODEC_ID_MP1) {
-        targetSampleFormat = AV_SAMPLE_FMT_S16P; 
-		/* todo 对几个mp2/mp1文件测试后发现原格式是AV_SAMPLE_FMT_FLTP，则需把重采样的格式设为AV_SAMPLE_FMT_S16P*/
-		if (codecParams->format != AV_SAMPLE_FMT_FLTP)
-			codecParams->format = AV_SAMPLE_FMT_S16P;
-    } else if (codecId == AV_CODEC_ID_MP3) {
-        targetSampleFormat = AV_SAMPLE_FMT_S16P;  // MP3 works better with S16P
-    } else {
-        targetSampleFormat = AV_SAMPLE_FMT_FLTP;  // Default to FLTP
+    // Initialize resamplers and encoders
+    streamCopy_ = streamCopyEnabled_ && inputMatchesOutputs();
+    if (streamCopy_) {
+        std::cout << "Input already is " << renditions_[0].spec.toString()
+                  << ", copying packets" << std::endl;
+    } else if (initializeRenditions() < 0) {
+        closeComponents();
+        return -1;
     }
 
-    if (resampler_->initializeResampler(codecParams, targetSampleFormat) < 0) {
-        std::cerr << "Failed to initialize resampler" << std::endl;
-        frameEncoder_->closeEncoder();
-        frameDecoder_->closeDecoder();
-        frameReader_->closeInput();
-        closeUdpClient();
-        return -1;
+    // Default outputs: the encoded file next to the working directory and, for a single
+    // output, the UDP stream
+    bool ladder = renditions_.size() > 1;
+    for (size_t i = 0; i < renditions_.size(); ++i) {
+        Rendition& rendition = renditions_[i];
+        rendition.encodeFailed = false;
+        rendition.defaultSinks = rendition.sinks.empty();
+        if (!rendition.defaultSinks) {
+            continue;
+        }
+
+        SinkEntry fileSink;
+        fileSink.sink.reset(
+            new FileSink(defaultOutputFileName(inputFilePath, rendition.spec, ladder)));
+        fileSink.failed = false;
+        rendition.sinks.push_back(std::move(fileSink));
+        if (!ladder) {
+            SinkEntry udpSink;
+            udpSink.sink.reset(new UdpSink(udpServerIp, udpServerPort, udpOptions_));
+            udpSink.failed = false;
+            rendition.sinks.push_back(std::move(udpSink));
+        }
     }
 
-	    // Initialize encoder with target format (48000 Hz, stereo) and appropriate codec
-    // For now, we always encode to MP3 format regardless of input format
-    codecId = AV_CODEC_ID_MP3;
-    if (frameEncoder_->initializeEncoder(48000, 2, AV_CODEC_ID_MP3) < 0) {
-        std::cerr << "Failed to initialize encoder" << std::endl;
-        frameDecoder_->closeDecoder();
-        frameReader_->closeInput();
-        closeUdpClient();
-        return -1;
+    bool sinksOpen = true;
+    for (size_t i = 0; i < renditions_.size() && sinksOpen; ++i) {
+        sinksOpen = openSinks(renditions_[i]) == 0;
     }
 
-    // Set output file name
-    std::string outputFileName = generateOutputFileName(inputFilePath, codecId);
-    frameEncoder_->setOutputFile(outputFileName);
+    // Process frames
+    bool segmentError = false;
+    int frameCount = 0;
+    if (!sinksOpen) {
+        // Nothing to do, fall through to the clean up
+    } else if (streamCopy_) {
+        runStreamCopy(frameCount);
+    } else if (segmentCount_ > 1 && inputSplitsForOutputs()) {
+        segmentError = runSegmented(inputFilePath) < 0;
+    } else if (pipelined_) {
+        runPipelined(frameCount);
+    } else {
+        runSerial(frameCount);
+    }
 
-    // Initialize local output file
-    if (initializeLocalOutputFile(frameEncoder_->getCodecContext()) < 0) {
-        std::cerr << "Failed to initialize local output file" << std::endl;
-        frameDecoder_->closeDecoder();
-        frameReader_->closeInput();
-        closeUdpClient();
+    // Clean up
+    closeComponents();
+    bool sinksOk = true;
+    bool encodeOk = true;
+    for (size_t i = 0; i < renditions_.size(); ++i) {
+        Rendition& rendition = renditions_[i];
+        encodeOk = !rendition.encodeFailed && encodeOk;
+        sinksOk = closeSinks(rendition) && sinksOk;
+        if (rendition.defaultSinks) {
+            rendition.sinks.clear();
+        }
+    }
+
+    if (!sinksOpen) {
+        return -1;
+    } else if (segmentError) {
+        std::cerr << "Segmented encoding failed" << std::endl;
         return -1;
+    } else if (!encodeOk) {
+        std::cerr << "Encoding failed, the output is incomplete" << std::endl;
+        return -1;
+    } else if (!sinksOk) {
+        std::cout << "Audio processing completed with output errors" << std::endl;
+        return -1;
+    } else {
+        std::cout << "Audio processing completed successfully" << std::endl;
+        return 0;
     }
+}
 
-    // Process frames
-    AVPacket* packet;
-    bool udpError = false;
-    int frameCount = 0;
-    while ((packet = frameReader_->readFrame()) != nullptr) {
-        frameCount++;
-        // Decode frame
-        AVFrame* decodedFrame = frameDecoder_->decodePacket(packet);
-        if (!decodedFrame) {
-            std::cerr << "Failed to decode frame " << frameCount << std::endl;
-            av_packet_unref(packet);
-            continue;
+int AudioProcessor::initializeRenditions() {
+    // Outputs whose encoders take the same sample rate, channel count, sample format and frame
+    // size share one resampler
+    std::vector<const OutputSpec*> stageFormats;
+    std::vector<int> stageFrameSizes;
+    resamplers_.clear();
+
+    for (size_t i = 0; i < renditions_.size(); ++i) {
+        Rendition& rendition = renditions_[i];
+        const OutputSpec& spec = rendition.spec;
+
+        rendition.encoder.reset(new FrameEncoder());
+        if (rendition.encoder->initializeEncoder(spec) < 0) {
+            std::cerr << "Failed to initialize encoder for " << spec.toString() << std::endl;
+            return -1;
         }
+        int frameSize = rendition.encoder->getCodecContext()->frame_size;
 
-        // Resample frame
-        AVFrame* resampledFrame = resampler_->resampleFrame(decodedFrame);
-        if (!resampledFrame) {
-            std::cerr << "Failed to resample frame " << frameCount << std::endl;
-            av_frame_unref(decodedFrame);
-            av_packet_unref(packet);
-            continue;
+        size_t stage = 0;
+        while (stage < stageFormats.size() &&
+               (!stageFormats[stage]->sameAudioFormat(spec) ||
+                stageFrameSizes[stage] != frameSize)) {
+            stage++;
         }
-#ifdef WRITE_PCM_DEBUG
-		write_s16p_frame_to_pcm(outfile, resampledFrame);
-#endif
-        // Encode frame (packet will be added to queue)
-        if (frameEncoder_->encodeFrame(resampledFrame) < 0) {
-            std::cerr << "Failed to encode frame " << frameCount << std::endl;
-            av_frame_unref(decodedFrame);
-            av_frame_unref(resampledFrame);
-            av_packet_unref(packet);
-            break;
+        if (stage == stageFormats.size()) {
+            std::unique_ptr<Resampler> resampler(new Resampler());
+            resampler->setBackend(resamplerBackend_);
+            resampler->setFrameSize(frameSize);
+            if (resampler->initializeResampler(frameDecoder_->getCodecContext(), spec) < 0) {
+                std::cerr << "Failed to initialize resampler" << std::endl;
+                return -1;
+            }
+            if (resampler->isPassThrough()) {
+                std::cout << "Decoder output already matches " << spec.toString()
+                          << ", not resampling" << std::endl;
+            }
+            resamplers_.push_back(std::move(resampler));
+            stageFormats.push_back(&spec);
+            stageFrameSizes.push_back(frameSize);
         }
+        rendition.stage = stage;
+    }
 
-        // Get encoded packets from queue and process them
-        while (frameEncoder_->hasEncodedPackets()) {
-            AVPacket* encodedPacket = frameEncoder_->getNextEncodedPacket();
-            if (encodedPacket) {
-                // Write the encoded packet to a local MP3 file for comparison with UDP server
-                // output
-                if (writeLocalOutputPacket(encodedPacket) < 0) {
-                    std::cerr << "Failed to write local output packet" << std::endl;
-                }
-
-                // Send the encoded packet over UDP
-                if (udpSocket_ >= 0 && !udpError) {
-                    if (sendUdpData(encodedPacket->data, encodedPacket->size) < 0) {
-                        std::cerr << "Failed to send UDP data, stopping UDP transmission"
-                                  << std::endl;
-                        udpError = true;
-                    }
-                }
-
-                // Clean up
-                av_packet_unref(encodedPacket);
-            }
+    if (renditions_.size() > 1) {
+        std::cout << "Encoding " << renditions_.size() << " outputs from " << resamplers_.size()
+                  << " resampled streams" << std::endl;
+    }
+    return 0;
+}
+
+void AudioProcessor::closeComponents() {
+    frameReader_->closeInput();
+    frameDecoder_->closeDecoder();
+    for (size_t i = 0; i < resamplers_.size(); ++i) {
+        resamplers_[i]->closeResampler();
+    }
+    resamplers_.clear();
+    for (size_t i = 0; i < renditions_.size(); ++i) {
+        if (renditions_[i].encoder) {
+            renditions_[i].encoder->closeEncoder();
         }
+    }
+}
 
-        // Clean up
-        av_frame_unref(decodedFrame);
-        av_frame_unref(resampledFrame);
-        av_packet_unref(packet);
+bool AudioProcessor::inputMatchesOutputs() const {
+    const AVCodecParameters* codecParams = frameDecoder_->getCodecParameters();
+    for (size_t i = 0; i < renditions_.size(); ++i) {
+        if (!renditions_[i].spec.matchesStream(codecParams)) {
+            return false;
+        }
     }
 
-    std::cout << "Processed " << frameCount << " frames" << std::endl;
+    // A variable bitrate MP3 can start with a frame of exactly the output bitrate
+    if (codecParams->codec_id == AV_CODEC_ID_MP3 && !frameReader_->isConstantBitrateMp3()) {
+        std::cout << "Input is not constant bitrate, re-encoding it" << std::endl;
+        return false;
+    }
+    return true;
+}
 
-    // Flush decoder
-    frameDecoder_->flushDecoder();
+bool AudioProcessor::inputSplitsForOutputs() const {
+    for (size_t i = 0; i < renditions_.size(); ++i) {
+        if (SegmentedEncoder::plannedSegmentCount(frameReader_->getFormatContext(),
+                                                  renditions_[i].spec, segmentCount_) == 0) {
+            std::cout << "Cannot split " << renditions_[i].spec.toString()
+                      << " output into segments, encoding it in one piece" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
 
-    // Flush resampler
-    AVFrame* flushedFrame = resampler_->flushResampler();
-    if (flushedFrame) {
-        frameEncoder_->encodeFrame(flushedFrame);
-        // Get encoded packets from queue and process them
-        while (frameEncoder_->hasEncodedPackets()) {
-            AVPacket* encodedPacket = frameEncoder_->getNextEncodedPacket();
-            if (encodedPacket) {
-                // Write the encoded packet to a local MP3 file for comparison with UDP server
-                // output
-                if (writeLocalOutputPacket(encodedPacket) < 0) {
-                    std::cerr << "Failed to write local output packet (flush)" << std::endl;
-                }
-
-                // Send the encoded packet over UDP if no error occurred
-                if (udpSocket_ >= 0 && !udpError) {
-                    if (sendUdpData(encodedPacket->data, encodedPacket->size) < 0) {
-                        std::cerr << "Failed to send UDP data, stopping UDP transmission"
-                                  << std::endl;
-                        udpError = true;
-                    }
-                }
-                // Clean up
-                av_packet_unref(encodedPacket);
-            }
+void AudioProcessor::runStreamCopy(int& packetCount) {
+    // Each demuxed packet is one frame of the right format, pass it through unchanged
+    int streamIndex = frameDecoder_->getStreamIndex();
+    PacketHandle packet;
+    while ((packet = frameReader_->readFrame())) {
+        if (packet->stream_index != streamIndex) {
+            continue;
+        }
+        packetCount++;
+        for (size_t i = 0; i < renditions_.size(); ++i) {
+            deliverEncodedPacket(renditions_[i], packet.get());
         }
-        av_frame_unref(flushedFrame);
     }
 
-    // Flush encoder
-    AVPacket* flushedPacket = nullptr;
-    frameEncoder_->flushEncoder(&flushedPacket);
-    if (flushedPacket) {
-        // Write the flushed packet to a local MP3 file for comparison with UDP server output
-        if (writeLocalOutputPacket(flushedPacket) < 0) {
-            std::cerr << "Failed to write local output packet (flush encoder)" << std::endl;
-        }
-
-        // Send the flushed packet over UDP if no error occurred
-        if (udpSocket_ >= 0 && !udpError) {
-            if (sendUdpData(flushedPacket->data, flushedPacket->size) < 0) {
-                std::cerr << "Failed to send UDP data, stopping UDP transmission" << std::endl;
-                udpError = true;
+    std::cout << "Copied " << packetCount << " packets" << std::endl;
+}
+
+void AudioProcessor::runSerial(int& frameCount) {
+    if (renditions_.size() > 1) {
+        // This thread decodes and resamples, every encoder runs on its own thread and writes
+        // its own sinks
+        FrameQueues frameQueues = createFrameQueues();
+        std::vector<std::thread> encoderThreads;
+        for (size_t i = 0; i < renditions_.size(); ++i) {
+            Rendition& rendition = renditions_[i];
+            BoundedQueue<FrameHandle>& frames = *frameQueues[i];
+            encoderThreads.push_back(std::thread([this, &rendition, &frames] {
+                encodeFrames(rendition, frames, [this, &rendition](PacketHandle encodedPacket) {
+                    deliverEncodedPacket(rendition, encodedPacket.get());
+                });
+            }));
+        }
+
+        FrameHandle decodedFrame = framePool_.acquire();
+        auto resampleDecodedFrame = [&](AVFrame* frame) {
+            resampleForOutputs(frame, frameQueues);
+            return true;
+        };
+
+        int streamIndex = frameDecoder_->getStreamIndex();
+        PacketHandle packet;
+        while ((packet = frameReader_->readFrame())) {
+            if (packet->stream_index != streamIndex) {
+                continue;
             }
+            frameCount++;
+            decodeFrames(packet.get(), decodedFrame.get(), resampleDecodedFrame);
         }
-        // Clean up
-        av_packet_unref(flushedPacket);
-    }
+        decodeFrames(nullptr, decodedFrame.get(), resampleDecodedFrame);
+        flushResamplers(frameQueues);
 
-    // Send end marker to UDP server if no error occurred
-    if (udpSocket_ >= 0 && !udpError) {
-        // Send a special end marker (0 bytes)
-        if (sendUdpData(nullptr, 0) >= 0) {
-            std::cout << "End marker sent to UDP server" << std::endl;
-        } else {
-            std::cerr << "Failed to send end marker to UDP server" << std::endl;
+        for (size_t i = 0; i < encoderThreads.size(); ++i) {
+            frameQueues[i]->close();
+            encoderThreads[i].join();
         }
+
+        std::cout << "Processed " << frameCount << " frames" << std::endl;
+        return;
     }
 
-    // Clean up
-    frameReader_->closeInput();
-    frameDecoder_->closeDecoder();
-    resampler_->closeResampler();
-    frameEncoder_->closeEncoder();
-    closeLocalOutputFile();
-    closeUdpClient();
+    Rendition& rendition = renditions_[0];
+    Resampler* resampler = resamplers_[0].get();
+    FrameEncoder* frameEncoder = rendition.encoder.get();
+
+    // Every packet is decoded into the same frame, and the resampler fills encoder-sized
+    // frames that it reuses once the encoder has released them
+    FrameHandle decodedFrame = framePool_.acquire();
+    bool encodeFailed = false;
+    auto encodeResampledFrames = [&] {
+        AVFrame* resampledFrame;
+        while ((resampledFrame = resampler->receiveFrame())) {
+#ifdef WRITE_PCM_DEBUG
+            write_s16p_frame_to_pcm(outfile, resampledFrame);
+#endif
+            // Encode frame (packet will be added to queue)
+            if (frameEncoder->encodeFrame(resampledFrame) < 0) {
+                std::cerr << "Failed to encode frame " << frameCount << std::endl;
+                encodeFailed = true;
+                return false;
+            }
 
-    if (udpError) {
-        std::cout << "Audio processing completed with UDP transmission errors" << std::endl;
-        return -1;
-    } else {
-        std::cout << "Audio processing completed successfully" << std::endl;
-        return 0;
+            // Get encoded packets from queue and process them
+            deliverQueuedPackets(rendition);
+        }
+        return true;
+    };
+    auto encodeDecodedFrame = [&](AVFrame* frame) {
+        if (resampler->sendFrame(frame) < 0) {
+            static LogLimiter resampleErrors;
+            LogLine(kLogError, &resampleErrors) << "Failed to resample frame " << frameCount;
+            return true;
+        }
+        return encodeResampledFrames();
+    };
+
+    int streamIndex = frameDecoder_->getStreamIndex();
+    PacketHandle packet;
+    while (!encodeFailed && (packet = frameReader_->readFrame())) {
+        if (packet->stream_index != streamIndex) {
+            continue;
+        }
+        frameCount++;
+        decodeFrames(packet.get(), decodedFrame.get(), encodeDecodedFrame);
     }
-}
 
-// Helper function to convert string to lowercase
-std::string toLower(const std::string& str) {
-    std::string lowerStr = str;
-    std::transform(lowerStr.begin(), lowerStr.end(), lowerStr.begin(),
-                   [](unsigned char c) { return std::tolower(c); });
-    return lowerStr;
-}
+    std::cout << "Processed " << frameCount << " frames" << std::endl;
 
-// Helper function to get file extension
-std::string getFileExtension(const std::string& filePath) {
-    size_t dotPos = filePath.find_last_of('.');
-    if (dotPos != std::string::npos) {
-        return toLower(filePath.substr(dotPos + 1));
+    // Drain decoder
+    if (!encodeFailed) {
+        decodeFrames(nullptr, decodedFrame.get(), encodeDecodedFrame);
     }
-    return "";
-}
 
-// Helper function to get codec ID based on file extension
-AVCodecID getCodecIdFromExtension(const std::string& filePath) {
-    std::string ext = getFileExtension(filePath);
-
-    if (ext == "mp3") {
-        return AV_CODEC_ID_MP3;
-    } else if (ext == "wav") {
-        return AV_CODEC_ID_PCM_S16LE;
-    } else if (ext == "aac") {
-        return AV_CODEC_ID_AAC;
-    } else if (ext == "flac") {
-        return AV_CODEC_ID_FLAC;
-    } else if (ext == "ogg" || ext == "oga") {
-        return AV_CODEC_ID_VORBIS;
-    } else if (ext == "m4a" || ext == "mp4" || ext == "aac") {
-        return AV_CODEC_ID_AAC;
-    } else {
-        // Default to MP3
-        return AV_CODEC_ID_MP3;
+    // Flush resampler, the last frame may be shorter than the encoder frame
+    if (!encodeFailed && resampler->sendFrame(nullptr) >= 0) {
+        encodeResampledFrames();
     }
+
+    // Flush encoder
+    if (!encodeFailed && frameEncoder->flushEncoder() < 0) {
+        encodeFailed = true;
+    }
+    deliverQueuedPackets(rendition);
+    rendition.encodeFailed = encodeFailed;
 }
 
-// Helper function to generate output file name based on input file name and codec
-std::string generateOutputFileName(const std::string& inputFilePath, AVCodecID codecId) {
-    // Extract just the file name without directory path
-    size_t slashPos = inputFilePath.find_last_of("/\\");
-    std::string fileName =
-        (slashPos != std::string::npos) ? inputFilePath.substr(slashPos + 1) : inputFilePath;
+void AudioProcessor::runPipelined(int& frameCount) {
+    // Each stage owns its component exclusively and hands ownership of every packet and
+    // frame to the next stage, so the stages never share FFmpeg state. The resampler stage
+    // fans out to one encoder and one sink thread per output.
+    BoundedQueue<PacketHandle> readQueue(kPipelineQueueDepth);
+    BoundedQueue<FrameHandle> decodedQueue(kPipelineQueueDepth);
+    FrameQueues resampledQueues = createFrameQueues();
+    std::vector<std::unique_ptr<BoundedQueue<PacketHandle>>> encodedQueues;
+    for (size_t i = 0; i < renditions_.size(); ++i) {
+        encodedQueues.push_back(std::unique_ptr<BoundedQueue<PacketHandle>>(
+            new BoundedQueue<PacketHandle>(kPipelineQueueDepth)));
+    }
 
-    // Extract base name without extension
-    size_t dotPos = fileName.find_last_of('.');
-    std::string baseName = (dotPos != std::string::npos) ? fileName.substr(0, dotPos) : fileName;
+    std::thread readerThread([&] {
+        PacketHandle packet;
+        while ((packet = frameReader_->readFrame())) {
+            if (!readQueue.push(std::move(packet))) {
+                break;
+            }
+        }
+        readQueue.close();
+    });
+
+    std::thread decoderThread([&] {
+        // Decode into one frame and move each result into a pooled frame for the queue
+        FrameHandle decodedFrame = framePool_.acquire();
+        auto forwardDecodedFrame = [&](AVFrame* frame) {
+            FrameHandle queuedFrame = framePool_.acquire();
+            if (!queuedFrame) {
+                return true;
+            }
+            av_frame_move_ref(queuedFrame.get(), frame);
+            return decodedQueue.push(std::move(queuedFrame));
+        };
+
+        int streamIndex = frameDecoder_->getStreamIndex();
+        bool downstreamClosed = false;
+        PacketHandle packet;
+        while (!downstreamClosed && readQueue.pop(packet)) {
+            if (packet->stream_index != streamIndex) {
+                continue;
+            }
+            frameCount++;
+            downstreamClosed = !decodeFrames(packet.get(), decodedFrame.get(), forwardDecodedFrame);
+            packet.reset();
+        }
+        readQueue.close();
+        while (readQueue.tryPop(packet)) {
+            packet.reset();
+        }
+        if (!downstreamClosed) {
+            decodeFrames(nullptr, decodedFrame.get(), forwardDecodedFrame);
+        }
+        decodedQueue.close();
+    });
+
+    std::thread resamplerThread([&] {
+        FrameHandle decodedFrame;
+        while (decodedQueue.pop(decodedFrame)) {
+            resampleForOutputs(decodedFrame.get(), resampledQueues);
+            decodedFrame.reset();
+        }
+        flushResamplers(resampledQueues);
+        for (size_t i = 0; i < resampledQueues.size(); ++i) {
+            resampledQueues[i]->close();
+        }
+    });
+
+    std::vector<std::thread> encoderThreads;
+    std::vector<std::thread> sinkThreads;
+    for (size_t i = 0; i < renditions_.size(); ++i) {
+        Rendition& rendition = renditions_[i];
+        BoundedQueue<FrameHandle>& frames = *resampledQueues[i];
+        BoundedQueue<PacketHandle>& encodedQueue = *encodedQueues[i];
+
+        encoderThreads.push_back(std::thread([this, &rendition, &frames, &encodedQueue] {
+            encodeFrames(rendition, frames, [&encodedQueue](PacketHandle encodedPacket) {
+                encodedQueue.push(std::move(encodedPacket));
+            });
+            encodedQueue.close();
+        }));
+
+        sinkThreads.push_back(std::thread([this, &rendition, &encodedQueue] {
+            PacketHandle encodedPacket;
+            while (encodedQueue.pop(encodedPacket)) {
+                deliverEncodedPacket(rendition, encodedPacket.get());
+                encodedPacket.reset();
+            }
+        }));
+    }
 
-    switch (codecId) {
-        case AV_CODEC_ID_PCM_S16LE:
-            return baseName + "_48000.wav";
-        case AV_CODEC_ID_AAC:
-            return baseName + "_48000.aac";
-        case AV_CODEC_ID_FLAC:
-            return baseName + "_48000.flac";
-        case AV_CODEC_ID_VORBIS:
-            return baseName + "_48000.ogg";
-        case AV_CODEC_ID_MP3:
-        default:
-            return baseName + "_48000.mp3";
+    readerThread.join();
+    decoderThread.join();
+    resamplerThread.join();
+    for (size_t i = 0; i < renditions_.size(); ++i) {
+        encoderThreads[i].join();
+        sinkThreads[i].join();
     }
+
+    std::cout << "Processed " << frameCount << " frames" << std::endl;
 }
 
-int AudioProcessor::initUdpClient(const std::string& serverIp, int serverPort) {
-    // Create UDP socket
-    udpSocket_ = socket(AF_INET, SOCK_DGRAM, 0);
-    if (udpSocket_ < 0) {
-        std::cerr << "Failed to create UDP socket" << std::endl;
-        return -1;
+int AudioProcessor::runSegmented(const std::string& inputFilePath) {
+    // The segments of one output already use every core, so the outputs run one after another
+    int result = 0;
+    for (size_t i = 0; i < renditions_.size(); ++i) {
+        Rendition& rendition = renditions_[i];
+        int packetCount = 0;
+        SegmentedEncoder segmentedEncoder(inputFilePath, segmentCount_);
+        segmentedEncoder.setResamplerBackend(resamplerBackend_);
+        int ret = segmentedEncoder.run(frameReader_->getFormatContext(), rendition.spec,
+                                       [&](AVPacket* packet) {
+                                           deliverEncodedPacket(rendition, packet);
+                                           packetCount++;
+                                       });
+
+        std::cout << "Stitched " << packetCount << " packets" << std::endl;
+        if (ret < 0) {
+            result = -1;
+        }
     }
+    return result;
+}
 
-    // Set up server address
-    memset(&udpServerAddr_, 0, sizeof(udpServerAddr_));
-    udpServerAddr_.sin_family = AF_INET;
-    udpServerAddr_.sin_port = htons(serverPort);
-    udpServerAddr_.sin_addr.s_addr = inet_addr(serverIp.c_str());
+bool AudioProcessor::decodeFrames(const AVPacket* packet, AVFrame* frame,
+                                  const FrameCallback& onFrame) {
+    // Errors are reported by the decoder, the packet is skipped
+    if (frameDecoder_->sendPacket(packet) < 0) {
+        return true;
+    }
 
-    std::cout << "UDP client initialized to send to " << serverIp << ":" << serverPort << std::endl;
-    return 0;
+    while (frameDecoder_->receiveFrame(frame) >= 0) {
+        if (!onFrame(frame)) {
+            return false;
+        }
+    }
+    return true;
 }
 
-void AudioProcessor::closeUdpClient() {
-    if (udpSocket_ >= 0) {
-        close(udpSocket_);
-        udpSocket_ = -1;
+AudioProcessor::FrameQueues AudioProcessor::createFrameQueues() const {
+    FrameQueues frameQueues;
+    for (size_t i = 0; i < renditions_.size(); ++i) {
+        frameQueues.push_back(std::unique_ptr<BoundedQueue<FrameHandle>>(
+            new BoundedQueue<FrameHandle>(kPipelineQueueDepth)));
     }
+    return frameQueues;
 }
 
-int AudioProcessor::sendUdpData(const uint8_t* data, size_t length) {
-    if (udpSocket_ < 0) {
-        return -1;
+void AudioProcessor::resampleForOutputs(AVFrame* decodedFrame, FrameQueues& frameQueues) {
+    for (size_t stage = 0; stage < resamplers_.size(); ++stage) {
+        if (resamplers_[stage]->sendFrame(decodedFrame) < 0) {
+            static LogLimiter resampleErrors;
+            LogLine(kLogError, &resampleErrors) << "Failed to resample frame";
+            continue;
+        }
+        AVFrame* resampledFrame;
+        while ((resampledFrame = resamplers_[stage]->receiveFrame())) {
+            fanOut(stage, resampledFrame, frameQueues);
+        }
     }
+}
 
-    ssize_t bytesSent;
-    if (data == nullptr && length == 0) {
-        // Send end marker (0 bytes)
-        bytesSent =
-            sendto(udpSocket_, "", 0, 0, (struct sockaddr*)&udpServerAddr_, sizeof(udpServerAddr_));
-    } else {
-        bytesSent = sendto(udpSocket_, data, length, 0, (struct sockaddr*)&udpServerAddr_,
-                           sizeof(udpServerAddr_));
+void AudioProcessor::flushResamplers(FrameQueues& frameQueues) {
+    for (size_t stage = 0; stage < resamplers_.size(); ++stage) {
+        if (resamplers_[stage]->sendFrame(nullptr) < 0) {
+            continue;
+        }
+        AVFrame* flushedFrame;
+        while ((flushedFrame = resamplers_[stage]->receiveFrame())) {
+            fanOut(stage, flushedFrame, frameQueues);
+        }
     }
+}
 
-    if (bytesSent < 0) {
-        std::cerr << "Failed to send UDP data" << std::endl;
-        return -1;
+void AudioProcessor::fanOut(size_t stage, AVFrame* resampledFrame, FrameQueues& frameQueues) {
+    for (size_t i = 0; i < renditions_.size(); ++i) {
+        if (renditions_[i].stage != stage) {
+            continue;
+        }
+        // The resampler reuses its output frame, so every encoder gets a reference of its own
+        FrameHandle outputFrame = framePool_.acquire();
+        if (outputFrame && av_frame_ref(outputFrame.get(), resampledFrame) >= 0) {
+            frameQueues[i]->push(std::move(outputFrame));
+        }
     }
+}
+
+void AudioProcessor::encodeFrames(Rendition& rendition, BoundedQueue<FrameHandle>& frames,
+                                  const PacketCallback& onPacket) {
+    FrameEncoder* frameEncoder = rendition.encoder.get();
+    auto forwardEncodedPackets = [&] {
+        while (frameEncoder->hasEncodedPackets()) {
+            PacketHandle encodedPacket = frameEncoder->getNextEncodedPacket();
+            if (encodedPacket) {
+                onPacket(std::move(encodedPacket));
+            }
+        }
+    };
+
+    FrameHandle resampledFrame;
+    while (frames.pop(resampledFrame)) {
+#ifdef WRITE_PCM_DEBUG
+        write_s16p_frame_to_pcm(outfile, resampledFrame.get());
+#endif
+        int ret = frameEncoder->encodeFrame(resampledFrame.get());
+        resampledFrame.reset();
+        if (ret < 0) {
+            std::cerr << "Failed to encode frame for " << rendition.spec.toString() << std::endl;
+            rendition.encodeFailed = true;
+            break;
+        }
 
-    if (static_cast<size_t>(bytesSent) != length) {
-        std::cerr << "Warning: Incomplete UDP data sent. Sent " << bytesSent << " out of " << length
-                  << " bytes" << std::endl;
+        forwardEncodedPackets();
+    }
+    frames.close();
+    while (frames.tryPop(resampledFrame)) {
+        resampledFrame.reset();
     }
 
-    return static_cast<int>(bytesSent);
+    if (!rendition.encodeFailed && frameEncoder->flushEncoder() < 0) {
+        rendition.encodeFailed = true;
+    }
+    forwardEncodedPackets();
 }
 
-int AudioProcessor::initializeLocalOutputFile(AVCodecContext* codecContext) {
-    // Allocate format context for output
-    avformat_alloc_output_context2(&localFormatContext_, nullptr, nullptr,
-                                   localOutputFilePath_.c_str());
-    if (!localFormatContext_) {
-        std::cerr << "Could not create output context for local file" << std::endl;
+int AudioProcessor::openSinks(Rendition& rendition) {
+    AVCodecParameters* codecParameters = avcodec_parameters_alloc();
+    AVRational timeBase;
+    if (!codecParameters) {
         return -1;
     }
+    if (streamCopy_) {
+        // The sinks get the input stream as it is
+        AVStream* stream =
+            frameReader_->getFormatContext()->streams[frameDecoder_->getStreamIndex()];
+        timeBase = stream->time_base;
+        if (avcodec_parameters_copy(codecParameters, stream->codecpar) < 0) {
+            avcodec_parameters_free(&codecParameters);
+            return -1;
+        }
+    } else {
+        AVCodecContext* codecContext = rendition.encoder->getCodecContext();
+        timeBase = codecContext->time_base;
+        if (avcodec_parameters_from_context(codecParameters, codecContext) < 0) {
+            avcodec_parameters_free(&codecParameters);
+            return -1;
+        }
+    }
 
-    // Create output stream
-    AVStream* outStream = avformat_new_stream(localFormatContext_, nullptr);
-    if (!outStream) {
-        std::cerr << "Failed allocating output stream for local file" << std::endl;
-        return -1;
+    int ret = 0;
+    for (size_t i = 0; i < rendition.sinks.size(); ++i) {
+        SinkEntry& entry = rendition.sinks[i];
+        entry.failed = false;
+        if (entry.sink->open(codecParameters, timeBase) < 0) {
+            std::cerr << "Failed to open output " << entry.sink->description() << std::endl;
+            ret = -1;
+            break;
+        }
     }
 
-    // Copy codec parameters to output stream
-    avcodec_parameters_from_context(outStream->codecpar, codecContext);
+    avcodec_parameters_free(&codecParameters);
+    return ret;
+}
 
-    // Open output file
-    if (!(localFormatContext_->oformat->flags & AVFMT_NOFILE)) {
-        if (avio_open(&localFormatContext_->pb, localOutputFilePath_.c_str(), AVIO_FLAG_WRITE) <
-            0) {
-            std::cerr << "Could not open output file " << localOutputFilePath_ << std::endl;
-            return -1;
+void AudioProcessor::deliverQueuedPackets(Rendition& rendition) {
+    FrameEncoder* frameEncoder = rendition.encoder.get();
+    while (frameEncoder->hasEncodedPackets()) {
+        PacketHandle encodedPacket = frameEncoder->getNextEncodedPacket();
+        if (encodedPacket) {
+            deliverEncodedPacket(rendition, encodedPacket.get());
         }
     }
+}
 
-    // Write header
-    if (avformat_write_header(localFormatContext_, nullptr) < 0) {
-        std::cerr << "Error occurred when opening output file " << localOutputFilePath_
-                  << std::endl;
-        return -1;
+void AudioProcessor::deliverEncodedPacket(Rendition& rendition, const AVPacket* packet) {
+    for (size_t i = 0; i < rendition.sinks.size(); ++i) {
+        SinkEntry& entry = rendition.sinks[i];
+        if (!entry.failed && entry.sink->write(packet) < 0) {
+            std::cerr << "Failed to write to " << entry.sink->description()
+                      << ", stopping output to it" << std::endl;
+            entry.failed = true;
+        }
     }
-
-    return 0;
 }
 
-int AudioProcessor::writeLocalOutputPacket(AVPacket* packet) {
-    if (!localFormatContext_ || !packet) {
-        return -1;
+bool AudioProcessor::closeSinks(Rendition& rendition) {
+    bool ok = true;
+    for (size_t i = 0; i < rendition.sinks.size(); ++i) {
+        rendition.sinks[i].sink->close();
+        ok = ok && !rendition.sinks[i].failed;
     }
+    return ok;
+}
 
-    // Write packet to file
-    if (av_write_frame(localFormatContext_, packet) < 0) {
-        std::cerr << "Error writing packet to local output file" << std::endl;
-        return -1;
+// Helper function to convert string to lowercase
+std::string toLower(const std::string& str) {
+    std::string lowerStr = str;
+    std::transform(lowerStr.begin(), lowerStr.end(), lowerStr.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    return lowerStr;
+}
+
+// Helper function to get file extension
+std::string getFileExtension(const std::string& filePath) {
+    size_t dotPos = filePath.find_last_of('.');
+    if (dotPos != std::string::npos) {
+        return toLower(filePath.substr(dotPos + 1));
     }
+    return "";
+}
 
-    return 0;
+// Helper function to get codec ID based on file extension
+AVCodecID getCodecIdFromExtension(const std::string& filePath) {
+    AVCodecID codecId = OutputSpec::codecIdForExtension(getFileExtension(filePath));
+    // Default to MP3
+    return codecId != AV_CODEC_ID_NONE ? codecId : AV_CODEC_ID_MP3;
 }
 
-void AudioProcessor::closeLocalOutputFile() {
-    if (localFormatContext_) {
-        // Write trailer
-        av_write_trailer(localFormatContext_);
+// Helper function to generate output file name based on input file name and output format
+std::string generateOutputFileName(const std::string& inputFilePath, const OutputSpec& spec) {
+    // Extract just the file name without directory path
+    size_t slashPos = inputFilePath.find_last_of("/\\");
+    std::string fileName =
+        (slashPos != std::string::npos) ? inputFilePath.substr(slashPos + 1) : inputFilePath;
 
-        // Close output file
-        if (!(localFormatContext_->oformat->flags & AVFMT_NOFILE)) {
-            avio_closep(&localFormatContext_->pb);
-        }
+    // Extract base name without extension
+    size_t dotPos = fileName.find_last_of('.');
+    std::string baseName = (dotPos != std::string::npos) ? fileName.substr(0, dotPos) : fileName;
 
-        // Free format context
-        avformat_free_context(localFormatContext_);
-        localFormatContext_ = nullptr;
-    }
-}
\ No newline at end of file
+    return baseName + "_" + std::to_string(spec.sampleRate) + "." + spec.fileExtension();
+}
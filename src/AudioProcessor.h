@@ -1,8 +1,10 @@
 #ifndef AUDIO_PROCESSOR_H
 #define AUDIO_PROCESSOR_H
 
+#include <functional>
 #include <memory>
 #include <string>
+#include <vector>
 
 extern "C" {
 #include <libavcodec/avcodec.h>
@@ -13,47 +15,121 @@ extern "C" {
 #include <libswresample/swresample.h>
 }
 
-#include <arpa/inet.h>
-#include <netinet/in.h>
-#include <sys/socket.h>
-
 // Forward declarations for helper functions
 std::string getFileExtension(const std::string& filePath);
 AVCodecID getCodecIdFromExtension(const std::string& filePath);
-std::string generateOutputFileName(const std::string& inputFilePath, AVCodecID codecId);
 
+#include "AVObjectPool.h"
+#include "BoundedQueue.h"
 #include "FrameDecoder.h"
 #include "FrameEncoder.h"
 #include "FrameReader.h"
+#include "OutputSpec.h"
+#include "PacketSink.h"
 #include "Resampler.h"
+#include "UdpSink.h"
+
+// <name>_<rate>.<ext> in the working directory
+std::string generateOutputFileName(const std::string& inputFilePath, const OutputSpec& spec);
 
 class AudioProcessor {
   public:
     AudioProcessor();
     ~AudioProcessor();
 
+    // Without registered outputs the input is encoded once to MP3 320k, 48 kHz stereo. An
+    // output without registered sinks is written to <name>_48000.mp3 and sent to
+    // serverIp:serverPort over UDP; with several outputs each default file name carries the
+    // bitrate (<name>_48000_128k.mp3) and nothing is sent over UDP.
     int processAudio(const std::string& inputFilePath, const std::string& serverIp = "127.0.0.1",
                      int serverPort = 8080);
 
+    // Adds an encoded output and returns its index. The input is decoded once and resampled
+    // once per distinct sample rate and channel count; each output has its own encoder.
+    int addOutput(const OutputSpec& spec);
+
+    // Every packet of an output is passed once to each of its sinks, in registration order.
+    // The sink is attached to the most recently added output (a default one if there is none).
+    void addSink(std::unique_ptr<PacketSink> sink);
+
+    // Run read, decode, resample, encode and the sinks on separate threads joined by
+    // bounded queues. The output is identical to the serial path.
+    void setPipelined(bool enabled);
+
+    // Split long inputs into this many time segments and encode them in parallel
+    // (0 or 1: off). Inputs that are short or not seekable are encoded normally.
+    void setSegmentCount(int segmentCount);
+
+    // When the input stream already matches every output (codec, bitrate, sample rate and
+    // channels), copy its packets to the sinks without decoding. On by default.
+    void setStreamCopy(bool enabled);
+
+    // Sample rate conversion backend, swr by default
+    void setResamplerBackend(Resampler::Backend backend);
+
+    // Transport and batching of the default UDP sink, see UdpSink
+    void setUdpOptions(const UdpSinkOptions& options);
+
   private:
+    static const size_t kPipelineQueueDepth = 16;
+
+    typedef std::function<bool(AVFrame*)> FrameCallback;
+    typedef std::function<void(PacketHandle)> PacketCallback;
+    typedef std::vector<std::unique_ptr<BoundedQueue<FrameHandle>>> FrameQueues;
+
+    struct SinkEntry {
+        std::unique_ptr<PacketSink> sink;
+        bool failed;
+    };
+
+    struct Rendition {
+        OutputSpec spec;
+        size_t stage;  // index of the resampler feeding the encoder
+        std::unique_ptr<FrameEncoder> encoder;
+        std::vector<SinkEntry> sinks;
+        bool defaultSinks;
+        bool encodeFailed;  // the encoder stopped early, the output is incomplete
+    };
+
     std::unique_ptr<FrameReader> frameReader_;
     std::unique_ptr<FrameDecoder> frameDecoder_;
-    std::unique_ptr<Resampler> resampler_;
-    std::unique_ptr<FrameEncoder> frameEncoder_;
-
-    // Local output file members
-    AVFormatContext* localFormatContext_;
-    std::string localOutputFilePath_;
-    int initializeLocalOutputFile(AVCodecContext* codecContext);
-    int writeLocalOutputPacket(AVPacket* packet);
-    void closeLocalOutputFile();
-
-    // UDP client members
-    int udpSocket_;
-    struct sockaddr_in udpServerAddr_;
-    int initUdpClient(const std::string& serverIp, int serverPort);
-    void closeUdpClient();
-    int sendUdpData(const uint8_t* data, size_t length);
+    std::vector<std::unique_ptr<Resampler>> resamplers_;
+    std::vector<Rendition> renditions_;
+    // Decoded frames and references to resampled frames handed to other threads
+    FramePool framePool_;
+    bool pipelined_;
+    int segmentCount_;
+    bool streamCopyEnabled_;
+    bool streamCopy_;  // the current input is being copied
+    Resampler::Backend resamplerBackend_;
+    UdpSinkOptions udpOptions_;
+
+    int initializeRenditions();
+    void closeComponents();
+
+    bool inputMatchesOutputs() const;
+    // Every output can be encoded in segments (MP3, long and seekable input)
+    bool inputSplitsForOutputs() const;
+    void runStreamCopy(int& packetCount);
+    void runSerial(int& frameCount);
+    void runPipelined(int& frameCount);
+    int runSegmented(const std::string& inputFilePath);
+
+    // Decodes packet (nullptr: drains the decoder) into frame and calls onFrame for every
+    // frame produced. Returns false if onFrame asked to stop.
+    bool decodeFrames(const AVPacket* packet, AVFrame* frame, const FrameCallback& onFrame);
+    FrameQueues createFrameQueues() const;
+    void resampleForOutputs(AVFrame* decodedFrame, FrameQueues& frameQueues);
+    void flushResamplers(FrameQueues& frameQueues);
+    void fanOut(size_t stage, AVFrame* resampledFrame, FrameQueues& frameQueues);
+    void encodeFrames(Rendition& rendition, BoundedQueue<FrameHandle>& frames,
+                      const PacketCallback& onPacket);
+
+    int openSinks(Rendition& rendition);
+    void deliverQueuedPackets(Rendition& rendition);
+    void deliverEncodedPacket(Rendition& rendition, const AVPacket* packet);
+    // Returns true if every sink of the output wrote every packet
+    bool closeSinks(Rendition& rendition);
 };
 
-#endif  // AUDIO_PROCESSOR_H
\ No newline at end of file
+#endif  // AUDIO_PROCESSOR_H
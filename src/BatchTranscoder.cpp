@@ -0,0 +1,300 @@
+#include "BatchTranscoder.h"
+
+#include <dirent.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <thread>
+
+#include "AudioProcessor.h"
+#include "FileSink.h"
+
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavutil/avutil.h>
+}
+
+BatchTranscoder::BatchTranscoder(int workerCount)
+    : workerCount_(workerCount > 0 ? workerCount : 1),
+      pipelined_(false),
+      streamCopy_(true),
+      resamplerBackend_(Resampler::kBackendSwr) {}
+
+int BatchTranscoder::addInputs(const std::string& directoryOrListFile) {
+    struct stat info;
+    if (stat(directoryOrListFile.c_str(), &info) < 0) {
+        std::cerr << "Could not access batch input " << directoryOrListFile << std::endl;
+        return -1;
+    }
+
+    if (S_ISDIR(info.st_mode)) {
+        return addDirectory(directoryOrListFile);
+    }
+    return addListFile(directoryOrListFile);
+}
+
+void BatchTranscoder::setPipelined(bool enabled) { pipelined_ = enabled; }
+
+void BatchTranscoder::setStreamCopy(bool enabled) { streamCopy_ = enabled; }
+
+void BatchTranscoder::setOutputSpec(const OutputSpec& spec) { outputSpec_ = spec; }
+
+void BatchTranscoder::setResamplerBackend(Resampler::Backend backend) {
+    resamplerBackend_ = backend;
+}
+
+int BatchTranscoder::addDirectory(const std::string& directoryPath) {
+    DIR* dir = opendir(directoryPath.c_str());
+    if (!dir) {
+        std::cerr << "Could not open directory " << directoryPath << std::endl;
+        return -1;
+    }
+
+    std::vector<std::string> files;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        std::string name = entry->d_name;
+        if (name == "." || name == "..") {
+            continue;
+        }
+
+        std::string filePath = directoryPath + "/" + name;
+        struct stat info;
+        if (stat(filePath.c_str(), &info) == 0 && S_ISREG(info.st_mode) && isAudioFile(name)) {
+            files.push_back(filePath);
+        }
+    }
+    closedir(dir);
+
+    // readdir order is arbitrary, keep the job list reproducible
+    std::sort(files.begin(), files.end());
+    for (size_t i = 0; i < files.size(); ++i) {
+        addJob(files[i]);
+    }
+    return 0;
+}
+
+int BatchTranscoder::addListFile(const std::string& listFilePath) {
+    std::ifstream listFile(listFilePath);
+    if (!listFile) {
+        std::cerr << "Could not open list file " << listFilePath << std::endl;
+        return -1;
+    }
+
+    std::string line;
+    while (std::getline(listFile, line)) {
+        // Trim surrounding whitespace
+        size_t begin = line.find_first_not_of(" \t\r");
+        if (begin == std::string::npos || line[begin] == '#') {
+            continue;
+        }
+        size_t end = line.find_last_not_of(" \t\r");
+        addJob(line.substr(begin, end - begin + 1));
+    }
+    return 0;
+}
+
+void BatchTranscoder::addJob(const std::string& inputFilePath) {
+    Job job;
+    job.inputFilePath = inputFilePath;
+    job.durationSeconds = 0.0;
+    job.elapsedSeconds = 0.0;
+    job.result = -1;
+    jobs_.push_back(job);
+}
+
+template <typename Function>
+void BatchTranscoder::forEachJob(Function function) {
+    std::atomic<size_t> nextJob(0);
+    std::vector<std::thread> workers;
+
+    int threadCount = std::min<int>(workerCount_, static_cast<int>(jobs_.size()));
+    for (int i = 0; i < threadCount; ++i) {
+        workers.push_back(std::thread([&] {
+            size_t index;
+            while ((index = nextJob.fetch_add(1)) < jobs_.size()) {
+                function(index);
+            }
+        }));
+    }
+
+    for (size_t i = 0; i < workers.size(); ++i) {
+        workers[i].join();
+    }
+}
+
+int BatchTranscoder::run() {
+    if (jobs_.empty()) {
+        std::cerr << "No input files for batch" << std::endl;
+        return -1;
+    }
+
+    if (planOutputs() < 0) {
+        return -1;
+    }
+
+    avformat_network_init();
+
+    // Probe durations in parallel, then schedule the longest jobs first
+    forEachJob([this](size_t index) {
+        jobs_[index].durationSeconds = probeDuration(jobs_[index].inputFilePath);
+    });
+    std::stable_sort(jobs_.begin(), jobs_.end(), [](const Job& a, const Job& b) {
+        return a.durationSeconds > b.durationSeconds;
+    });
+
+    std::cout << "Batch: " << jobs_.size() << " files on " << workerCount_ << " workers"
+              << std::endl;
+
+    std::chrono::steady_clock::time_point batchStart = std::chrono::steady_clock::now();
+    forEachJob([this](size_t index) {
+        Job& job = jobs_[index];
+        std::chrono::steady_clock::time_point jobStart = std::chrono::steady_clock::now();
+
+        // Jobs run concurrently, so each only writes its own output file and skips the
+        // shared UDP stream
+        AudioProcessor processor;
+        processor.setPipelined(pipelined_);
+        processor.setStreamCopy(streamCopy_);
+        processor.setResamplerBackend(resamplerBackend_);
+        processor.addOutput(outputSpec_);
+        processor.addSink(std::unique_ptr<PacketSink>(
+            new FileSink(job.outputFilePath)));
+        job.result = processor.processAudio(job.inputFilePath);
+
+        job.elapsedSeconds =
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - jobStart).count();
+    });
+    double wallSeconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - batchStart).count();
+
+    size_t succeeded = 0;
+    double mediaSeconds = 0.0;
+    const Job* slowest = &jobs_[0];
+    std::cerr << std::fixed << std::setprecision(2);
+    for (size_t i = 0; i < jobs_.size(); ++i) {
+        if (jobs_[i].result == 0) {
+            succeeded++;
+            mediaSeconds += jobs_[i].durationSeconds;
+        } else {
+            std::cerr << "Failed: " << jobs_[i].inputFilePath << " after "
+                      << jobs_[i].elapsedSeconds << " s" << std::endl;
+        }
+        if (jobs_[i].elapsedSeconds > slowest->elapsedSeconds) {
+            slowest = &jobs_[i];
+        }
+    }
+
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "Batch completed: " << succeeded << "/" << jobs_.size() << " files in "
+              << wallSeconds << " s" << std::endl;
+    if (wallSeconds > 0.0) {
+        std::cout << "Throughput: " << succeeded / wallSeconds << " files/s, "
+                  << mediaSeconds / wallSeconds << "x realtime (" << mediaSeconds
+                  << " s of audio)" << std::endl;
+    }
+    // The batch cannot end before its slowest file, whatever the worker count
+    std::cout << "Slowest: " << slowest->inputFilePath << " in " << slowest->elapsedSeconds
+              << " s (" << slowest->durationSeconds << " s of audio)" << std::endl;
+
+    return succeeded == jobs_.size() ? 0 : -1;
+}
+
+// The directory part of path with its trailing slash, empty for a bare file name
+static std::string directoryOf(const std::string& path) {
+    size_t slashPos = path.find_last_of('/');
+    return slashPos != std::string::npos ? path.substr(0, slashPos + 1) : std::string();
+}
+
+// path with its directory resolved, so that two spellings of one file compare equal
+static std::string resolvedPath(const std::string& path) {
+    std::string directory = directoryOf(path);
+    char resolved[PATH_MAX];
+    if (!realpath(directory.empty() ? "." : directory.c_str(), resolved)) {
+        return path;
+    }
+    return std::string(resolved) + "/" + path.substr(directory.size());
+}
+
+int BatchTranscoder::planOutputs() {
+    std::map<std::string, size_t> outputs;
+    for (size_t i = 0; i < jobs_.size(); ++i) {
+        Job& job = jobs_[i];
+        job.outputFilePath =
+            directoryOf(job.inputFilePath) + generateOutputFileName(job.inputFilePath, outputSpec_);
+        job.outputKey = resolvedPath(job.outputFilePath);
+        outputs.insert(std::make_pair(job.outputKey, i));
+    }
+
+    std::vector<Job> jobs;
+    for (size_t i = 0; i < jobs_.size(); ++i) {
+        std::map<std::string, size_t>::const_iterator producer =
+            outputs.find(resolvedPath(jobs_[i].inputFilePath));
+        if (producer != outputs.end()) {
+            std::cout << "Skipping " << jobs_[i].inputFilePath << ", it is the output of "
+                      << jobs_[producer->second].inputFilePath << std::endl;
+        } else {
+            jobs.push_back(jobs_[i]);
+        }
+    }
+    jobs_.swap(jobs);
+
+    // Two jobs writing one file would interleave their packets
+    outputs.clear();
+    int result = 0;
+    for (size_t i = 0; i < jobs_.size(); ++i) {
+        std::pair<std::map<std::string, size_t>::iterator, bool> inserted =
+            outputs.insert(std::make_pair(jobs_[i].outputKey, i));
+        if (!inserted.second) {
+            std::cerr << "Inputs " << jobs_[inserted.first->second].inputFilePath << " and "
+                      << jobs_[i].inputFilePath << " would both be written to "
+                      << jobs_[i].outputFilePath << std::endl;
+            result = -1;
+        }
+    }
+    if (jobs_.empty()) {
+        std::cerr << "No input files for batch" << std::endl;
+        return -1;
+    }
+    return result;
+}
+
+double BatchTranscoder::probeDuration(const std::string& inputFilePath) {
+    AVFormatContext* formatContext = nullptr;
+    if (avformat_open_input(&formatContext, inputFilePath.c_str(), nullptr, nullptr) < 0) {
+        return 0.0;
+    }
+
+    double duration = 0.0;
+    if (avformat_find_stream_info(formatContext, nullptr) >= 0) {
+        if (formatContext->duration != AV_NOPTS_VALUE) {
+            duration = formatContext->duration / static_cast<double>(AV_TIME_BASE);
+        } else {
+            int streamIndex =
+                av_find_best_stream(formatContext, AVMEDIA_TYPE_AUDIO, -1, -1, nullptr, 0);
+            if (streamIndex >= 0) {
+                AVStream* stream = formatContext->streams[streamIndex];
+                if (stream->duration != AV_NOPTS_VALUE) {
+                    duration = stream->duration * av_q2d(stream->time_base);
+                }
+            }
+        }
+    }
+
+    avformat_close_input(&formatContext);
+    return duration;
+}
+
+bool BatchTranscoder::isAudioFile(const std::string& filePath) {
+    std::string ext = getFileExtension(filePath);
+    return ext == "mp3" || ext == "wav" || ext == "aac" || ext == "flac" || ext == "ogg" ||
+           ext == "oga" || ext == "m4a" || ext == "mp4";
+}
@@ -0,0 +1,71 @@
+#ifndef BATCH_TRANSCODER_H
+#define BATCH_TRANSCODER_H
+
+#include <string>
+#include <vector>
+
+#include "OutputSpec.h"
+#include "Resampler.h"
+
+// Runs many AudioProcessor jobs in one process on a fixed pool of worker threads.
+// Inputs are probed first and scheduled longest first so the pool does not idle on a
+// single long file at the end of the batch. Each output is written next to its input, named
+// as generateOutputFileName() does.
+class BatchTranscoder {
+  public:
+    explicit BatchTranscoder(int workerCount);
+
+    // Adds every audio file in a directory, or every path listed in a text file
+    // (one per line, '#' starts a comment)
+    int addInputs(const std::string& directoryOrListFile);
+
+    // Pipelined processing inside each job
+    void setPipelined(bool enabled);
+
+    // Copy inputs that already match the output instead of re-encoding them (default on)
+    void setStreamCopy(bool enabled);
+
+    // Format every job is encoded to (default MP3 320k, 48 kHz stereo)
+    void setOutputSpec(const OutputSpec& spec);
+
+    // Sample rate conversion backend of every job
+    void setResamplerBackend(Resampler::Backend backend);
+
+    // Returns 0 if every job succeeded, -1 without running any if two inputs would be
+    // written to the same output file
+    int run();
+
+  private:
+    struct Job {
+        std::string inputFilePath;
+        std::string outputFilePath;
+        std::string outputKey;  // outputFilePath with the directory resolved, for comparing
+        double durationSeconds;
+        double elapsedSeconds;  // wall time of the job, reported for failures and the slowest
+        int result;
+    };
+
+    int workerCount_;
+    bool pipelined_;
+    bool streamCopy_;
+    Resampler::Backend resamplerBackend_;
+    OutputSpec outputSpec_;
+    std::vector<Job> jobs_;
+
+    int addDirectory(const std::string& directoryPath);
+    int addListFile(const std::string& listFilePath);
+    void addJob(const std::string& inputFilePath);
+
+    // Runs function(index) for every job index on the worker pool
+    template <typename Function>
+    void forEachJob(Function function);
+
+    // Skips the inputs that are the output of another job, left by an earlier run, and
+    // returns -1 if two jobs have the same output
+    int planOutputs();
+
+    static double probeDuration(const std::string& inputFilePath);
+    static bool isAudioFile(const std::string& filePath);
+};
+
+#endif  // BATCH_TRANSCODER_H
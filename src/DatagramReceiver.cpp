@@ -0,0 +1,59 @@
+#include "DatagramReceiver.h"
+
+#include <errno.h>
+#include <poll.h>
+
+#include <cstring>
+
+DatagramReceiver::DatagramReceiver(int batchSize)
+    : batchSize_(batchSize > 0 ? batchSize : 1),
+      slab_(new uint8_t[batchSize_ * kMaxDatagramSize]),
+      messages_(batchSize_),
+      iovecs_(batchSize_),
+      sources_(batchSize_),
+      full_(false),
+      datagrams_(0),
+      calls_(0) {
+    memset(messages_.data(), 0, messages_.size() * sizeof(mmsghdr));
+    for (int i = 0; i < batchSize_; ++i) {
+        iovecs_[i].iov_base = slab_.get() + i * kMaxDatagramSize;
+        iovecs_[i].iov_len = kMaxDatagramSize;
+        messages_[i].msg_hdr.msg_iov = &iovecs_[i];
+        messages_[i].msg_hdr.msg_iovlen = 1;
+        messages_[i].msg_hdr.msg_name = &sources_[i];
+    }
+}
+
+int DatagramReceiver::receive(int socket, int timeoutMs) {
+    if (!full_) {
+        struct pollfd descriptor;
+        descriptor.fd = socket;
+        descriptor.events = POLLIN;
+        descriptor.revents = 0;
+        int ready = poll(&descriptor, 1, timeoutMs);
+        if (ready <= 0) {
+            return ready;
+        }
+    }
+
+    return read(socket);
+}
+
+int DatagramReceiver::read(int socket) {
+    // The kernel overwrites the address lengths
+    for (int i = 0; i < batchSize_; ++i) {
+        messages_[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+        messages_[i].msg_len = 0;
+    }
+    int count = recvmmsg(socket, messages_.data(), batchSize_, MSG_DONTWAIT, nullptr);
+    if (count < 0) {
+        full_ = false;
+        // Readable but drained meanwhile, the guess after a full batch was wrong, or a
+        // signal (the server's stop) came in
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1;
+    }
+    full_ = count == batchSize_;
+    datagrams_ += count;
+    calls_++;
+    return count;
+}
@@ -0,0 +1,58 @@
+#ifndef DATAGRAM_RECEIVER_H
+#define DATAGRAM_RECEIVER_H
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Receives the datagrams of a UDP socket in batches: one poll() for readiness, then one
+// recvmmsg() for up to batchSize datagrams. The datagrams land in a slab of batchSize
+// buffers of kMaxDatagramSize bytes allocated once, big enough for any UDP payload, and
+// stay there until the next receive(), so they can be handed on without copying. The slab
+// is not initialized, so pages the kernel never writes are never touched.
+//
+// After a full batch more datagrams are likely queued and the next receive() skips poll().
+// The buffers can serve several sockets in turn.
+class DatagramReceiver {
+  public:
+    static const int kDefaultBatchSize = 32;
+    static const size_t kMaxDatagramSize = 65536;
+
+    explicit DatagramReceiver(int batchSize = kDefaultBatchSize);
+
+    // Waits up to timeoutMs (negative waits forever) for datagrams on socket and receives
+    // them. Returns how many, 0 on timeout, or -1 with errno set on error.
+    int receive(int socket, int timeoutMs);
+    // Receives the datagrams already queued on socket, for callers that wait for readiness
+    // themselves (with epoll). Returns how many, or -1 with errno set on error.
+    int read(int socket);
+
+    // Datagram i of the last receive() or read()
+    const uint8_t* data(int i) const { return slab_.get() + i * kMaxDatagramSize; }
+    size_t size(int i) const { return messages_[i].msg_len; }
+    const sockaddr_in& source(int i) const { return sources_[i]; }
+
+    int batchSize() const { return batchSize_; }
+    uint64_t datagrams() const { return datagrams_; }
+    uint64_t calls() const { return calls_; }  // recvmmsg() calls that returned datagrams
+
+  private:
+    int batchSize_;
+    std::unique_ptr<uint8_t[]> slab_;
+    std::vector<mmsghdr> messages_;
+    std::vector<iovec> iovecs_;
+    std::vector<sockaddr_in> sources_;
+    bool full_;  // the last batch filled every buffer
+    uint64_t datagrams_;
+    uint64_t calls_;
+
+    DatagramReceiver(const DatagramReceiver&);
+    DatagramReceiver& operator=(const DatagramReceiver&);
+};
+
+#endif  // DATAGRAM_RECEIVER_H
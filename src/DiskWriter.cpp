@@ -0,0 +1,347 @@
+#include "DiskWriter.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+
+#include "Log.h"
+
+// How long the writer sleeps with nothing queued when no periodic sync wakes it
+static const int kIdleWakeMs = 1000;
+
+DiskWriter::DiskWriter(const DiskWriterOptions& options)
+    : options_(options),
+      queuedBytes_(0),
+      stopping_(false),
+      nextFile_(0),
+      bytesWritten_(0),
+      bytesDropped_(0),
+      writeCalls_(0),
+      syncs_(0),
+      batches_(0) {
+    thread_ = std::thread(&DiskWriter::writeLoop, this);
+}
+
+DiskWriter::~DiskWriter() { finish(); }
+
+void DiskWriter::finish() {
+    if (!thread_.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wakeUp_.notify_one();
+    thread_.join();
+}
+
+int DiskWriter::open(const std::string& path) {
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        LogLine(kLogError) << "Could not open output file " << path << ": " << strerror(errno);
+        return -1;
+    }
+    Operation operation;
+    operation.kind = Operation::kOpen;
+    operation.fd = fd;
+    operation.path = path;
+    operation.offset = 0;
+    int file;
+    bool wake;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        file = nextFile_++;
+        operation.file = file;
+        wake = queue_.empty();
+        if (wake) {
+            oldestQueued_ = Clock::now();
+        }
+        queue_.push_back(std::move(operation));
+    }
+    if (wake) {
+        wakeUp_.notify_one();
+    }
+    return file;
+}
+
+bool DiskWriter::write(int file, int64_t offset, std::vector<uint8_t>& data) {
+    Operation operation;
+    operation.kind = Operation::kWrite;
+    operation.file = file;
+    operation.fd = -1;
+    operation.offset = offset;
+    size_t size = data.size();
+    bool wake;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (queuedBytes_ + size > options_.maxQueuedBytes) {
+            bytesDropped_ += size;
+            data.clear();
+            return false;
+        }
+        operation.data.swap(data);
+        // The writer sleeps until the oldest operation is due, the first one sets that time
+        wake = queue_.empty();
+        if (wake) {
+            oldestQueued_ = Clock::now();
+        }
+        queue_.push_back(std::move(operation));
+        queuedBytes_ += size;
+        wake = wake || (queuedBytes_ >= options_.flushBytes &&
+                        queuedBytes_ - size < options_.flushBytes);
+    }
+    if (wake) {
+        wakeUp_.notify_one();
+    }
+    return true;
+}
+
+void DiskWriter::close(int file) {
+    Operation operation;
+    operation.kind = Operation::kClose;
+    operation.file = file;
+    operation.fd = -1;
+    operation.offset = 0;
+    bool wake;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        wake = queue_.empty();
+        if (wake) {
+            oldestQueued_ = Clock::now();
+        }
+        queue_.push_back(std::move(operation));
+    }
+    if (wake) {
+        wakeUp_.notify_one();
+    }
+}
+
+uint64_t DiskWriter::bytesWritten() const { return bytesWritten_; }
+
+uint64_t DiskWriter::bytesDropped() const { return bytesDropped_; }
+
+std::string DiskWriter::toString() const {
+    std::ostringstream stream;
+    uint64_t calls = writeCalls_;
+    stream << std::fixed << std::setprecision(1) << bytesWritten_ / 1e6 << " MB in " << calls
+           << " writes (" << (calls ? bytesWritten_ / 1e3 / calls : 0.0) << " KB each) and "
+           << batches_ << " batches, " << syncs_ << " syncs, " << bytesDropped_
+           << " bytes dropped";
+    return stream.str();
+}
+
+void DiskWriter::writeLoop() {
+    std::chrono::milliseconds flushInterval(options_.flushMs);
+    std::chrono::milliseconds idleInterval(options_.syncMs > 0 ? options_.syncMs : kIdleWakeMs);
+    std::deque<Operation> batch;
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+        // A batch is due when flushBytes are queued, when the oldest queued operation has
+        // waited flushMs, or at the end
+        Clock::time_point now = Clock::now();
+        bool due = stopping_ || queuedBytes_ >= options_.flushBytes ||
+                   (!queue_.empty() && now >= oldestQueued_ + flushInterval);
+        if (!due) {
+            wakeUp_.wait_until(lock, queue_.empty() ? now + idleInterval
+                                                    : oldestQueued_ + flushInterval);
+            lock.unlock();
+            syncDue(Clock::now());
+            lock.lock();
+            continue;
+        }
+        if (queue_.empty()) {
+            break;  // stopping_ with nothing left
+        }
+        batch.swap(queue_);
+        queuedBytes_ = 0;
+        lock.unlock();
+
+        writeBatch(batch);
+        batch.clear();
+        syncDue(Clock::now());
+        lock.lock();
+    }
+    lock.unlock();
+
+    // Files the producers did not close
+    for (std::unordered_map<int, File>::iterator it = files_.begin(); it != files_.end();
+         ++it) {
+        closeFile(it->second);
+    }
+    files_.clear();
+}
+
+void DiskWriter::writeBatch(std::deque<Operation>& batch) {
+    batches_++;
+
+    // The operations of each file in order, files in the order they first appear
+    std::unordered_map<int, std::vector<Operation*> > perFile;
+    std::vector<int> order;
+    for (size_t i = 0; i < batch.size(); ++i) {
+        std::vector<Operation*>& ops = perFile[batch[i].file];
+        if (ops.empty()) {
+            order.push_back(batch[i].file);
+        }
+        ops.push_back(&batch[i]);
+    }
+
+    for (size_t f = 0; f < order.size(); ++f) {
+        const std::vector<Operation*>& ops = perFile[order[f]];
+        size_t i = 0;
+        while (i < ops.size()) {
+            Operation& operation = *ops[i];
+            if (operation.kind == Operation::kOpen) {
+                File& file = files_[operation.file];
+                file.fd = operation.fd;
+                file.path = operation.path;
+                file.size = 0;
+                file.allocated = 0;
+                file.dirty = false;
+                file.failed = false;
+                file.lastSync = Clock::now();
+                ++i;
+                continue;
+            }
+            std::unordered_map<int, File>::iterator file = files_.find(operation.file);
+            if (file == files_.end()) {
+                ++i;
+                continue;
+            }
+            if (operation.kind == Operation::kClose) {
+                closeFile(file->second);
+                files_.erase(file);
+                ++i;
+                continue;
+            }
+
+            // The writes that continue each other, up to what one pwritev() takes
+            size_t end = i + 1;
+            while (end < ops.size() && end - i < IOV_MAX && ops[end]->kind == Operation::kWrite) {
+                const Operation& previous = *ops[end - 1];
+                if (ops[end]->offset !=
+                    previous.offset + static_cast<int64_t>(previous.data.size())) {
+                    break;
+                }
+                ++end;
+            }
+            writeRun(file->second, ops, i, end);
+            i = end;
+        }
+    }
+}
+
+void DiskWriter::writeRun(File& file, const std::vector<Operation*>& ops, size_t begin,
+                          size_t end) {
+    std::vector<struct iovec> iov;
+    iov.reserve(end - begin);
+    size_t total = 0;
+    for (size_t i = begin; i < end; ++i) {
+        struct iovec part;
+        part.iov_base = ops[i]->data.data();
+        part.iov_len = ops[i]->data.size();
+        iov.push_back(part);
+        total += part.iov_len;
+    }
+    int64_t offset = ops[begin]->offset;
+    preallocate(file, offset + static_cast<int64_t>(total));
+
+    size_t first = 0;
+    size_t left = total;
+    while (left > 0) {
+        ssize_t written = pwritev(file.fd, &iov[first], static_cast<int>(iov.size() - first),
+                                  offset);
+        writeCalls_++;
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (!file.failed) {
+                LogLine(kLogError) << "Error writing " << file.path << ": " << strerror(errno);
+                file.failed = true;
+            }
+            bytesDropped_ += left;
+            break;
+        }
+        // A short write, resume after what went out
+        bytesWritten_ += written;
+        offset += written;
+        left -= written;
+        size_t remaining = static_cast<size_t>(written);
+        while (first < iov.size() && remaining >= iov[first].iov_len) {
+            remaining -= iov[first].iov_len;
+            ++first;
+        }
+        if (first < iov.size()) {
+            iov[first].iov_base = static_cast<uint8_t*>(iov[first].iov_base) + remaining;
+            iov[first].iov_len -= remaining;
+        }
+    }
+    file.size = std::max(file.size, offset);
+    file.dirty = true;
+}
+
+void DiskWriter::preallocate(File& file, int64_t end) {
+    if (options_.preallocateBytes == 0 || file.allocated < 0 || end <= file.allocated) {
+        return;
+    }
+    int64_t step = static_cast<int64_t>(options_.preallocateBytes);
+    int64_t allocated = (end + step - 1) / step * step;
+    // FALLOC_FL_KEEP_SIZE reserves the blocks without moving the end of file, so a reader
+    // never sees the reserved space as zeros
+    if (fallocate(file.fd, FALLOC_FL_KEEP_SIZE, file.allocated, allocated - file.allocated) <
+        0) {
+        file.allocated = -1;  // not supported here, write without it
+        return;
+    }
+    file.allocated = allocated;
+}
+
+void DiskWriter::closeFile(File& file) {
+    // Give back the preallocated blocks past the end of the data
+    if (file.allocated > file.size) {
+        if (ftruncate(file.fd, file.size) < 0) {
+            LogLine(kLogError) << "Could not trim " << file.path << ": " << strerror(errno);
+        }
+    }
+    if (options_.syncMs >= 0 && file.dirty) {
+        syncFile(file);
+    }
+    if (::close(file.fd) < 0) {
+        LogLine(kLogError) << "Error closing " << file.path << ": " << strerror(errno);
+    }
+}
+
+void DiskWriter::syncFile(File& file) {
+    if (fdatasync(file.fd) < 0) {
+        if (!file.failed) {
+            LogLine(kLogError) << "Error syncing " << file.path << ": " << strerror(errno);
+            file.failed = true;
+        }
+        return;
+    }
+    syncs_++;
+}
+
+void DiskWriter::syncDue(Clock::time_point now) {
+    if (options_.syncMs <= 0) {
+        return;
+    }
+    std::chrono::milliseconds interval(options_.syncMs);
+    for (std::unordered_map<int, File>::iterator it = files_.begin(); it != files_.end();
+         ++it) {
+        File& file = it->second;
+        if (file.dirty && now - file.lastSync >= interval) {
+            syncFile(file);
+            file.dirty = false;
+            file.lastSync = now;
+        }
+    }
+}
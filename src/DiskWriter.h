@@ -0,0 +1,119 @@
+#ifndef DISK_WRITER_H
+#define DISK_WRITER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// How DiskWriter batches and persists what it writes
+struct DiskWriterOptions {
+    int flushMs;              // longest a queued write waits for its batch to grow
+    size_t flushBytes;        // queued bytes that start a batch at once
+    int syncMs;               // fdatasync() interval per file, 0 only at close, -1 never
+    size_t preallocateBytes;  // files grow in fallocate() steps of this size, 0 does not
+    size_t maxQueuedBytes;    // writes beyond this are dropped instead of waiting for disk
+
+    DiskWriterOptions()
+        : flushMs(100),
+          flushBytes(1 << 20),
+          syncMs(-1),
+          preallocateBytes(8 << 20),
+          maxQueuedBytes(256 << 20) {}
+};
+
+// Moves file writes off the threads that produce the data, so a slow disk cannot stall
+// them. Writes are queued with their file offset and taken by a writer thread in batches,
+// when flushBytes are queued or the oldest write has waited flushMs. The writes of a batch
+// are grouped per file and contiguous ones go to the kernel together, one pwritev() for up
+// to IOV_MAX of them. Files grow in preallocated steps, and the steps left over are given
+// back at close.
+//
+// Producers never block on the disk: when more than maxQueuedBytes wait, further writes are
+// dropped and counted. open() creates the file on the calling thread, so that failure is
+// reported at once; everything after it happens on the writer thread, which alone keeps
+// the state of open files. All methods are thread-safe.
+class DiskWriter {
+  public:
+    explicit DiskWriter(const DiskWriterOptions& options = DiskWriterOptions());
+    ~DiskWriter();
+
+    // Writes what is queued, closes the files and joins the writer thread. Nothing may be
+    // queued after it; the destructor calls it if needed.
+    void finish();
+
+    // Creates or truncates path. Returns a file id, or -1.
+    int open(const std::string& path);
+    // Queues data for offset in file; data is swapped out, leaving the caller an empty
+    // buffer. Returns false if the write was dropped because the queue is full.
+    bool write(int file, int64_t offset, std::vector<uint8_t>& data);
+    // Queues the close of file after its writes
+    void close(int file);
+
+    uint64_t bytesWritten() const;
+    uint64_t bytesDropped() const;
+    std::string toString() const;
+
+  private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Operation {
+        enum Kind { kOpen, kWrite, kClose };
+
+        Kind kind;
+        int file;
+        int fd;                     // kOpen
+        std::string path;           // kOpen
+        int64_t offset;             // kWrite
+        std::vector<uint8_t> data;  // kWrite
+    };
+
+    // Writer thread state of an open file
+    struct File {
+        int fd;
+        std::string path;
+        int64_t size;       // end of the data written
+        int64_t allocated;  // end of the space preallocated, -1 if fallocate() failed
+        bool dirty;         // written since the last fdatasync()
+        bool failed;        // a write or sync failed, the error has been reported
+        Clock::time_point lastSync;
+    };
+
+    DiskWriterOptions options_;
+    mutable std::mutex mutex_;
+    std::condition_variable wakeUp_;
+    std::deque<Operation> queue_;
+    size_t queuedBytes_;
+    Clock::time_point oldestQueued_;
+    bool stopping_;
+    int nextFile_;
+    std::unordered_map<int, File> files_;  // writer thread only
+    std::atomic<uint64_t> bytesWritten_;
+    std::atomic<uint64_t> bytesDropped_;
+    std::atomic<uint64_t> writeCalls_;
+    std::atomic<uint64_t> syncs_;
+    std::atomic<uint64_t> batches_;
+    std::thread thread_;
+
+    DiskWriter(const DiskWriter&);
+    DiskWriter& operator=(const DiskWriter&);
+
+    void writeLoop();
+    void writeBatch(std::deque<Operation>& batch);
+    // Writes the contiguous writes ops[begin, end) of one file
+    void writeRun(File& file, const std::vector<Operation*>& ops, size_t begin, size_t end);
+    void preallocate(File& file, int64_t end);
+    void closeFile(File& file);
+    // fdatasync() of file; only successful syncs are counted
+    void syncFile(File& file);
+    void syncDue(Clock::time_point now);
+};
+
+#endif  // DISK_WRITER_H
@@ -0,0 +1,395 @@
+#include "FecCodec.h"
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+
+#include "GaloisField.h"
+#include "RtpPacket.h"
+
+namespace {
+
+uint8_t coefficient(FecScheme scheme, int row, int column) {
+    if (scheme == kFecXor) {
+        return 1;
+    }
+    return GaloisField::inverse(static_cast<uint8_t>((255 - row) ^ column));
+}
+
+uint16_t readUint16(const uint8_t* data) { return static_cast<uint16_t>((data[0] << 8) | data[1]); }
+
+uint32_t readUint32(const uint8_t* data) {
+    return (static_cast<uint32_t>(data[0]) << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+}
+
+void writeUint16(uint16_t value, uint8_t* out) {
+    out[0] = value >> 8;
+    out[1] = value & 0xff;
+}
+
+void writeUint32(uint32_t value, uint8_t* out) {
+    out[0] = value >> 24;
+    out[1] = (value >> 16) & 0xff;
+    out[2] = (value >> 8) & 0xff;
+    out[3] = value & 0xff;
+}
+
+// Only plain 12-byte RTP headers are protected, as RtpPacketizer writes them
+bool isPlainRtp(const uint8_t* datagram, size_t length) {
+    return length >= static_cast<size_t>(kRtpHeaderSize) && datagram[0] == 0x80;
+}
+
+// Inverts the n x n matrix in place by Gauss-Jordan elimination. Returns false if it is
+// singular, which a Cauchy or all-ones 1 x 1 matrix never is.
+bool invertMatrix(std::vector<uint8_t>& matrix, int n) {
+    std::vector<uint8_t> inverse(n * n, 0);
+    for (int i = 0; i < n; ++i) {
+        inverse[i * n + i] = 1;
+    }
+    for (int column = 0; column < n; ++column) {
+        int pivot = column;
+        while (pivot < n && matrix[pivot * n + column] == 0) {
+            pivot++;
+        }
+        if (pivot == n) {
+            return false;
+        }
+        if (pivot != column) {
+            for (int k = 0; k < n; ++k) {
+                std::swap(matrix[pivot * n + k], matrix[column * n + k]);
+                std::swap(inverse[pivot * n + k], inverse[column * n + k]);
+            }
+        }
+        uint8_t scale = GaloisField::inverse(matrix[column * n + column]);
+        for (int k = 0; k < n; ++k) {
+            matrix[column * n + k] = GaloisField::multiply(matrix[column * n + k], scale);
+            inverse[column * n + k] = GaloisField::multiply(inverse[column * n + k], scale);
+        }
+        for (int row = 0; row < n; ++row) {
+            uint8_t factor = matrix[row * n + column];
+            if (row == column || factor == 0) {
+                continue;
+            }
+            for (int k = 0; k < n; ++k) {
+                matrix[row * n + k] ^= GaloisField::multiply(factor, matrix[column * n + k]);
+                inverse[row * n + k] ^= GaloisField::multiply(factor, inverse[column * n + k]);
+            }
+        }
+    }
+    matrix.swap(inverse);
+    return true;
+}
+
+}  // namespace
+
+bool FecOptions::parse(const std::string& description, FecOptions& options) {
+    std::vector<std::string> fields;
+    std::stringstream stream(description);
+    std::string field;
+    while (std::getline(stream, field, ':')) {
+        fields.push_back(field);
+    }
+    if (fields.empty() || fields.size() > 3) {
+        return false;
+    }
+
+    FecOptions parsed;
+    if (fields[0] == "off" && fields.size() == 1) {
+        options = parsed;
+        return true;
+    }
+    if (fields[0] == "xor" && fields.size() <= 2) {
+        parsed.scheme = kFecXor;
+        parsed.parityCount = 1;
+    } else if (fields[0] == "rs") {
+        parsed.scheme = kFecReedSolomon;
+        parsed.parityCount = 2;
+    } else {
+        return false;
+    }
+    try {
+        if (fields.size() > 1) {
+            parsed.groupSize = std::stoi(fields[1]);
+        }
+        if (fields.size() > 2) {
+            parsed.parityCount = std::stoi(fields[2]);
+        }
+    } catch (const std::exception&) {
+        return false;
+    }
+    if (parsed.groupSize < 1 || parsed.groupSize > kFecMaxGroupSize || parsed.parityCount < 1 ||
+        parsed.parityCount > kFecMaxParityCount) {
+        return false;
+    }
+    options = parsed;
+    return true;
+}
+
+std::string FecOptions::toString() const {
+    if (scheme == kFecNone) {
+        return "off";
+    }
+    std::ostringstream stream;
+    stream << (scheme == kFecXor ? "xor" : "rs") << " " << groupSize << "+" << parityCount
+           << " (" << 100 * parityCount / groupSize << "% overhead)";
+    return stream.str();
+}
+
+FecEncoder::FecEncoder()
+    : count_(0), baseSequence_(0), ssrc_(0), lastTimestamp_(0), sequence_(0), repairCount_(0) {}
+
+void FecEncoder::init(const FecOptions& options) {
+    options_ = options;
+    symbols_.assign(options.scheme != kFecNone ? options.groupSize : 0, std::vector<uint8_t>());
+    repairs_.assign(options.scheme != kFecNone ? options.parityCount : 0, std::vector<uint8_t>());
+    count_ = 0;
+    sequence_ = 0;
+    repairCount_ = 0;
+}
+
+bool FecEncoder::add(const uint8_t* header, size_t headerLength, const uint8_t* payload,
+                     size_t payloadLength) {
+    if (!enabled() || !isPlainRtp(header, headerLength)) {
+        return false;
+    }
+
+    if (count_ == 0) {
+        baseSequence_ = readUint16(header + 2);
+        ssrc_ = readUint32(header + 8);
+    }
+    lastTimestamp_ = readUint32(header + 4);
+
+    // The symbol keeps its capacity from the previous group
+    std::vector<uint8_t>& symbol = symbols_[count_];
+    size_t length = headerLength - kRtpHeaderSize + payloadLength;
+    symbol.resize(kFecSymbolHeaderSize);
+    writeUint16(static_cast<uint16_t>(length), &symbol[0]);
+    symbol[2] = header[1];
+    memcpy(&symbol[3], header + 4, 4);
+    symbol.insert(symbol.end(), header + kRtpHeaderSize, header + headerLength);
+    symbol.insert(symbol.end(), payload, payload + payloadLength);
+
+    if (++count_ < options_.groupSize) {
+        return false;
+    }
+    encodeGroup();
+    return true;
+}
+
+bool FecEncoder::finish() {
+    if (!enabled() || count_ == 0) {
+        return false;
+    }
+    encodeGroup();
+    return true;
+}
+
+void FecEncoder::encodeGroup() {
+    size_t symbolLength = 0;
+    for (int i = 0; i < count_; ++i) {
+        symbolLength = std::max(symbolLength, symbols_[i].size());
+    }
+
+    const size_t offset = kRtpHeaderSize + kFecHeaderSize;
+    repairCount_ = options_.parityCount;
+    for (int j = 0; j < repairCount_; ++j) {
+        std::vector<uint8_t>& repair = repairs_[j];
+        repair.assign(offset + symbolLength, 0);
+
+        RtpHeader header;
+        header.marker = false;
+        header.payloadType = kRtpPayloadTypeFec;
+        header.sequence = sequence_++;
+        header.timestamp = lastTimestamp_;
+        header.ssrc = ssrc_;
+        writeRtpHeader(header, &repair[0]);
+        uint8_t* fecHeader = &repair[kRtpHeaderSize];
+        writeUint16(baseSequence_, fecHeader);
+        fecHeader[2] = static_cast<uint8_t>(count_);
+        fecHeader[3] = static_cast<uint8_t>(repairCount_);
+        fecHeader[4] = static_cast<uint8_t>(j);
+        fecHeader[5] = static_cast<uint8_t>(options_.scheme);
+
+        for (int i = 0; i < count_; ++i) {
+            GaloisField::multiplyAdd(coefficient(options_.scheme, j, i), symbols_[i].data(),
+                                     &repair[offset], symbols_[i].size());
+        }
+    }
+    count_ = 0;
+}
+
+FecDecoder::FecDecoder() : history_(kHistory) { reset(); }
+
+void FecDecoder::reset() {
+    for (size_t i = 0; i < history_.size(); ++i) {
+        history_[i].valid = false;
+    }
+    groups_.clear();
+    repairsReceived_ = 0;
+    recovered_ = 0;
+}
+
+void FecDecoder::addMedia(const uint8_t* datagram, size_t length) {
+    if (!isPlainRtp(datagram, length)) {
+        return;
+    }
+    Media& media = history_[readUint16(datagram + 2) % kHistory];
+    media.valid = true;
+    media.sequence = readUint16(datagram + 2);
+    media.symbol.resize(kFecSymbolHeaderSize);
+    writeUint16(static_cast<uint16_t>(length - kRtpHeaderSize), &media.symbol[0]);
+    media.symbol[2] = datagram[1];
+    memcpy(&media.symbol[3], datagram + 4, 4);
+    media.symbol.insert(media.symbol.end(), datagram + kRtpHeaderSize, datagram + length);
+}
+
+int FecDecoder::addRepair(const uint8_t* datagram, size_t length,
+                          std::vector<std::vector<uint8_t> >& recovered) {
+    const size_t offset = kRtpHeaderSize + kFecHeaderSize;
+    if (!isPlainRtp(datagram, length) || length <= offset) {
+        return 0;
+    }
+    const uint8_t* fecHeader = datagram + kRtpHeaderSize;
+    uint32_t ssrc = readUint32(datagram + 8);
+    uint16_t baseSequence = readUint16(fecHeader);
+    int groupSize = fecHeader[2];
+    int parityCount = fecHeader[3];
+    int parityIndex = fecHeader[4];
+    FecScheme scheme = static_cast<FecScheme>(fecHeader[5]);
+    if (groupSize < 1 || groupSize > kFecMaxGroupSize || parityCount < 1 ||
+        parityCount > kFecMaxParityCount || parityIndex >= parityCount ||
+        (scheme != kFecXor && scheme != kFecReedSolomon)) {
+        return 0;
+    }
+    repairsReceived_++;
+
+    Group* group = nullptr;
+    for (size_t i = 0; i < groups_.size(); ++i) {
+        if (groups_[i].ssrc == ssrc && groups_[i].baseSequence == baseSequence) {
+            group = &groups_[i];
+            break;
+        }
+    }
+    if (!group) {
+        if (groups_.size() == static_cast<size_t>(kMaxPendingGroups)) {
+            groups_.pop_front();
+        }
+        Group added;
+        added.ssrc = ssrc;
+        added.baseSequence = baseSequence;
+        added.groupSize = groupSize;
+        added.parityCount = parityCount;
+        added.scheme = scheme;
+        added.done = false;
+        added.repairs.resize(parityCount);
+        groups_.push_back(added);
+        group = &groups_.back();
+    }
+    if (group->done || group->groupSize != groupSize || group->parityCount != parityCount) {
+        return 0;
+    }
+    group->repairs[parityIndex].assign(datagram + offset, datagram + length);
+
+    size_t before = recovered.size();
+    if (recoverGroup(*group, recovered)) {
+        group->done = true;
+        group->repairs.clear();
+    }
+    return static_cast<int>(recovered.size() - before);
+}
+
+std::string FecDecoder::toString() const {
+    std::ostringstream stream;
+    stream << repairsReceived_ << " FEC packets, " << recovered_ << " lost packets rebuilt";
+    return stream.str();
+}
+
+void FecDecoder::storeSymbol(uint16_t sequence, const uint8_t* symbol, size_t length) {
+    Media& media = history_[sequence % kHistory];
+    media.valid = true;
+    media.sequence = sequence;
+    media.symbol.assign(symbol, symbol + length);
+}
+
+// Rebuilds the lost media datagrams of the group if it has enough repair datagrams.
+// Returns true when nothing is left to do for the group.
+bool FecDecoder::recoverGroup(Group& group, std::vector<std::vector<uint8_t> >& recovered) {
+    std::vector<int> missing;
+    for (int i = 0; i < group.groupSize; ++i) {
+        uint16_t sequence = static_cast<uint16_t>(group.baseSequence + i);
+        const Media& media = history_[sequence % kHistory];
+        if (!media.valid || media.sequence != sequence) {
+            missing.push_back(i);
+        }
+    }
+    if (missing.empty()) {
+        return true;
+    }
+    std::vector<int> rows;
+    for (int j = 0; j < group.parityCount && rows.size() < missing.size(); ++j) {
+        if (!group.repairs[j].empty()) {
+            rows.push_back(j);
+        }
+    }
+    if (rows.size() < missing.size()) {
+        return false;
+    }
+
+    // Subtract the received symbols from the repair symbols, leaving the lost ones'
+    // combination: sum over lost i of c(j, i) * symbol i
+    int lost = static_cast<int>(missing.size());
+    size_t symbolLength = group.repairs[rows[0]].size();
+    std::vector<std::vector<uint8_t> > remainders(lost);
+    for (int r = 0; r < lost; ++r) {
+        remainders[r] = group.repairs[rows[r]];
+        if (remainders[r].size() != symbolLength) {
+            return true;  // inconsistent group, give up on it
+        }
+        for (int i = 0, m = 0; i < group.groupSize; ++i) {
+            if (m < lost && missing[m] == i) {
+                m++;
+                continue;
+            }
+            const std::vector<uint8_t>& symbol =
+                history_[static_cast<uint16_t>(group.baseSequence + i) % kHistory].symbol;
+            GaloisField::multiplyAdd(coefficient(group.scheme, rows[r], i), symbol.data(),
+                                     remainders[r].data(), std::min(symbol.size(), symbolLength));
+        }
+    }
+
+    std::vector<uint8_t> matrix(lost * lost);
+    for (int r = 0; r < lost; ++r) {
+        for (int m = 0; m < lost; ++m) {
+            matrix[r * lost + m] = coefficient(group.scheme, rows[r], missing[m]);
+        }
+    }
+    if (!invertMatrix(matrix, lost)) {
+        return true;
+    }
+
+    std::vector<uint8_t> symbol;
+    for (int m = 0; m < lost; ++m) {
+        symbol.assign(symbolLength, 0);
+        for (int r = 0; r < lost; ++r) {
+            GaloisField::multiplyAdd(matrix[m * lost + r], remainders[r].data(), symbol.data(),
+                                     symbolLength);
+        }
+        size_t payloadLength = readUint16(&symbol[0]);
+        if (payloadLength + kFecSymbolHeaderSize > symbolLength) {
+            continue;  // not a symbol of this group
+        }
+
+        uint16_t sequence = static_cast<uint16_t>(group.baseSequence + missing[m]);
+        std::vector<uint8_t> datagram(kRtpHeaderSize + payloadLength);
+        datagram[0] = 0x80;
+        datagram[1] = symbol[2];
+        writeUint16(sequence, &datagram[2]);
+        memcpy(&datagram[4], &symbol[3], 4);
+        writeUint32(group.ssrc, &datagram[8]);
+        memcpy(&datagram[kRtpHeaderSize], &symbol[kFecSymbolHeaderSize], payloadLength);
+        storeSymbol(sequence, symbol.data(), kFecSymbolHeaderSize + payloadLength);
+        recovered.push_back(datagram);
+        recovered_++;
+    }
+    return true;
+}
@@ -0,0 +1,129 @@
+#ifndef FEC_CODEC_H
+#define FEC_CODEC_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+// Forward error correction for an RTP stream, in the manner of RFC 5109: after every group
+// of groupSize media datagrams the sender adds parityCount repair datagrams, from which the
+// receiver rebuilds up to parityCount lost media datagrams of the group. The overhead is
+// parityCount / groupSize.
+//
+// A repair datagram is an RTP packet of the media stream's SSRC with payload type 127 and
+// its own sequence numbers, followed by the FEC header
+//
+//   base sequence (16 bits)  group size (8)  parity count (8)  parity index (8)  scheme (8)
+//
+// and the repair symbol. The symbol of a media datagram is its payload length (16 bits),
+// the marker/payload type byte and timestamp of its RTP header, and its payload after the
+// 12-byte RTP header, zero-padded to the longest symbol of the group. The repair symbol j
+// is the sum over the group of c(j, i) times symbol i in GF(2^8):
+//  - kFecXor: c = 1, plain XOR parity, one repair datagram per group
+//  - kFecReedSolomon: c(j, i) = 1 / ((255 - j) XOR i), a Cauchy matrix, of which every
+//    square submatrix is invertible, so that any parityCount losses can be rebuilt
+enum FecScheme { kFecNone, kFecXor, kFecReedSolomon };
+
+static const uint8_t kRtpPayloadTypeFec = 127;
+static const int kFecHeaderSize = 6;
+static const int kFecSymbolHeaderSize = 7;
+static const int kFecMaxGroupSize = 64;
+static const int kFecMaxParityCount = 16;
+
+struct FecOptions {
+    FecScheme scheme;
+    int groupSize;    // media datagrams per group, K
+    int parityCount;  // repair datagrams per group, M
+
+    FecOptions() : scheme(kFecNone), groupSize(10), parityCount(1) {}
+
+    // "off", "xor[:K]" or "rs[:K[:M]]"; rs defaults to 10:2
+    static bool parse(const std::string& description, FecOptions& options);
+    std::string toString() const;
+};
+
+// Sender side: collects the symbols of the current group
+class FecEncoder {
+  public:
+    FecEncoder();
+
+    void init(const FecOptions& options);
+    bool enabled() const { return options_.scheme != kFecNone; }
+
+    // Protects one media datagram, given as its headers (starting with the 12-byte RTP
+    // header) and its payload. Returns true when it completed a group; the repair
+    // datagrams are then repair(0) to repair(repairCount() - 1).
+    bool add(const uint8_t* header, size_t headerLength, const uint8_t* payload,
+             size_t payloadLength);
+    // Closes a partial group at the end of the stream; true if it had any datagram
+    bool finish();
+
+    int repairCount() const { return repairCount_; }
+    const std::vector<uint8_t>& repair(int index) const { return repairs_[index]; }
+
+  private:
+    FecOptions options_;
+    std::vector<std::vector<uint8_t> > symbols_;
+    int count_;
+    uint16_t baseSequence_;
+    uint32_t ssrc_;
+    uint32_t lastTimestamp_;
+    uint16_t sequence_;  // of the repair datagrams
+    std::vector<std::vector<uint8_t> > repairs_;
+    int repairCount_;
+
+    void encodeGroup();
+};
+
+// Receiver side: keeps the symbols of the last kHistory media datagrams and the repair
+// datagrams of the last kMaxPendingGroups groups, and rebuilds a group's lost media
+// datagrams as soon as enough repair datagrams have arrived.
+class FecDecoder {
+  public:
+    static const int kHistory = 1024;
+    static const int kMaxPendingGroups = 16;
+
+    FecDecoder();
+
+    void reset();
+
+    // A media datagram, not a duplicate
+    void addMedia(const uint8_t* datagram, size_t length);
+    // A repair datagram. Appends the media datagrams it allowed to rebuild to recovered,
+    // complete with their RTP header, and returns their number.
+    int addRepair(const uint8_t* datagram, size_t length,
+                  std::vector<std::vector<uint8_t> >& recovered);
+
+    uint64_t repairsReceived() const { return repairsReceived_; }
+    uint64_t recovered() const { return recovered_; }
+    std::string toString() const;
+
+  private:
+    struct Media {
+        bool valid;
+        uint16_t sequence;
+        std::vector<uint8_t> symbol;
+    };
+
+    struct Group {
+        uint32_t ssrc;
+        uint16_t baseSequence;
+        int groupSize;
+        int parityCount;
+        FecScheme scheme;
+        bool done;  // complete or rebuilt, later repair datagrams are ignored
+        std::vector<std::vector<uint8_t> > repairs;  // by parity index, empty until received
+    };
+
+    std::vector<Media> history_;
+    std::deque<Group> groups_;
+    uint64_t repairsReceived_;
+    uint64_t recovered_;
+
+    void storeSymbol(uint16_t sequence, const uint8_t* symbol, size_t length);
+    bool recoverGroup(Group& group, std::vector<std::vector<uint8_t> >& recovered);
+};
+
+#endif  // FEC_CODEC_H
@@ -0,0 +1,117 @@
+#include "FileSink.h"
+
+#include <iostream>
+
+#include "OutputSpec.h"
+
+FileSink::FileSink(const std::string& filePath)
+    : filePath_(filePath),
+      formatContext_(nullptr),
+      packet_(nullptr),
+      timeBase_({1, 1}),
+      headerWritten_(false) {}
+
+FileSink::~FileSink() { close(); }
+
+int FileSink::open(const AVCodecParameters* codecParameters, AVRational timeBase) {
+    timeBase_ = timeBase;
+
+    // An MP3 file is written without the muxer
+    size_t dot = filePath_.rfind('.');
+    if (codecParameters->codec_id == AV_CODEC_ID_MP3 && dot != std::string::npos &&
+        OutputSpec::codecIdForExtension(filePath_.substr(dot + 1)) == AV_CODEC_ID_MP3) {
+        mp3Writer_.reset(new Mp3Writer());
+        return mp3Writer_->open(filePath_, codecParameters);
+    }
+
+    // Allocate format context for output
+    avformat_alloc_output_context2(&formatContext_, nullptr, nullptr, filePath_.c_str());
+    if (!formatContext_) {
+        std::cerr << "Could not create output context for " << filePath_ << std::endl;
+        return -1;
+    }
+
+    // Create output stream
+    AVStream* outStream = avformat_new_stream(formatContext_, nullptr);
+    if (!outStream) {
+        std::cerr << "Failed allocating output stream for " << filePath_ << std::endl;
+        return -1;
+    }
+
+    // Copy codec parameters to output stream
+    avcodec_parameters_copy(outStream->codecpar, codecParameters);
+    outStream->time_base = timeBase;
+
+    // Open output file
+    if (!(formatContext_->oformat->flags & AVFMT_NOFILE)) {
+        if (avio_open(&formatContext_->pb, filePath_.c_str(), AVIO_FLAG_WRITE) < 0) {
+            std::cerr << "Could not open output file " << filePath_ << std::endl;
+            return -1;
+        }
+    }
+
+    // Write header
+    if (avformat_write_header(formatContext_, nullptr) < 0) {
+        std::cerr << "Error occurred when opening output file " << filePath_ << std::endl;
+        return -1;
+    }
+    headerWritten_ = true;
+
+    packet_ = av_packet_alloc();
+    if (!packet_) {
+        return -1;
+    }
+
+    return 0;
+}
+
+int FileSink::write(const AVPacket* packet) {
+    if (mp3Writer_) {
+        return packet ? mp3Writer_->write(packet) : -1;
+    }
+    if (!headerWritten_ || !packet) {
+        return -1;
+    }
+
+    // The muxer adjusts timestamps in place, so give it its own reference
+    if (av_packet_ref(packet_, packet) < 0) {
+        return -1;
+    }
+    packet_->stream_index = 0;
+    av_packet_rescale_ts(packet_, timeBase_, formatContext_->streams[0]->time_base);
+
+    int ret = av_write_frame(formatContext_, packet_);
+    av_packet_unref(packet_);
+    if (ret < 0) {
+        std::cerr << "Error writing packet to " << filePath_ << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+void FileSink::close() {
+    if (mp3Writer_) {
+        mp3Writer_->close();
+        mp3Writer_.reset();
+    }
+    if (formatContext_) {
+        // Write trailer
+        if (headerWritten_) {
+            av_write_trailer(formatContext_);
+        }
+
+        // Close output file
+        if (!(formatContext_->oformat->flags & AVFMT_NOFILE)) {
+            avio_closep(&formatContext_->pb);
+        }
+
+        // Free format context
+        avformat_free_context(formatContext_);
+        formatContext_ = nullptr;
+    }
+    headerWritten_ = false;
+    av_packet_free(&packet_);
+}
+
+std::string FileSink::description() const { return "file:" + filePath_; }
@@ -0,0 +1,31 @@
+#ifndef FILE_SINK_H
+#define FILE_SINK_H
+
+#include <memory>
+#include <string>
+
+#include "Mp3Writer.h"
+#include "PacketSink.h"
+
+// Muxes packets into a file with libavformat. An MP3 stream into a .mp3 file needs no muxer
+// and is written by Mp3Writer instead, which gives the same file at a fraction of the cost.
+class FileSink : public PacketSink {
+  public:
+    explicit FileSink(const std::string& filePath);
+    ~FileSink();
+
+    int open(const AVCodecParameters* codecParameters, AVRational timeBase) override;
+    int write(const AVPacket* packet) override;
+    void close() override;
+    std::string description() const override;
+
+  private:
+    std::string filePath_;
+    AVFormatContext* formatContext_;
+    AVPacket* packet_;  // reference to the caller's packet, timestamps rescaled for the muxer
+    AVRational timeBase_;
+    bool headerWritten_;
+    std::unique_ptr<Mp3Writer> mp3Writer_;  // instead of formatContext_
+};
+
+#endif  // FILE_SINK_H
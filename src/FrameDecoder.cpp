@@ -2,11 +2,28 @@
 
 #include <iostream>
 
-FrameDecoder::FrameDecoder() : codecContext_(nullptr), codecParameters_(nullptr), codec_(nullptr) {}
+#include "Log.h"
+
+FrameDecoder::FrameDecoder()
+    : codecContext_(nullptr),
+      codecParameters_(nullptr),
+      codec_(nullptr),
+      streamIndex_(-1),
+      pendingPacket_(av_packet_alloc()),
+      hasPendingPacket_(false) {}
+
+FrameDecoder::~FrameDecoder() {
+    closeDecoder();
+    av_packet_free(&pendingPacket_);
+}
 
-FrameDecoder::~FrameDecoder() { closeDecoder(); }
+int FrameDecoder::initializeDecoder(AVFormatContext* formatContext,
+                                    AVSampleFormat requestedSampleFormat) {
+    if (!pendingPacket_) {
+        std::cerr << "Could not allocate packet" << std::endl;
+        return -1;
+    }
 
-int FrameDecoder::initializeDecoder(AVFormatContext* formatContext) {
     // Find audio stream
     int streamIndex = av_find_best_stream(formatContext, AVMEDIA_TYPE_AUDIO, -1, -1, &codec_, 0);
     if (streamIndex < 0) {
@@ -14,6 +31,22 @@ int FrameDecoder::initializeDecoder(AVFormatContext* formatContext) {
         return -1;
     }
 
+    streamIndex_ = streamIndex;
+
+    // Prefer a decoder for this codec that outputs the requested format itself
+    if (requestedSampleFormat != AV_SAMPLE_FMT_NONE &&
+        !supportsSampleFormat(codec_, requestedSampleFormat)) {
+        void* iterator = nullptr;
+        const AVCodec* candidate;
+        while ((candidate = av_codec_iterate(&iterator)) != nullptr) {
+            if (av_codec_is_decoder(candidate) && candidate->id == codec_->id &&
+                supportsSampleFormat(candidate, requestedSampleFormat)) {
+                codec_ = candidate;
+                break;
+            }
+        }
+    }
+
     // Allocate codec context
     codecContext_ = avcodec_alloc_context3(codec_);
     if (!codecContext_) {
@@ -29,6 +62,7 @@ int FrameDecoder::initializeDecoder(AVFormatContext* formatContext) {
         std::cerr << "Failed to copy codec parameters to codec context" << std::endl;
         return -1;
     }
+    codecContext_->request_sample_fmt = requestedSampleFormat;
 
     // Initialize codec context
     if (avcodec_open2(codecContext_, codec_, nullptr) < 0) {
@@ -39,49 +73,106 @@ int FrameDecoder::initializeDecoder(AVFormatContext* formatContext) {
     return 0;
 }
 
-AVFrame* FrameDecoder::decodePacket(AVPacket* packet) {
-    if (!codecContext_ || !packet) {
-        return nullptr;
+int FrameDecoder::sendPacket(const AVPacket* packet) {
+    if (!codecContext_) {
+        return AVERROR(EINVAL);
+    }
+
+    // A packet the decoder refused earlier has to go in first
+    if (hasPendingPacket_) {
+        int ret = submitPendingPacket();
+        if (ret < 0) {
+            return ret;
+        }
     }
 
     int ret = avcodec_send_packet(codecContext_, packet);
-    if (ret < 0) {
+    if (ret == AVERROR(EAGAIN)) {
+        // Output is full, keep the packet until receiveFrame() has made room
+        if (packet) {
+            ret = av_packet_ref(pendingPacket_, packet);
+            if (ret < 0) {
+                return ret;
+            }
+        }
+        hasPendingPacket_ = true;
+        return 0;
+    } else if (ret < 0 && ret != AVERROR_EOF) {
         char errBuf[AV_ERROR_MAX_STRING_SIZE];
         av_strerror(ret, errBuf, sizeof(errBuf));
-        std::cerr << "Error sending packet for decoding: " << errBuf << std::endl;
-        return nullptr;
+        static LogLimiter sendErrors;
+        LogLine(kLogError, &sendErrors) << "Error sending packet for decoding: " << errBuf;
+        return ret;
     }
 
-    AVFrame* frame = av_frame_alloc();
-    if (!frame) {
-        std::cerr << "Could not allocate frame" << std::endl;
-        return nullptr;
+    return 0;
+}
+
+int FrameDecoder::receiveFrame(AVFrame* frame) {
+    if (!codecContext_ || !frame) {
+        return AVERROR(EINVAL);
     }
 
-    ret = avcodec_receive_frame(codecContext_, frame);
-    if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
-        av_frame_free(&frame);
-        return nullptr;
-    } else if (ret < 0) {
-        char errBuf[AV_ERROR_MAX_STRING_SIZE];
-        av_strerror(ret, errBuf, sizeof(errBuf));
-        std::cerr << "Error during decoding: " << errBuf << std::endl;
-        av_frame_free(&frame);
-        return nullptr;
+    while (true) {
+        int ret = avcodec_receive_frame(codecContext_, frame);
+        if (ret == AVERROR(EAGAIN) && hasPendingPacket_) {
+            // There is room now for the packet sendPacket() had to hold back
+            ret = submitPendingPacket();
+            if (ret < 0) {
+                return ret;
+            }
+            continue;
+        }
+
+        if (ret < 0 && ret != AVERROR(EAGAIN) && ret != AVERROR_EOF) {
+            char errBuf[AV_ERROR_MAX_STRING_SIZE];
+            av_strerror(ret, errBuf, sizeof(errBuf));
+            static LogLimiter decodeErrors;
+            LogLine(kLogError, &decodeErrors) << "Error during decoding: " << errBuf;
+        }
+        return ret;
+    }
+}
+
+bool FrameDecoder::supportsSampleFormat(const AVCodec* codec, AVSampleFormat sampleFormat) {
+    const void* formats = nullptr;
+    int count = 0;
+    if (avcodec_get_supported_config(nullptr, codec, AV_CODEC_CONFIG_SAMPLE_FORMAT, 0, &formats,
+                                     &count) < 0 ||
+        !formats) {
+        return false;
     }
 
-    return frame;
+    const AVSampleFormat* sampleFormats = static_cast<const AVSampleFormat*>(formats);
+    for (int i = 0; i < count; ++i) {
+        if (sampleFormats[i] == sampleFormat) {
+            return true;
+        }
+    }
+    return false;
 }
 
-void FrameDecoder::flushDecoder() {
-    if (!codecContext_) {
-        return;
+int FrameDecoder::submitPendingPacket() {
+    // An empty pending packet is the drain request
+    const AVPacket* packet = pendingPacket_->data || pendingPacket_->side_data_elems
+                                 ? pendingPacket_
+                                 : nullptr;
+    int ret = avcodec_send_packet(codecContext_, packet);
+    if (ret == AVERROR(EAGAIN)) {
+        return ret;
     }
 
-    avcodec_send_packet(codecContext_, nullptr);
+    av_packet_unref(pendingPacket_);
+    hasPendingPacket_ = false;
+    return ret == AVERROR_EOF ? 0 : ret;
 }
 
 void FrameDecoder::closeDecoder() {
+    if (pendingPacket_) {
+        av_packet_unref(pendingPacket_);
+    }
+    hasPendingPacket_ = false;
+
     if (codecContext_) {
         avcodec_free_context(&codecContext_);
         codecContext_ = nullptr;
@@ -97,4 +188,6 @@ AVCodecID FrameDecoder::getCodecId() const {
         return codecParameters_->codec_id;
     }
     return AV_CODEC_ID_NONE;
-}
\ No newline at end of file
+}
+
+int FrameDecoder::getStreamIndex() const { return streamIndex_; }
\ No newline at end of file
@@ -18,23 +18,48 @@ extern "C" {
 }
 #endif
 
+// Pull-style decoder: sendPacket() queues one packet, then receiveFrame() is called until it
+// returns AVERROR(EAGAIN) to collect every frame the packet produced. At the end of the input
+// sendPacket(nullptr) starts the drain and receiveFrame() yields the remaining frames until it
+// returns AVERROR_EOF. Frames are decoded into a frame the caller owns and may reuse.
 class FrameDecoder {
   public:
     FrameDecoder();
     ~FrameDecoder();
 
-    int initializeDecoder(AVFormatContext* formatContext);
-    AVFrame* decodePacket(AVPacket* packet);
-    void flushDecoder();
+    // requestedSampleFormat is the format the frames are wanted in. A decoder implementation
+    // that produces it natively is preferred (e.g. the fixed-point MP3 decoder for S16P) and
+    // it is passed on as request_sample_fmt; decoders that cannot honour it use their own.
+    int initializeDecoder(AVFormatContext* formatContext,
+                          AVSampleFormat requestedSampleFormat = AV_SAMPLE_FMT_NONE);
+    // Queues packet for decoding, or starts the drain if packet is null. If the decoder is
+    // still full the packet is kept and submitted by the following receiveFrame() calls.
+    // Returns 0 or a negative AVERROR; AVERROR(EAGAIN) only if the frames of the previous
+    // packet were not all received.
+    int sendPacket(const AVPacket* packet);
+
+    // Replaces the contents of frame with the next decoded frame. Returns 0, AVERROR(EAGAIN)
+    // when the next packet is needed, AVERROR_EOF once drained, or another negative AVERROR.
+    int receiveFrame(AVFrame* frame);
+
     void closeDecoder();
     AVCodecContext* getCodecContext() const;
     AVCodecParameters* getCodecParameters() const;
     AVCodecID getCodecId() const;  // Added getCodecId method
+    int getStreamIndex() const;
 
   private:
     AVCodecContext* codecContext_;
     AVCodecParameters* codecParameters_;
     const AVCodec* codec_;
+    int streamIndex_;
+
+    // Packet the decoder had no room for yet
+    AVPacket* pendingPacket_;
+    bool hasPendingPacket_;
+
+    int submitPendingPacket();
+    static bool supportsSampleFormat(const AVCodec* codec, AVSampleFormat sampleFormat);
 };
 
 #endif  // FRAME_DECODER_H
\ No newline at end of file
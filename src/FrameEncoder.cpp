@@ -2,22 +2,28 @@
 
 #include <iostream>
 
+#include "Log.h"
+
 // FFmpeg includes - configured in CMakeLists.txt
 extern "C" {
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
 #include <libavutil/channel_layout.h>
 #include <libavutil/frame.h>
+#include <libavutil/opt.h>
 #include <libavutil/samplefmt.h>
 }
 
 FrameEncoder::FrameEncoder()
     : codecContext_(nullptr),
       codec_(nullptr),
-      formatContext_(nullptr),
       frameCount_(0),
+      bitReservoir_(true),
       bufferFrame_(nullptr),
-      bufferedSamples_(0) {}
+      bufferedSamples_(0),
+      bufferPts_(0),
+      packetPool_(kPacketRingCapacity),
+      packetRing_(kPacketRingCapacity) {}
 
 FrameEncoder::~FrameEncoder() {
 
@@ -29,9 +35,9 @@ FrameEncoder::~FrameEncoder() {
     closeEncoder();
 }
 
-int FrameEncoder::initializeEncoder(int sampleRate, int channels, AVCodecID codecId) {
+int FrameEncoder::initializeEncoder(const OutputSpec& spec) {
     // Find encoder for specified codec
-    codec_ = avcodec_find_encoder(codecId);
+    codec_ = avcodec_find_encoder(spec.codecId);
     if (!codec_) {
         std::cerr << "Codec not found" << std::endl;
         return -1;
@@ -44,33 +50,32 @@ int FrameEncoder::initializeEncoder(int sampleRate, int channels, AVCodecID code
         return -1;
     }
 
-    // Set codec parameters for MP3
-    codecContext_->bit_rate = 320000;  // 320K bitrate
-    codecContext_->sample_rate = sampleRate;
-
-    AVChannelLayout chLayout;
-    av_channel_layout_default(&chLayout, channels);
-    codecContext_->ch_layout = chLayout;
-
-    // Set sample format based on codec
-    if (codecId == AV_CODEC_ID_AAC) {
-        codecContext_->sample_fmt = AV_SAMPLE_FMT_FLTP;  // AAC requires fltp
-    } else if (codecId == AV_CODEC_ID_PCM_S16LE) {
-        codecContext_->sample_fmt = AV_SAMPLE_FMT_S16;  // WAV requires s16
-    } else {
-        codecContext_->sample_fmt = AV_SAMPLE_FMT_S16P;  // For MP3 encoding
+    // Only the MP3 encoder has a reservoir that can be turned off; refuse the others rather
+    // than return frames that depend on each other
+    if (!bitReservoir_ &&
+        (spec.codecId != AV_CODEC_ID_MP3 ||
+         av_opt_set_int(codecContext_->priv_data, "reservoir", 0, 0) < 0)) {
+        std::cerr << "Encoder " << codec_->name << " cannot disable its bit reservoir"
+                  << std::endl;
+        return -1;
     }
 
+    // Set codec parameters from the output spec
+    codecContext_->bit_rate = spec.bitRate;
+    codecContext_->sample_rate = spec.sampleRate;
+    av_channel_layout_default(&codecContext_->ch_layout, spec.channels);
+    codecContext_->sample_fmt = spec.sampleFormat;
+
     // Open codec
     if (avcodec_open2(codecContext_, codec_, nullptr) < 0) {
-        std::cerr << "Could not open codec" << std::endl;
+        std::cerr << "Could not open codec for " << spec.toString() << std::endl;
         return -1;
     }
 
     return 0;
 }
 
-int FrameEncoder::encodeFrame(AVFrame* frame, AVPacket** outputPacket) {
+int FrameEncoder::encodeFrame(AVFrame* frame) {
     if (!codecContext_) {
         return -1;
     }
@@ -84,238 +89,120 @@ int FrameEncoder::encodeFrame(AVFrame* frame, AVPacket** outputPacket) {
         }
 
         // Receive encoded packets
-        AVPacket* pkt = av_packet_alloc();
-        while (ret >= 0) {
-            ret = avcodec_receive_packet(codecContext_, pkt);
-            if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
-                break;
-            } else if (ret < 0) {
-                std::cerr << "Error during encoding" << std::endl;
-                av_packet_free(&pkt);
-                return -1;
-            }
-
-            // Write packet to file
-            if (formatContext_) {
-                WRITE_PACKET(formatContext_, pkt);
-            }
-
-            // Add packet to queue
-            {
-                std::lock_guard<std::mutex> lock(queueMutex_);
-                packetQueue_.push(av_packet_clone(pkt));
-            }
-            queueCondition_.notify_one();
-
-            // If outputPacket is provided, return the packet
-            if (outputPacket) {
-                *outputPacket = av_packet_clone(pkt);
-            }
-
-            av_packet_unref(pkt);
-            frameCount_++;
+        if (receivePackets() < 0) {
+            return -1;
         }
-
-        av_packet_free(&pkt);
         return 0;
     }
 
-    // For MP3 encoding, we need to handle frame sizes properly
+    // Codecs without a fixed frame size, and frames the resampler already sized to the
+    // encoder frame, are sent as they are
     int frameSize = codecContext_->frame_size;
-    if (frameSize > 0) {
-        // Initialize buffer frame if needed
-        if (!bufferFrame_) {
-            bufferFrame_ = av_frame_alloc();
-            bufferFrame_->format = frame->format;
-            bufferFrame_->sample_rate = frame->sample_rate;
-            bufferFrame_->ch_layout = frame->ch_layout;
-            bufferFrame_->nb_samples = frameSize;
-
-            if (av_frame_get_buffer(bufferFrame_, 0) < 0) {
-                std::cerr << "Could not allocate buffer frame" << std::endl;
-                return -1;
-            }
+    if (frameSize <= 0 || (bufferedSamples_ == 0 && frame->nb_samples == frameSize)) {
+        return sendToEncoder(frame);
+    }
 
-            bufferedSamples_ = 0;
+    // Anything else is staged into encoder-sized frames
+    if (!bufferFrame_) {
+        bufferFrame_ = av_frame_alloc();
+        if (!bufferFrame_) {
+            std::cerr << "Could not allocate buffer frame" << std::endl;
+            return -1;
         }
+        bufferFrame_->format = frame->format;
+        bufferFrame_->sample_rate = frame->sample_rate;
+        bufferFrame_->ch_layout = frame->ch_layout;
+        bufferFrame_->nb_samples = frameSize;
 
-        // Process input frame samples
-        int samplesProcessed = 0;
-        while (samplesProcessed < frame->nb_samples) {
-            // Calculate how many samples we can copy to buffer
-            int samplesToCopy =
-                FFMIN(frameSize - bufferedSamples_, frame->nb_samples - samplesProcessed);
-
-            // Copy samples to buffer
-            av_samples_copy(bufferFrame_->data, frame->data, bufferedSamples_, samplesProcessed,
-                            samplesToCopy, frame->ch_layout.nb_channels,
-                            (AVSampleFormat)frame->format);
-
-            bufferedSamples_ += samplesToCopy;
-            samplesProcessed += samplesToCopy;
-
-            // If buffer is full, encode it
-            if (bufferedSamples_ == frameSize) {
-                // Set PTS for the buffer frame
-                bufferFrame_->pts = frame->pts + av_rescale_q(samplesProcessed - bufferedSamples_,
-                                                              (AVRational){1, frame->sample_rate},
-                                                              codecContext_->time_base);
-
-                // Encode the buffer frame
-                int ret = avcodec_send_frame(codecContext_, bufferFrame_);
-                if (ret < 0) {
-                    std::cerr << "Error sending frame for encoding" << std::endl;
-                    return -1;
-                }
-
-                // Receive encoded packets
-                AVPacket* pkt = av_packet_alloc();
-                while (ret >= 0) {
-                    ret = avcodec_receive_packet(codecContext_, pkt);
-                    if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
-                        break;
-                    } else if (ret < 0) {
-                        std::cerr << "Error during encoding" << std::endl;
-                        av_packet_free(&pkt);
-                        return -1;
-                    }
-
-                    // Write packet to file
-                    if (formatContext_) {
-                        WRITE_PACKET(formatContext_, pkt);
-                    }
-
-                    // Add packet to queue
-                    {
-                        std::lock_guard<std::mutex> lock(queueMutex_);
-                        packetQueue_.push(av_packet_clone(pkt));
-                    }
-                    queueCondition_.notify_one();
-
-                    // If outputPacket is provided, return the packet
-                    if (outputPacket) {
-                        *outputPacket = av_packet_clone(pkt);
-                    }
-
-                    av_packet_unref(pkt);
-                    frameCount_++;
-                }
-                av_packet_free(&pkt);
-                bufferedSamples_ = 0;
-            }
-        }
-    } else {
-        // If codec doesn't have a fixed frame size, send frame directly
-        int ret = avcodec_send_frame(codecContext_, frame);
-        if (ret < 0) {
-            std::cerr << "Error sending frame for encoding" << std::endl;
+        if (av_frame_get_buffer(bufferFrame_, 0) < 0) {
+            std::cerr << "Could not allocate buffer frame" << std::endl;
             return -1;
         }
 
-        // Receive encoded packets
-        AVPacket* pkt = av_packet_alloc();
-        while (ret >= 0) {
-            ret = avcodec_receive_packet(codecContext_, pkt);
-            if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
-                break;
-            } else if (ret < 0) {
-                std::cerr << "Error during encoding" << std::endl;
-                av_packet_free(&pkt);
+        bufferedSamples_ = 0;
+    }
+
+    // Process input frame samples
+    int samplesProcessed = 0;
+    while (samplesProcessed < frame->nb_samples) {
+        if (bufferedSamples_ == 0) {
+            // The encoder may still reference the previous staged frame
+            if (av_frame_make_writable(bufferFrame_) < 0) {
+                std::cerr << "Could not allocate buffer frame" << std::endl;
                 return -1;
             }
+            bufferPts_ = frame->pts + av_rescale_q(samplesProcessed,
+                                                   (AVRational){1, frame->sample_rate},
+                                                   codecContext_->time_base);
+        }
 
-            // Write packet to file
-            if (formatContext_) {
-                WRITE_PACKET(formatContext_, pkt);
-            }
+        // Calculate how many samples we can copy to buffer
+        int samplesToCopy =
+            FFMIN(frameSize - bufferedSamples_, frame->nb_samples - samplesProcessed);
 
-            // Add packet to queue
-            {
-                std::lock_guard<std::mutex> lock(queueMutex_);
-                packetQueue_.push(av_packet_clone(pkt));
-            }
-            queueCondition_.notify_one();
+        // Copy samples to buffer
+        av_samples_copy(bufferFrame_->extended_data, frame->extended_data, bufferedSamples_,
+                        samplesProcessed, samplesToCopy, frame->ch_layout.nb_channels,
+                        (AVSampleFormat)frame->format);
 
-            // If outputPacket is provided, return the packet
-            if (outputPacket) {
-                *outputPacket = av_packet_clone(pkt);
-            }
+        bufferedSamples_ += samplesToCopy;
+        samplesProcessed += samplesToCopy;
 
-            av_packet_unref(pkt);
-            frameCount_++;
+        // If buffer is full, encode it
+        if (bufferedSamples_ == frameSize) {
+            bufferFrame_->pts = bufferPts_;
+            bufferedSamples_ = 0;
+            if (sendToEncoder(bufferFrame_) < 0) {
+                return -1;
+            }
         }
-
-        av_packet_free(&pkt);
     }
 
     return 0;
 }
 
-void FrameEncoder::flushEncoder(AVPacket** outputPacket) {
-    if (!codecContext_) {
-        return;
+int FrameEncoder::sendToEncoder(AVFrame* frame) {
+    int ret = avcodec_send_frame(codecContext_, frame);
+    if (ret < 0) {
+        static LogLimiter sendErrors;
+        LogLine(kLogError, &sendErrors) << "Error sending frame for encoding";
+        return -1;
     }
 
-    // Handle any remaining buffered samples
-    static AVFrame* bufferFrame = nullptr;
-    static int bufferedSamples = 0;
+    // Receive encoded packets
+    return receivePackets();
+}
 
-    if (bufferFrame && bufferedSamples > 0) {
-        // Set the actual number of samples in the buffer frame
-        bufferFrame->nb_samples = bufferedSamples;
+int FrameEncoder::flushEncoder() {
+    if (!codecContext_) {
+        return -1;
+    }
 
-        // Encode the partial frame
-        int ret = avcodec_send_frame(codecContext_, bufferFrame);
-        if (ret < 0) {
-            std::cerr << "Error sending final frame for encoding" << std::endl;
+    // Encode the staged samples as the last frame, padded with silence if the codec only
+    // takes full frames
+    if (bufferFrame_ && bufferedSamples_ > 0) {
+        int frameSize = codecContext_->frame_size;
+        if (codec_->capabilities & AV_CODEC_CAP_SMALL_LAST_FRAME) {
+            bufferFrame_->nb_samples = bufferedSamples_;
+        } else {
+            av_samples_set_silence(bufferFrame_->extended_data, bufferedSamples_,
+                                   frameSize - bufferedSamples_,
+                                   bufferFrame_->ch_layout.nb_channels,
+                                   (AVSampleFormat)bufferFrame_->format);
         }
+        bufferFrame_->pts = bufferPts_;
+        bufferedSamples_ = 0;
 
-        // Receive encoded packets
-        AVPacket* pkt = av_packet_alloc();
-        while (ret >= 0) {
-            ret = avcodec_receive_packet(codecContext_, pkt);
-            if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
-                break;
-            } else if (ret < 0) {
-                std::cerr << "Error during encoding" << std::endl;
-                av_packet_free(&pkt);
-                break;
-            }
-
-            // Write packet to file
-            if (formatContext_) {
-                WRITE_PACKET(formatContext_, pkt);
-            }
-
-            // Add packet to queue
-            {
-                std::lock_guard<std::mutex> lock(queueMutex_);
-                packetQueue_.push(av_packet_clone(pkt));
-            }
-            queueCondition_.notify_one();
-
-            // If outputPacket is provided, return the packet
-            if (outputPacket) {
-                *outputPacket = av_packet_clone(pkt);
-            }
-
-            av_packet_unref(pkt);
-            frameCount_++;
+        int ret = sendToEncoder(bufferFrame_);
+        bufferFrame_->nb_samples = frameSize;
+        if (ret < 0) {
+            std::cerr << "Error sending final frame for encoding" << std::endl;
+            return -1;
         }
-
-        // Clean up buffer
-        av_frame_free(&bufferFrame);
-        bufferFrame = nullptr;
-        bufferedSamples = 0;
     }
 
     // Flush encoder
-    encodeFrame(nullptr, outputPacket);
-
-    // Write trailer
-    if (formatContext_) {
-        WRITE_TRAILER(formatContext_);
-    }
+    return encodeFrame(nullptr);
 }
 
 void FrameEncoder::closeEncoder() {
@@ -323,76 +210,68 @@ void FrameEncoder::closeEncoder() {
         avcodec_free_context(&codecContext_);
     }
 
-    if (formatContext_) {
-        avformat_free_context(formatContext_);
-    }
-
     // Clear packet queue
     clearPacketQueue();
 }
 
-AVPacket* FrameEncoder::getNextEncodedPacket() {
-    std::unique_lock<std::mutex> lock(queueMutex_);
-
+PacketHandle FrameEncoder::getNextEncodedPacket() {
     // Wait for packets to be available
-    queueCondition_.wait(lock, [this] { return !packetQueue_.empty(); });
-
-    // Get the front packet
-    AVPacket* packet = packetQueue_.front();
-    packetQueue_.pop();
-
+    PacketHandle packet;
+    packetRing_.waitPop(packet);
     return packet;
 }
 
-bool FrameEncoder::hasEncodedPackets() const {
-    std::lock_guard<std::mutex> lock(queueMutex_);
-    return !packetQueue_.empty();
-}
+bool FrameEncoder::hasEncodedPackets() const { return !packetRing_.empty(); }
 
 void FrameEncoder::clearPacketQueue() {
-    std::lock_guard<std::mutex> lock(queueMutex_);
-
-    // Free all packets in the queue
-    while (!packetQueue_.empty()) {
-        AVPacket* packet = packetQueue_.front();
-        av_packet_free(&packet);
-        packetQueue_.pop();
+    // Return all packets in the queue to the pool
+    PacketHandle packet;
+    while (packetRing_.tryPop(packet)) {
+        packet.reset();
     }
 }
 
-AVCodecContext* FrameEncoder::getCodecContext() const { return codecContext_; }
-
-void FrameEncoder::setOutputFile(const std::string& outputFile) {
-    outputFilePath_ = outputFile;
+int FrameEncoder::receivePackets() {
+    while (true) {
+        PacketHandle pkt = packetPool_.acquire();
+        if (!pkt) {
+            return -1;
+        }
 
-    // Initialize format context for output
-    avformat_alloc_output_context2(&formatContext_, nullptr, nullptr, outputFile.c_str());
-    if (!formatContext_) {
-        std::cerr << "Could not create output context" << std::endl;
-        return;
-    }
+        int ret = avcodec_receive_packet(codecContext_, pkt.get());
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+            break;
+        } else if (ret < 0) {
+            static LogLimiter encodeErrors;
+            LogLine(kLogError, &encodeErrors) << "Error during encoding";
+            return -1;
+        }
 
-    // Create output stream
-    AVStream* outStream = avformat_new_stream(formatContext_, codec_);
-    if (!outStream) {
-        std::cerr << "Failed allocating output stream" << std::endl;
-        return;
+        // Hand the packet itself to the queue and receive into the next pooled one
+        if (enqueuePacket(pkt) < 0) {
+            return -1;
+        }
+        frameCount_++;
     }
 
-    // Copy codec parameters to output stream
-    avcodec_parameters_from_context(outStream->codecpar, codecContext_);
+    return 0;
+}
 
-    // Open output file
-    if (!(formatContext_->oformat->flags & AVFMT_NOFILE)) {
-        if (avio_open(&formatContext_->pb, outputFile.c_str(), AVIO_FLAG_WRITE) < 0) {
-            std::cerr << "Could not open output file" << outputFile << std::endl;
-            return;
-        }
+int FrameEncoder::enqueuePacket(PacketHandle& packet) {
+    if (!packet) {
+        return 0;
     }
 
-    // Write header
-    if (WRITE_HEADER(formatContext_, nullptr) < 0) {
-        std::cerr << "Error occurred when opening output file" << std::endl;
-        return;
+    // Dropping the packet would leave a gap in the stream, so the caller has to stop
+    if (!packetRing_.tryPush(packet)) {
+        std::cerr << "Encoded packet queue full after " << kPacketRingCapacity
+                  << " packets; it must be drained after every encodeFrame()" << std::endl;
+        packet.reset();
+        return -1;
     }
-}
\ No newline at end of file
+    return 0;
+}
+
+AVCodecContext* FrameEncoder::getCodecContext() const { return codecContext_; }
+
+void FrameEncoder::setBitReservoir(bool enabled) { bitReservoir_ = enabled; }
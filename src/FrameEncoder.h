@@ -1,23 +1,11 @@
 #ifndef FRAME_ENCODER_H
 #define FRAME_ENCODER_H
 
-#include <condition_variable>
-#include <mutex>
-#include <queue>
 #include <string>
 
-// 宏定义用于控制是否写入文件
-#define ENABLE_FILE_WRITING 1
-
-#if ENABLE_FILE_WRITING
-#define WRITE_PACKET(ctx, pkt) av_write_frame(ctx, pkt)
-#define WRITE_HEADER(ctx, options) avformat_write_header(ctx, options)
-#define WRITE_TRAILER(ctx) av_write_trailer(ctx)
-#else
-#define WRITE_PACKET(ctx, pkt) (0)
-#define WRITE_HEADER(ctx, options) (0)
-#define WRITE_TRAILER(ctx) (0)
-#endif
+#include "AVObjectPool.h"
+#include "OutputSpec.h"
+#include "SpscRing.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -36,14 +24,23 @@ class FrameEncoder {
     FrameEncoder();
     ~FrameEncoder();
 
-    int initializeEncoder(int sampleRate, int channels, AVCodecID codecId = AV_CODEC_ID_MP3);
-    int encodeFrame(AVFrame* frame, AVPacket** outputPacket = nullptr);
-    void flushEncoder(AVPacket** outputPacket = nullptr);
+    // Opens the encoder for spec; input frames must have its rate, channels and sample format
+    int initializeEncoder(const OutputSpec& spec);
+
+    // Frames of exactly frame_size samples are encoded without copying, others are staged
+    int encodeFrame(AVFrame* frame);
+    // Encodes the staged remainder as a last, shorter frame and drains the encoder
+    int flushEncoder();
     void closeEncoder();
-    void setOutputFile(const std::string& outputFile);
 
-    // Queue methods for AudioProcessor to get encoded packets
-    AVPacket* getNextEncodedPacket();
+    // Disable the MP3 bit reservoir so every frame decodes on its own; needed when frames
+    // from independently encoded segments are spliced. Call before initializeEncoder(),
+    // which then fails for an encoder that has no reservoir to disable.
+    void setBitReservoir(bool enabled);
+
+    // Queue methods for AudioProcessor to get encoded packets. The packet goes back to the
+    // encoder's pool when the returned handle is released.
+    PacketHandle getNextEncodedPacket();
     bool hasEncodedPackets() const;
     void clearPacketQueue();
 
@@ -51,20 +48,26 @@ class FrameEncoder {
     AVCodecContext* getCodecContext() const;
 
   private:
+    // Packets produced by one encodeFrame() or flushEncoder() call; the consumer drains it
+    // after every call. A call that would produce more fails instead of dropping packets.
+    static const size_t kPacketRingCapacity = 256;
+
     AVCodecContext* codecContext_;
     const AVCodec* codec_;
-    AVFormatContext* formatContext_;
-    std::string outputFilePath_;
     int frameCount_;
+    bool bitReservoir_;
 
-    // Buffer for MP3 encoding
+    // Stages frames that are not frame_size long, e.g. from a pass-through resampler
     AVFrame* bufferFrame_;
     int bufferedSamples_;
+    int64_t bufferPts_;
 
-    // Packet queue for encoded packets
-    std::queue<AVPacket*> packetQueue_;
-    mutable std::mutex queueMutex_;
-    std::condition_variable queueCondition_;
+    // Lock-free packet queue for encoded packets
+    PacketPool packetPool_;
+    SpscRing<PacketHandle> packetRing_;
+    int sendToEncoder(AVFrame* frame);
+    int receivePackets();
+    int enqueuePacket(PacketHandle& packet);
 };
 
 #endif  // FRAME_ENCODER_H
\ No newline at end of file
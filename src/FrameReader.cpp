@@ -1,6 +1,8 @@
 #include "FrameReader.h"
 
+#include <cstring>
 #include <iostream>
+#include <vector>
 
 extern "C" {
 #include <libavcodec/avcodec.h>
@@ -10,6 +12,32 @@ extern "C" {
 #include <libavutil/samplefmt.h>
 }
 
+// Layer III bitrates in kbit/s by bitrate index, for MPEG-1 and for MPEG-2 and 2.5
+static const int kBitrates[2][15] = {
+    {0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320},
+    {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160}};
+static const int kSampleRates[3] = {44100, 48000, 32000};
+// Side information size after the frame header, where a Xing or Info tag starts
+static const int kSideInfoSizes[2][2] = {{32, 17}, {17, 9}};  // [MPEG-2 or 2.5][mono]
+static const int kVbriOffset = 4 + 32;
+
+// Size in bytes of the layer III frame starting at data, 0 if it is not a frame header
+// (free format included)
+static int mp3FrameSize(const uint8_t* data) {
+    uint32_t header = (uint32_t)data[0] << 24 | data[1] << 16 | data[2] << 8 | data[3];
+    int version = (header >> 19) & 3;  // 3: MPEG-1, 2: MPEG-2, 0: MPEG-2.5
+    int bitrateIndex = (header >> 12) & 15;
+    int sampleRateIndex = (header >> 10) & 3;
+    if ((header & 0xFFE00000) != 0xFFE00000 || version == 1 || ((header >> 17) & 3) != 1 ||
+        bitrateIndex == 0 || bitrateIndex == 15 || sampleRateIndex == 3) {
+        return 0;
+    }
+    bool mpeg1 = version == 3;
+    int sampleRate = kSampleRates[sampleRateIndex] >> (mpeg1 ? 0 : version == 2 ? 1 : 2);
+    int bitrate = kBitrates[mpeg1 ? 0 : 1][bitrateIndex] * 1000;
+    return (mpeg1 ? 144 : 72) * bitrate / sampleRate + ((header >> 9) & 1);
+}
+
 FrameReader::FrameReader() : formatContext_(nullptr) {}
 
 FrameReader::~FrameReader() { closeInput(); }
@@ -30,20 +58,19 @@ int FrameReader::openInputFile(const std::string& filePath) {
     return 0;
 }
 
-AVPacket* FrameReader::readFrame() {
+PacketHandle FrameReader::readFrame() {
     if (!formatContext_) {
-        return nullptr;
+        return PacketHandle();
     }
 
-    AVPacket* packet = av_packet_alloc();
+    PacketHandle packet = packetPool_.acquire();
     if (!packet) {
-        return nullptr;
+        return PacketHandle();
     }
 
-    int ret = av_read_frame(formatContext_, packet);
+    int ret = av_read_frame(formatContext_, packet.get());
     if (ret < 0) {
-        av_packet_free(&packet);
-        return nullptr;
+        return PacketHandle();
     }
 
     return packet;
@@ -56,4 +83,69 @@ void FrameReader::closeInput() {
     }
 }
 
-AVFormatContext* FrameReader::getFormatContext() const { return formatContext_; }
\ No newline at end of file
+AVFormatContext* FrameReader::getFormatContext() const { return formatContext_; }
+
+bool FrameReader::isConstantBitrateMp3() const {
+    if (!formatContext_ || !formatContext_->url) {
+        return false;
+    }
+
+    // Read the start of the input again on its own, the demuxer keeps its position
+    AVIOContext* io = nullptr;
+    if (avio_open(&io, formatContext_->url, AVIO_FLAG_READ) < 0) {
+        return false;
+    }
+    std::vector<uint8_t> data(kBitrateProbeBytes);
+    int size = avio_read(io, data.data(), kBitrateProbeBytes);
+    avio_closep(&io);
+    if (size < 10) {
+        return false;
+    }
+
+    // Skip an ID3v2 tag, its size is stored 7 bits per byte
+    int offset = 0;
+    if (memcmp(data.data(), "ID3", 3) == 0) {
+        offset = 10 + (data[6] << 21 | data[7] << 14 | data[8] << 7 | data[9]);
+    }
+
+    // The first frame is a header whose next frame is one too
+    int frameSize = 0;
+    for (; offset + 4 <= size; ++offset) {
+        frameSize = mp3FrameSize(&data[offset]);
+        if (frameSize > 0 && offset + frameSize + 4 <= size &&
+            mp3FrameSize(&data[offset + frameSize]) > 0) {
+            break;
+        }
+    }
+    if (offset + 4 > size) {
+        return false;
+    }
+
+    bool mpeg1 = ((data[offset + 1] >> 3) & 3) == 3;
+    bool mono = ((data[offset + 3] >> 6) & 3) == 3;
+    int tagOffset = offset + 4 + kSideInfoSizes[mpeg1 ? 0 : 1][mono ? 1 : 0];
+    if (tagOffset + 4 <= size) {
+        if (memcmp(&data[tagOffset], "Info", 4) == 0) {
+            return true;
+        }
+        if (memcmp(&data[tagOffset], "Xing", 4) == 0) {
+            return false;
+        }
+    }
+    if (offset + kVbriOffset + 4 <= size && memcmp(&data[offset + kVbriOffset], "VBRI", 4) == 0) {
+        return false;
+    }
+
+    // No tag: every whole frame in the probe must have the bitrate of the first
+    int bitrateIndex = data[offset + 2] >> 4;
+    int frames = 0;
+    while (offset + 4 <= size && (frameSize = mp3FrameSize(&data[offset])) > 0 &&
+           offset + frameSize <= size) {
+        if (data[offset + 2] >> 4 != bitrateIndex) {
+            return false;
+        }
+        offset += frameSize;
+        frames++;
+    }
+    return frames >= 2;
+}
\ No newline at end of file
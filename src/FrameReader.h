@@ -3,6 +3,8 @@
 
 #include <string>
 
+#include "AVObjectPool.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -21,12 +23,22 @@ class FrameReader {
     ~FrameReader();
 
     int openInputFile(const std::string& filePath);
-    AVPacket* readFrame();
+    // Returns the next packet, or an empty handle at the end of the input. The packet
+    // struct goes back to the reader's pool when the handle is released.
+    PacketHandle readFrame();
     void closeInput();
     AVFormatContext* getFormatContext() const;
 
+    // Whether the opened input is an MP3 file whose frames all have one bitrate. A Xing or
+    // VBRI tag means variable and an Info tag constant; without a tag the frame headers in
+    // the first kBitrateProbeBytes must agree. False if the input cannot be read again.
+    bool isConstantBitrateMp3() const;
+
   private:
+    static const int kBitrateProbeBytes = 256 * 1024;
+
     AVFormatContext* formatContext_;
+    PacketPool packetPool_;
 };
 
 #endif  // FRAME_READER_H
\ No newline at end of file
@@ -0,0 +1,161 @@
+#include "GaloisField.h"
+
+#include <algorithm>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GALOIS_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+namespace {
+
+const unsigned kPolynomial = 0x11d;
+
+struct Tables {
+    uint8_t exp[512];  // doubled so that exp[log a + log b] needs no modulo
+    uint8_t log[256];
+    uint8_t product[256][256];
+    // Products with the low and high nibble of a byte, for the PSHUFB kernels
+    uint8_t lowNibble[256][16];
+    uint8_t highNibble[256][16];
+
+    Tables() {
+        unsigned x = 1;
+        for (int i = 0; i < 255; ++i) {
+            exp[i] = static_cast<uint8_t>(x);
+            log[x] = static_cast<uint8_t>(i);
+            x <<= 1;
+            if (x & 0x100) {
+                x ^= kPolynomial;
+            }
+        }
+        for (int i = 255; i < 512; ++i) {
+            exp[i] = exp[i - 255];
+        }
+        log[0] = 0;
+
+        for (int a = 0; a < 256; ++a) {
+            for (int b = 0; b < 256; ++b) {
+                product[a][b] = (a == 0 || b == 0) ? 0 : exp[log[a] + log[b]];
+            }
+            for (int n = 0; n < 16; ++n) {
+                lowNibble[a][n] = product[a][n];
+                highNibble[a][n] = product[a][n << 4];
+            }
+        }
+    }
+};
+
+const Tables& tables() {
+    static const Tables instance;
+    return instance;
+}
+
+void multiplyAddScalar(const Tables& t, uint8_t c, const uint8_t* src, uint8_t* dst,
+                       size_t length) {
+    const uint8_t* row = t.product[c];
+    for (size_t i = 0; i < length; ++i) {
+        dst[i] ^= row[src[i]];
+    }
+}
+
+#ifdef GALOIS_X86_KERNELS
+__attribute__((target("ssse3"))) size_t multiplyAddSsse3(const Tables& t, uint8_t c,
+                                                         const uint8_t* src, uint8_t* dst,
+                                                         size_t length) {
+    const __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(t.lowNibble[c]));
+    const __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(t.highNibble[c]));
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i lowProduct = _mm_shuffle_epi8(low, _mm_and_si128(x, mask));
+        __m128i highProduct = _mm_shuffle_epi8(high, _mm_and_si128(_mm_srli_epi64(x, 4), mask));
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+        d = _mm_xor_si128(d, _mm_xor_si128(lowProduct, highProduct));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), d);
+    }
+    return i;
+}
+
+__attribute__((target("avx2"))) size_t multiplyAddAvx2(const Tables& t, uint8_t c,
+                                                       const uint8_t* src, uint8_t* dst,
+                                                       size_t length) {
+    const __m256i low = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(t.lowNibble[c])));
+    const __m256i high = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(t.highNibble[c])));
+    const __m256i mask = _mm256_set1_epi8(0x0f);
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        __m256i lowProduct = _mm256_shuffle_epi8(low, _mm256_and_si256(x, mask));
+        __m256i highProduct =
+            _mm256_shuffle_epi8(high, _mm256_and_si256(_mm256_srli_epi64(x, 4), mask));
+        __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+        d = _mm256_xor_si256(d, _mm256_xor_si256(lowProduct, highProduct));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), d);
+    }
+    return i;
+}
+#endif
+
+}  // namespace
+
+uint8_t GaloisField::multiply(uint8_t a, uint8_t b) { return tables().product[a][b]; }
+
+uint8_t GaloisField::inverse(uint8_t a) {
+    const Tables& t = tables();
+    return t.exp[255 - t.log[a]];
+}
+
+GaloisField::Kernel GaloisField::detectKernel() {
+#ifdef GALOIS_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return kKernelAvx2;
+    }
+    if (__builtin_cpu_supports("ssse3")) {
+        return kKernelSsse3;
+    }
+#endif
+    return kKernelScalar;
+}
+
+const char* GaloisField::kernelName(Kernel kernel) {
+    switch (kernel) {
+        case kKernelAvx2:
+            return "avx2";
+        case kKernelSsse3:
+            return "ssse3";
+        default:
+            return "scalar";
+    }
+}
+
+void GaloisField::multiplyAdd(uint8_t c, const uint8_t* src, uint8_t* dst, size_t length) {
+    static const Kernel kernel = detectKernel();
+    multiplyAdd(c, src, dst, length, kernel);
+}
+
+void GaloisField::multiplyAdd(uint8_t c, const uint8_t* src, uint8_t* dst, size_t length,
+                              Kernel kernel) {
+    if (c == 0) {
+        return;
+    }
+    const Tables& t = tables();
+    size_t done = 0;
+#ifdef GALOIS_X86_KERNELS
+    static const Kernel available = detectKernel();
+    kernel = std::min(kernel, available);
+    if (kernel == kKernelAvx2) {
+        done = multiplyAddAvx2(t, c, src, dst, length);
+    } else if (kernel == kKernelSsse3) {
+        done = multiplyAddSsse3(t, c, src, dst, length);
+    }
+#else
+    (void)kernel;
+#endif
+    // The tail shorter than a vector
+    multiplyAddScalar(t, c, src + done, dst + done, length - done);
+}
@@ -0,0 +1,35 @@
+#ifndef GALOIS_FIELD_H
+#define GALOIS_FIELD_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Arithmetic in GF(2^8) with the polynomial x^8 + x^4 + x^3 + x^2 + 1 (0x11d), the field of
+// the usual Reed-Solomon erasure codes. Addition is XOR; multiplication and inversion use
+// log/exp tables.
+//
+// The inner loop of FEC encoding and decoding is multiplyAdd(): a whole buffer times one
+// constant, added to another buffer. The scalar kernel looks up a 256-byte product row;
+// the SSSE3 and AVX2 kernels split every byte into nibbles and look both up in 16-entry
+// product tables with PSHUFB, 16 or 32 bytes per instruction. The kernel is picked once at
+// runtime from the CPU features, like PolyphaseResampler's.
+class GaloisField {
+  public:
+    enum Kernel { kKernelScalar, kKernelSsse3, kKernelAvx2 };
+
+    static uint8_t multiply(uint8_t a, uint8_t b);
+    // a must not be 0
+    static uint8_t inverse(uint8_t a);
+
+    // Fastest kernel this CPU can run
+    static Kernel detectKernel();
+    static const char* kernelName(Kernel kernel);
+
+    // dst[i] ^= c * src[i] for i < length, with the detected kernel or the given one (a
+    // kernel the CPU lacks falls back to the next slower one)
+    static void multiplyAdd(uint8_t c, const uint8_t* src, uint8_t* dst, size_t length);
+    static void multiplyAdd(uint8_t c, const uint8_t* src, uint8_t* dst, size_t length,
+                            Kernel kernel);
+};
+
+#endif  // GALOIS_FIELD_H
@@ -0,0 +1,204 @@
+#include "JitterBuffer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+
+const double JitterBuffer::kJitterFactor = 4.0;
+
+JitterBuffer::JitterBuffer(double minDelaySeconds, double maxDelaySeconds)
+    : minDelay_(minDelaySeconds), maxDelay_(maxDelaySeconds), slots_(kCapacity) {
+    reset();
+}
+
+void JitterBuffer::setDelayRange(double minDelaySeconds, double maxDelaySeconds) {
+    minDelay_ = minDelaySeconds;
+    maxDelay_ = std::max(minDelaySeconds, maxDelaySeconds);
+    updateTarget();
+}
+
+void JitterBuffer::reset() {
+    for (size_t i = 0; i < slots_.size(); ++i) {
+        slots_[i].filled = false;
+        slots_[i].skipped = false;
+    }
+    jitterDelay_ = 0.0;
+    latePeak_ = 0.0;
+    started_ = false;
+    releasedAny_ = false;
+    next_ = 0;
+    highest_ = 0;
+    firstHeld_ = 0;
+    depth_ = 0;
+    maxDepth_ = 0;
+    heldBack_ = 0;
+    late_ = 0;
+    skipped_ = 0;
+    updateTarget();
+}
+
+bool JitterBuffer::insert(int64_t sequence, double arrival, const uint8_t* data, size_t size,
+                          PacketList& out) {
+    if (!started_) {
+        started_ = true;
+        next_ = sequence;
+        highest_ = sequence;
+    }
+    if (sequence < next_) {
+        // Until the first release a reordered start of the stream can still move next_ down
+        if (!releasedAny_ && highest_ - sequence < kCapacity) {
+            next_ = sequence;
+        } else {
+            late_++;
+            Slot& given = slot(sequence);
+            if (given.skipped && given.sequence == sequence) {
+                // Waiting that much longer would have saved it
+                latePeak_ = std::max(latePeak_, targetDelay_ + (arrival - given.arrival));
+                updateTarget();
+            }
+            return false;
+        }
+    }
+
+    while (sequence >= next_ + kCapacity) {
+        Slot& oldest = slot(next_);
+        if (oldest.filled && oldest.sequence == next_) {
+            releaseNext(out);
+        } else {
+            skipNext(arrival);
+        }
+    }
+
+    // In order with nothing waiting: passed on from the caller's buffer
+    if (depth_ == 0 && sequence == next_) {
+        out.append(data, size);
+        highest_ = std::max(highest_, sequence);
+        advance();
+        return true;
+    }
+
+    Slot& held = slot(sequence);
+    if (held.filled && held.sequence == sequence) {
+        return true;  // duplicate
+    }
+    held.filled = true;
+    held.skipped = false;
+    held.sequence = sequence;
+    held.arrival = arrival;
+    held.data.assign(data, data + size);
+    firstHeld_ = depth_ == 0 ? sequence : std::min(firstHeld_, sequence);
+    depth_++;
+    maxDepth_ = std::max(maxDepth_, depth_);
+    highest_ = std::max(highest_, sequence);
+    if (sequence != next_) {
+        heldBack_++;
+    }
+    return true;
+}
+
+void JitterBuffer::adapt(double jitterSeconds) {
+    jitterDelay_ = kJitterFactor * jitterSeconds;
+    updateTarget();
+}
+
+void JitterBuffer::release(double now, PacketList& out) {
+    while (depth_ > 0) {
+        const Slot& front = slot(next_);
+        if (front.filled && front.sequence == next_) {
+            releaseNext(out);
+            continue;
+        }
+        // Give up the gap once the packet after it has waited the target delay
+        const Slot* first = firstHeld();
+        if (now - first->arrival < targetDelay_) {
+            break;
+        }
+        int64_t sequence = first->sequence;
+        while (next_ < sequence) {
+            skipNext(now);
+        }
+    }
+}
+
+void JitterBuffer::flush(PacketList& out) {
+    while (depth_ > 0) {
+        const Slot& front = slot(next_);
+        if (front.filled && front.sequence == next_) {
+            releaseNext(out);
+        } else {
+            skipNext(0.0);
+        }
+    }
+}
+
+double JitterBuffer::nextDeadline() const {
+    if (depth_ == 0) {
+        return -1.0;
+    }
+    const Slot* first = firstHeld();
+    if (first->sequence == next_) {
+        return -1.0;  // released by the next release() call
+    }
+    return first->arrival + targetDelay_;
+}
+
+std::string JitterBuffer::toString() const {
+    std::ostringstream stream;
+    stream << "depth " << depth_ << " (max " << maxDepth_ << "), target delay " << std::fixed
+           << std::setprecision(1) << targetDelay_ * 1000.0 << " ms, " << heldBack_
+           << " held back, " << late_ << " late, " << skipped_ << " skipped";
+    return stream.str();
+}
+
+// Lowest held packet; depth_ must not be 0
+const JitterBuffer::Slot* JitterBuffer::firstHeld() const {
+    return &slots_[static_cast<uint64_t>(firstHeld_) % kCapacity];
+}
+
+// Moves firstHeld_ to the lowest held packet from next_ on, after the first one was
+// released. Only the gap up to it is scanned, and only once.
+void JitterBuffer::findFirstHeld() {
+    for (firstHeld_ = next_; firstHeld_ < highest_; ++firstHeld_) {
+        const Slot& held = slot(firstHeld_);
+        if (held.filled && held.sequence == firstHeld_) {
+            return;
+        }
+    }
+}
+
+void JitterBuffer::releaseNext(PacketList& out) {
+    // Copied, so that the slot keeps its buffer for the packet that next lands in it
+    Slot& front = slot(next_);
+    out.appendCopy(front.data);
+    front.filled = false;
+    depth_--;
+    advance();
+    if (depth_ > 0) {
+        findFirstHeld();
+    }
+}
+
+// Moves past the packet just released
+void JitterBuffer::advance() {
+    static const double kPeakDecay = std::pow(0.5, 1.0 / kPeakHalfLife);
+    next_++;
+    releasedAny_ = true;
+    latePeak_ *= kPeakDecay;
+    updateTarget();
+}
+
+void JitterBuffer::skipNext(double now) {
+    Slot& given = slot(next_);
+    given.filled = false;
+    given.skipped = true;
+    given.sequence = next_;
+    given.arrival = now;
+    skipped_++;
+    next_++;
+    releasedAny_ = true;
+}
+
+void JitterBuffer::updateTarget() {
+    targetDelay_ = std::min(std::max(std::max(jitterDelay_, latePeak_), minDelay_), maxDelay_);
+}
@@ -0,0 +1,134 @@
+#ifndef JITTER_BUFFER_H
+#define JITTER_BUFFER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Packets released by a JitterBuffer. A packet that was held is copied into a buffer the
+// list keeps when it is cleared, so once the buffers have grown to the packet size neither
+// the list nor the jitter buffer slots allocate again. A packet released as it arrives is
+// only referenced, and its data must stay valid until the list is cleared.
+class PacketList {
+  public:
+    struct Packet {
+        const uint8_t* data;
+        size_t size;
+    };
+
+    PacketList() : copies_(0) {}
+
+    size_t size() const { return packets_.size(); }
+    bool empty() const { return packets_.empty(); }
+    const Packet& operator[](size_t index) const { return packets_[index]; }
+    void clear() {
+        packets_.clear();
+        copies_ = 0;
+    }
+    void append(const uint8_t* data, size_t size) {
+        Packet packet = {data, size};
+        packets_.push_back(packet);
+    }
+    void appendCopy(const std::vector<uint8_t>& data) {
+        if (copies_ == buffers_.size()) {
+            buffers_.push_back(std::vector<uint8_t>());
+        }
+        std::vector<uint8_t>& buffer = buffers_[copies_++];
+        buffer.assign(data.begin(), data.end());
+        append(buffer.data(), buffer.size());
+    }
+
+  private:
+    std::vector<Packet> packets_;
+    std::vector<std::vector<uint8_t> > buffers_;  // moving them keeps their data in place
+    size_t copies_;
+};
+
+// Puts the packets of one RTP stream back into sequence order before they are written.
+// Packets are held in a ring of kCapacity slots indexed by extended sequence number and
+// released as soon as every packet before them has been released. When a packet is
+// missing, the ones after it wait at most the target delay from their arrival; then the
+// missing packet is given up and counted as skipped. A packet that arrives after its turn
+// was given up is late and dropped, since its successors are already written.
+//
+// The target delay adapts between a minimum and a maximum: it is kJitterFactor times the
+// interarrival jitter the caller measures (RtpReceiveStats), but at least the delay that
+// would have saved the latest late packet, a peak that decays by half every
+// kPeakHalfLife packets. In-order packets are never delayed, so the target only costs
+// time when there is a gap.
+class JitterBuffer {
+  public:
+    static const int kCapacity = 1024;
+    static const int kPeakHalfLife = 512;
+    static const double kJitterFactor;
+
+    JitterBuffer(double minDelaySeconds = 0.05, double maxDelaySeconds = 2.0);
+
+    void setDelayRange(double minDelaySeconds, double maxDelaySeconds);
+    void reset();
+
+    // Holds a packet; times are seconds on a monotonic clock. Returns false if the packet
+    // came too late and was dropped. Packets that have to make room for it when it is
+    // kCapacity or more ahead of the next one are appended to out. The packet that is next
+    // while nothing is held is appended to out as it is, without a copy, so data must stay
+    // valid until out is cleared.
+    bool insert(int64_t sequence, double arrival, const uint8_t* data, size_t size,
+                PacketList& out);
+    // Recomputes the target delay from the current jitter estimate
+    void adapt(double jitterSeconds);
+
+    // Appends the packets due at now to out, in sequence order
+    void release(double now, PacketList& out);
+    // Appends every held packet to out, in sequence order, at the end of the stream
+    void flush(PacketList& out);
+    // When release() next has a packet to give up waiting for, or a negative value if no
+    // packet waits for a gap
+    double nextDeadline() const;
+
+    size_t depth() const { return depth_; }
+    size_t maxDepth() const { return maxDepth_; }
+    double targetDelay() const { return targetDelay_; }
+    uint64_t heldBack() const { return heldBack_; }  // waited for an earlier packet
+    uint64_t late() const { return late_; }
+    uint64_t skipped() const { return skipped_; }
+    std::string toString() const;
+
+  private:
+    struct Slot {
+        bool filled;
+        bool skipped;  // given up, a packet of this sequence number is late
+        int64_t sequence;
+        double arrival;  // or when the sequence number was given up
+        std::vector<uint8_t> data;
+    };
+
+    double minDelay_;
+    double maxDelay_;
+    double targetDelay_;
+    double jitterDelay_;
+    double latePeak_;
+    std::vector<Slot> slots_;
+    bool started_;
+    bool releasedAny_;
+    int64_t next_;     // sequence number to release next
+    int64_t highest_;  // highest held sequence number
+    // Lowest held sequence number when depth_ > 0, kept up to date so that deadlines are
+    // found without scanning the slots
+    int64_t firstHeld_;
+    size_t depth_;
+    size_t maxDepth_;
+    uint64_t heldBack_;
+    uint64_t late_;
+    uint64_t skipped_;
+
+    Slot& slot(int64_t sequence) { return slots_[static_cast<uint64_t>(sequence) % kCapacity]; }
+    const Slot* firstHeld() const;
+    void findFirstHeld();
+    void releaseNext(PacketList& out);
+    void advance();
+    void skipNext(double now);
+    void updateTarget();
+};
+
+#endif  // JITTER_BUFFER_H
@@ -0,0 +1,303 @@
+#include "Log.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <streambuf>
+#include <thread>
+#include <vector>
+
+#include "SpscRing.h"
+
+namespace {
+
+// How often the drain thread looks at the rings when nobody flushes
+const std::chrono::milliseconds kDrainInterval(20);
+
+std::atomic<int> g_level(kLogInfo);
+std::atomic<uint64_t> g_sequence(0);  // orders the lines of different threads
+
+int64_t steadyMilliseconds() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+struct LogEntry {
+    uint64_t sequence;
+    LogLevel level;
+    size_t size;
+    char text[Log::kMaxLineSize];
+};
+
+// The lines of one thread, shared by the thread and the drain thread
+struct LogRing {
+    SpscRing<LogEntry> entries;
+    std::atomic<bool> closed;  // the thread has ended
+    std::atomic<uint64_t> dropped;
+
+    LogRing() : entries(Log::kRingCapacity), closed(false), dropped(0) {}
+};
+
+// A stream buffer over a fixed array; what does not fit is cut
+class LineBuffer : public std::streambuf {
+  public:
+    LineBuffer() { reset(); }
+
+    void reset() { setp(text_, text_ + Log::kMaxLineSize); }
+    const char* data() const { return pbase(); }
+    size_t size() const { return pptr() - pbase(); }
+
+  private:
+    char text_[Log::kMaxLineSize];
+};
+
+// What a thread keeps for logging, created when it first logs
+struct LogThread {
+    LineBuffer buffer;
+    std::ostream stream;
+    std::ios_base::fmtflags defaultFlags;
+    std::shared_ptr<LogRing> ring;
+
+    LogThread() : stream(&buffer), defaultFlags(stream.flags()) {}
+    ~LogThread() {
+        if (ring) {
+            ring->closed.store(true, std::memory_order_release);
+        }
+    }
+};
+
+LogThread& logThread() {
+    static thread_local LogThread thread;
+    return thread;
+}
+
+// The background thread that prints the rings, started with the first line logged and
+// stopped at exit after printing what is left
+class LogDrain {
+  public:
+    static LogDrain& instance() {
+        static LogDrain drain;
+        return drain;
+    }
+
+    std::shared_ptr<LogRing> addRing() {
+        std::shared_ptr<LogRing> ring(new LogRing());
+        std::lock_guard<std::mutex> lock(mutex_);
+        rings_.push_back(ring);
+        return ring;
+    }
+
+    void flush() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        uint64_t request = ++flushRequests_;
+        wakeUp_.notify_one();
+        while (flushesDone_ < request) {
+            flushed_.wait(lock);
+        }
+    }
+
+    uint64_t dropped() const { return dropped_; }
+
+  private:
+    std::mutex mutex_;
+    std::condition_variable wakeUp_;
+    std::condition_variable flushed_;
+    std::vector<std::shared_ptr<LogRing> > rings_;
+    bool stopping_;
+    uint64_t flushRequests_;
+    uint64_t flushesDone_;
+    std::atomic<uint64_t> dropped_;
+    std::vector<std::shared_ptr<LogRing> > snapshot_;  // drain thread only
+    std::vector<LogEntry> pending_;
+    std::thread thread_;
+
+    LogDrain() : stopping_(false), flushRequests_(0), flushesDone_(0), dropped_(0) {
+        thread_ = std::thread(&LogDrain::run, this);
+    }
+
+    ~LogDrain() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        wakeUp_.notify_one();
+        thread_.join();
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;) {
+            // A pass that starts after a flush request prints every line queued before it
+            uint64_t requested = flushRequests_;
+            bool stopping = stopping_;
+            snapshot_ = rings_;
+            lock.unlock();
+            bool printed = drain();
+            lock.lock();
+
+            flushesDone_ = requested;
+            flushed_.notify_all();
+            if (stopping && !printed) {
+                break;
+            }
+            if (!printed && flushRequests_ == flushesDone_ && !stopping_) {
+                wakeUp_.wait_for(lock, kDrainInterval);
+            }
+        }
+    }
+
+    // Prints what the rings hold, returns false if they were empty
+    bool drain() {
+        pending_.clear();
+        uint64_t dropped = 0;
+        std::vector<LogRing*> finished;
+        for (size_t i = 0; i < snapshot_.size(); ++i) {
+            LogRing& ring = *snapshot_[i];
+            // Closed before its last lines are taken, so it can go once they are
+            bool closed = ring.closed.load(std::memory_order_acquire);
+            pending_.resize(pending_.size() + 1);
+            while (ring.entries.tryPop(pending_.back())) {
+                pending_.resize(pending_.size() + 1);
+            }
+            pending_.pop_back();
+            dropped += ring.dropped.exchange(0);
+            if (closed) {
+                finished.push_back(&ring);
+            }
+        }
+        if (!finished.empty()) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (size_t i = 0; i < finished.size(); ++i) {
+                for (size_t r = 0; r < rings_.size(); ++r) {
+                    if (rings_[r].get() == finished[i]) {
+                        rings_.erase(rings_.begin() + r);
+                        break;
+                    }
+                }
+            }
+        }
+        snapshot_.clear();
+
+        std::sort(pending_.begin(), pending_.end(),
+                  [](const LogEntry& a, const LogEntry& b) { return a.sequence < b.sequence; });
+        // Runs of lines for the same stream go out in one write
+        std::string chunk;
+        FILE* chunkFile = nullptr;
+        for (size_t i = 0; i < pending_.size(); ++i) {
+            FILE* file = pending_[i].level >= kLogWarning ? stderr : stdout;
+            if (file != chunkFile && !chunk.empty()) {
+                fwrite(chunk.data(), 1, chunk.size(), chunkFile);
+                fflush(chunkFile);
+                chunk.clear();
+            }
+            chunkFile = file;
+            chunk.append(pending_[i].text, pending_[i].size);
+            chunk.push_back('\n');
+        }
+        if (!chunk.empty()) {
+            fwrite(chunk.data(), 1, chunk.size(), chunkFile);
+            fflush(chunkFile);
+        }
+        if (dropped > 0) {
+            dropped_ += dropped;
+            fprintf(stderr, "%llu log lines dropped, the log could not keep up\n",
+                    static_cast<unsigned long long>(dropped));
+        }
+        return !pending_.empty() || dropped > 0;
+    }
+};
+
+}  // namespace
+
+LogLimiter::LogLimiter(int burst, int intervalMs)
+    : burst_(burst), intervalMs_(intervalMs), windowStart_(0), count_(0), suppressed_(0) {}
+
+bool LogLimiter::allow(uint64_t& suppressed) {
+    int64_t now = steadyMilliseconds();
+    int64_t start = windowStart_.load(std::memory_order_relaxed);
+    if ((start == 0 || now - start >= intervalMs_) &&
+        windowStart_.compare_exchange_strong(start, now)) {
+        count_.store(0, std::memory_order_relaxed);
+    }
+    if (count_.fetch_add(1, std::memory_order_relaxed) < burst_) {
+        suppressed = suppressed_.exchange(0);
+        return true;
+    }
+    suppressed_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+const size_t Log::kMaxLineSize;
+const size_t Log::kRingCapacity;
+
+void Log::setLevel(LogLevel level) { g_level.store(level, std::memory_order_relaxed); }
+
+LogLevel Log::level() { return static_cast<LogLevel>(g_level.load(std::memory_order_relaxed)); }
+
+bool Log::enabled(LogLevel level) {
+    return level < kLogOff && level >= g_level.load(std::memory_order_relaxed);
+}
+
+bool Log::parseLevel(const std::string& text, LogLevel& level) {
+    static const char* const kNames[] = {"debug", "info", "warning", "error", "off"};
+    for (int i = kLogDebug; i <= kLogOff; ++i) {
+        if (text == kNames[i]) {
+            level = static_cast<LogLevel>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+void Log::write(LogLevel level, const char* text, size_t size) {
+    if (!enabled(level)) {
+        return;
+    }
+    LogThread& thread = logThread();
+    if (!thread.ring) {
+        thread.ring = LogDrain::instance().addRing();
+    }
+    LogEntry entry;
+    entry.sequence = g_sequence.fetch_add(1, std::memory_order_relaxed);
+    entry.level = level;
+    entry.size = std::min(size, kMaxLineSize);
+    memcpy(entry.text, text, entry.size);
+    if (!thread.ring->entries.tryPush(entry)) {
+        thread.ring->dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void Log::flush() { LogDrain::instance().flush(); }
+
+uint64_t Log::dropped() { return LogDrain::instance().dropped(); }
+
+LogLine::LogLine(LogLevel level, LogLimiter* limiter)
+    : level_(level), stream_(nullptr), suppressed_(0) {
+    if (!Log::enabled(level) || (limiter && !limiter->allow(suppressed_))) {
+        return;
+    }
+    LogThread& thread = logThread();
+    thread.buffer.reset();
+    thread.stream.clear();
+    thread.stream.flags(thread.defaultFlags);
+    thread.stream.fill(' ');
+    thread.stream.width(0);
+    thread.stream.precision(6);
+    stream_ = &thread.stream;
+}
+
+LogLine::~LogLine() {
+    if (!stream_) {
+        return;
+    }
+    if (suppressed_ > 0) {
+        *stream_ << " (" << suppressed_ << " similar lines suppressed)";
+    }
+    LogThread& thread = logThread();
+    Log::write(level_, thread.buffer.data(), thread.buffer.size());
+}
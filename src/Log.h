@@ -0,0 +1,86 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+enum LogLevel { kLogDebug, kLogInfo, kLogWarning, kLogError, kLogOff };
+
+// Keeps a call site that can fire for every packet or frame to at most burst lines per
+// interval. The lines over that are counted, and the next line printed says how many were
+// suppressed. Declare one static at the call site; it is thread-safe.
+class LogLimiter {
+  public:
+    explicit LogLimiter(int burst = 5, int intervalMs = 1000);
+
+    // Whether a line may be printed now. If so, suppressed is set to the lines held back
+    // since the previous one.
+    bool allow(uint64_t& suppressed);
+
+  private:
+    int burst_;
+    int64_t intervalMs_;
+    std::atomic<int64_t> windowStart_;  // steady clock milliseconds
+    std::atomic<int> count_;            // lines asked for in the window
+    std::atomic<uint64_t> suppressed_;
+
+    LogLimiter(const LogLimiter&);
+    LogLimiter& operator=(const LogLimiter&);
+};
+
+// Process-wide asynchronous log. Every thread that logs gets a ring of kRingCapacity lines
+// of up to kMaxLineSize bytes, which only it writes and one background thread drains, so
+// logging takes no lock and never waits for the console: a full ring drops the line and
+// counts it. The drain thread prints the lines of all rings in the order they were logged,
+// kLogWarning and above to stderr and the others to stdout, and reports dropped lines.
+// What is queued is printed at exit.
+class Log {
+  public:
+    static const size_t kMaxLineSize = 256;  // longer lines are cut
+    static const size_t kRingCapacity = 512;
+
+    static void setLevel(LogLevel level);
+    static LogLevel level();
+    static bool enabled(LogLevel level);
+    // Parses "debug", "info", "warning", "error" or "off"
+    static bool parseLevel(const std::string& text, LogLevel& level);
+
+    // Queues one line, without its newline
+    static void write(LogLevel level, const char* text, size_t size);
+    // Returns when the lines queued before the call have been printed
+    static void flush();
+    // Lines dropped because a ring was full
+    static uint64_t dropped();
+};
+
+// One log line, built with operator<< and queued when it goes out of scope:
+//   LogLine(kLogWarning) << name() << ": " << lost << " packets lost";
+// It is formatted into a buffer of the thread's, so a line costs no allocation and no lock.
+// Nothing is formatted for a level Log::level() filters out or a line the limiter holds
+// back. Stream flags such as std::hex last for the line only.
+class LogLine {
+  public:
+    explicit LogLine(LogLevel level, LogLimiter* limiter = nullptr);
+    ~LogLine();
+
+    template <typename T>
+    LogLine& operator<<(const T& value) {
+        if (stream_) {
+            *stream_ << value;
+        }
+        return *this;
+    }
+
+  private:
+    LogLevel level_;
+    std::ostream* stream_;  // null when the line is not printed
+    uint64_t suppressed_;
+
+    LogLine(const LogLine&);
+    LogLine& operator=(const LogLine&);
+};
+
+#endif  // LOG_H
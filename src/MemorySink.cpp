@@ -0,0 +1,23 @@
+#include "MemorySink.h"
+
+MemorySink::MemorySink() {}
+
+int MemorySink::open(const AVCodecParameters* /*codecParameters*/, AVRational /*timeBase*/) {
+    data_.clear();
+    packetSizes_.clear();
+    return 0;
+}
+
+int MemorySink::write(const AVPacket* packet) {
+    data_.insert(data_.end(), packet->data, packet->data + packet->size);
+    packetSizes_.push_back(packet->size);
+    return 0;
+}
+
+void MemorySink::close() {}
+
+std::string MemorySink::description() const { return "memory"; }
+
+const std::vector<uint8_t>& MemorySink::data() const { return data_; }
+
+const std::vector<int>& MemorySink::packetSizes() const { return packetSizes_; }
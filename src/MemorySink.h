@@ -0,0 +1,29 @@
+#ifndef MEMORY_SINK_H
+#define MEMORY_SINK_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "PacketSink.h"
+
+// Collects the raw elementary stream in memory
+class MemorySink : public PacketSink {
+  public:
+    MemorySink();
+
+    int open(const AVCodecParameters* codecParameters, AVRational timeBase) override;
+    int write(const AVPacket* packet) override;
+    void close() override;
+    std::string description() const override;
+
+    const std::vector<uint8_t>& data() const;
+    // Size of every packet written, in order
+    const std::vector<int>& packetSizes() const;
+
+  private:
+    std::vector<uint8_t> data_;
+    std::vector<int> packetSizes_;
+};
+
+#endif  // MEMORY_SINK_H
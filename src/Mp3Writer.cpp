@@ -0,0 +1,404 @@
+#include "Mp3Writer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <libavcodec/avcodec.h>
+#include <libavformat/version.h>
+#include <libavutil/crc.h>
+#ifdef __cplusplus
+}
+#endif
+
+#include "Log.h"
+
+// Layer III bitrates in kbit/s by bitrate index, for MPEG-1 and for MPEG-2 and 2.5
+static const int kBitrates[2][15] = {
+    {0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320},
+    {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160}};
+// MPEG-1 sample rates by index; MPEG-2 has half and MPEG-2.5 a quarter of them
+static const int kSampleRates[3] = {44100, 48000, 32000};
+// Size of the side information after the frame header, where the Xing tag starts
+static const size_t kSideInfoSizes[2][2] = {{32, 17}, {17, 9}};  // [MPEG-2 or 2.5][mono]
+
+// Layout of the Xing header from its tag on: tag, flags, frame count, byte count, seek
+// table, quality, then the LAME tag
+static const size_t kXingFramesOffset = 8;
+static const size_t kXingBytesOffset = 12;
+static const size_t kXingTocOffset = 16;
+static const size_t kXingTocSize = 100;
+static const size_t kLameOffset = kXingTocOffset + kXingTocSize + 4;
+static const size_t kLameDelayOffset = kLameOffset + 21;
+static const size_t kLameMusicLengthOffset = kLameOffset + 28;
+static const size_t kLameMusicCrcOffset = kLameOffset + 32;
+static const size_t kLameTagCrcOffset = kLameOffset + 34;
+static const size_t kXingSize = kLameOffset + 36;
+// The LAME tag CRC covers this much of the frame, whatever the Xing offset
+static const size_t kLameTagCrcCoverage = 190;
+
+// Padding libavformat leaves after the ID3v2 frames (metadata_header_padding of -1)
+static const size_t kId3PaddingSize = 16;
+
+// Bitrate in kbit/s of a layer III frame header, 0 for free format, -1 if the header is not
+// one the muxer's parser accepts
+static int headerBitrate(const uint8_t* data) {
+    int version = (data[1] >> 3) & 3;
+    int layer = (data[1] >> 1) & 3;
+    int bitrateIndex = data[2] >> 4;
+    int rateIndex = (data[2] >> 2) & 3;
+    if (data[0] != 0xff || (data[1] & 0xe0) != 0xe0 || version == 1 || layer != 1 ||
+        bitrateIndex == 15 || rateIndex == 3) {
+        return -1;
+    }
+    return kBitrates[version != 3][bitrateIndex];
+}
+
+static void putBe16(uint8_t* data, uint32_t value) {
+    data[0] = static_cast<uint8_t>(value >> 8);
+    data[1] = static_cast<uint8_t>(value);
+}
+
+static void putBe32(uint8_t* data, uint32_t value) {
+    data[0] = static_cast<uint8_t>(value >> 24);
+    data[1] = static_cast<uint8_t>(value >> 16);
+    data[2] = static_cast<uint8_t>(value >> 8);
+    data[3] = static_cast<uint8_t>(value);
+}
+
+// ID3v2 sizes have seven bits per byte
+static void putSynchsafe32(uint8_t* data, uint32_t value) {
+    data[0] = static_cast<uint8_t>((value >> 21) & 0x7f);
+    data[1] = static_cast<uint8_t>((value >> 14) & 0x7f);
+    data[2] = static_cast<uint8_t>((value >> 7) & 0x7f);
+    data[3] = static_cast<uint8_t>(value & 0x7f);
+}
+
+static const AVCRC* crcTable() { return av_crc_get_table(AV_CRC_16_ANSI_LE); }
+
+Mp3Writer::Mp3Writer(size_t bufferSize)
+    : bufferSize_(bufferSize > 0 ? bufferSize : 1),
+      fd_(-1),
+      writer_(nullptr),
+      file_(-1),
+      open_(false),
+      failed_(false),
+      position_(0),
+      bytesDropped_(0),
+      xingPosition_(0),
+      xingOffset_(0),
+      initialBitrate_(0),
+      variableBitrate_(false),
+      frames_(0),
+      audioBytes_(0),
+      audioCrc_(0),
+      seekStep_(1),
+      seekSeen_(0),
+      delay_(0),
+      padding_(0) {}
+
+Mp3Writer::~Mp3Writer() { close(); }
+
+int Mp3Writer::open(const std::string& path, const AVCodecParameters* codecParameters) {
+    if (open_) {
+        return -1;
+    }
+    fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd_ < 0) {
+        LogLine(kLogError) << "Could not open output file " << path << ": " << strerror(errno);
+        return -1;
+    }
+    writer_ = nullptr;
+    return start(path, codecParameters);
+}
+
+int Mp3Writer::open(DiskWriter& writer, const std::string& path,
+                    const AVCodecParameters* codecParameters) {
+    if (open_) {
+        return -1;
+    }
+    file_ = writer.open(path);
+    if (file_ < 0) {
+        return -1;
+    }
+    writer_ = &writer;
+    return start(path, codecParameters);
+}
+
+int Mp3Writer::start(const std::string& path, const AVCodecParameters* codecParameters) {
+    path_ = path;
+    open_ = true;
+    failed_ = false;
+    position_ = 0;
+    bytesDropped_ = 0;
+    initialBitrate_ = 0;
+    variableBitrate_ = false;
+    frames_ = 0;
+    audioCrc_ = 0;
+    seekPoints_.clear();
+    seekStep_ = 1;
+    seekSeen_ = 0;
+    delay_ = 0;
+    padding_ = 0;
+    buffer_.clear();
+    buffer_.reserve(bufferSize_);
+
+    if (!buildXingFrame(codecParameters)) {
+        LogLine(kLogError) << "MP3 cannot carry " << codecParameters->sample_rate << " Hz "
+                           << codecParameters->ch_layout.nb_channels << "ch, not writing "
+                           << path;
+        failed_ = true;
+        close();
+        return -1;
+    }
+
+    // ID3v2.4 tag with the encoder in a TSSE frame, as the muxer writes it
+    static const char kEncoder[] = LIBAVFORMAT_IDENT;
+    const size_t textSize = 1 + sizeof(kEncoder);  // UTF-8 marker, text, terminator
+    std::vector<uint8_t> tag(10 + 10 + textSize + kId3PaddingSize, 0);
+    memcpy(&tag[0], "ID3", 3);
+    tag[3] = 4;
+    putSynchsafe32(&tag[6], static_cast<uint32_t>(tag.size() - 10));
+    memcpy(&tag[10], "TSSE", 4);
+    putSynchsafe32(&tag[14], static_cast<uint32_t>(textSize));
+    tag[20] = 3;
+    memcpy(&tag[21], kEncoder, sizeof(kEncoder));
+    append(tag.data(), tag.size());
+
+    xingPosition_ = position_ + static_cast<int64_t>(buffer_.size());
+    append(xingFrame_.data(), xingFrame_.size());
+    audioBytes_ = xingFrame_.size();
+    return failed_ ? -1 : 0;
+}
+
+bool Mp3Writer::buildXingFrame(const AVCodecParameters* codecParameters) {
+    int sampleRate = codecParameters->sample_rate;
+    int channels = codecParameters->ch_layout.nb_channels;
+    int version = -1;  // header bits: 3 MPEG-1, 2 MPEG-2, 0 MPEG-2.5
+    int rateIndex = 0;
+    for (; rateIndex < 3; ++rateIndex) {
+        if (sampleRate == kSampleRates[rateIndex]) {
+            version = 3;
+        } else if (sampleRate == kSampleRates[rateIndex] / 2) {
+            version = 2;
+        } else if (sampleRate == kSampleRates[rateIndex] / 4) {
+            version = 0;
+        } else {
+            continue;
+        }
+        break;
+    }
+    if (version < 0 || channels < 1 || channels > 2) {
+        return false;
+    }
+    int lsf = version != 3;
+    int mono = channels == 1;
+
+    // Sync, version, layer III, no CRC, sample rate, mono or stereo, and the bitrate
+    // nearest the stream's that leaves room for the header
+    uint32_t header = 0xffe00000u | (version << 19) | (1 << 17) | (1 << 16) |
+                      (rateIndex << 10) | ((mono ? 3 : 0) << 6);
+    int bitrateIndex = 1;
+    for (int i = 2; i < 15; ++i) {
+        if (std::abs(kBitrates[lsf][i] * 1000 - codecParameters->bit_rate) <
+            std::abs(kBitrates[lsf][bitrateIndex] * 1000 - codecParameters->bit_rate)) {
+            bitrateIndex = i;
+        }
+    }
+    xingOffset_ = 4 + kSideInfoSizes[lsf][mono];
+    size_t frameSize = 0;
+    for (; bitrateIndex < 15; ++bitrateIndex) {
+        frameSize = (lsf ? 72000 : 144000) * kBitrates[lsf][bitrateIndex] / sampleRate;
+        if (xingOffset_ + kXingSize <= frameSize) {
+            break;
+        }
+    }
+    if (bitrateIndex == 15) {
+        return false;
+    }
+    header |= bitrateIndex << 12;
+
+    xingFrame_.assign(frameSize, 0);
+    putBe32(&xingFrame_[0], header);
+    uint8_t* xing = &xingFrame_[xingOffset_];
+    memcpy(xing, "Xing", 4);
+    putBe32(xing + 4, 0x0f);  // frames, bytes, seek table and quality present
+    for (size_t i = 0; i < kXingTocSize; ++i) {
+        xing[kXingTocOffset + i] = static_cast<uint8_t>(255 * i / kXingTocSize);
+    }
+    // The muxer names the encoder from the stream's metadata, which none of ours carries
+    memcpy(xing + kLameOffset, "Lavf", 4);
+    return true;
+}
+
+int Mp3Writer::write(const uint8_t* data, size_t size) { return writeFrames(data, size, nullptr); }
+
+int Mp3Writer::write(const AVPacket* packet) {
+    size_t sideDataSize = 0;
+    const uint8_t* skipSamples =
+        av_packet_get_side_data(packet, AV_PKT_DATA_SKIP_SAMPLES, &sideDataSize);
+    return writeFrames(packet->data, packet->size, sideDataSize >= 10 ? skipSamples : nullptr);
+}
+
+static uint32_t readLe32(const uint8_t* data) {
+    return data[0] | (data[1] << 8) | (data[2] << 16) | (static_cast<uint32_t>(data[3]) << 24);
+}
+
+int Mp3Writer::writeFrames(const uint8_t* data, size_t size, const uint8_t* skipSamples) {
+    if (!open_) {
+        return -1;
+    }
+    // The muxer leaves a packet too short for a header out of the Xing frame
+    if (size < 4) {
+        append(data, size);
+        return failed_ ? -1 : 0;
+    }
+
+    int bitrate = headerBitrate(data);
+    if (bitrate >= 0) {
+        if (initialBitrate_ == 0) {
+            initialBitrate_ = bitrate;
+        }
+        if (bitrate == 0 || bitrate != initialBitrate_) {
+            variableBitrate_ = true;
+        }
+    }
+    frames_++;
+    audioBytes_ += size;
+    audioCrc_ = static_cast<uint16_t>(av_crc(crcTable(), audioCrc_, data, size));
+    if (++seekSeen_ == seekStep_) {
+        seekSeen_ = 0;
+        seekPoints_.push_back(audioBytes_);
+        if (seekPoints_.size() == kMaxSeekPoints) {
+            for (size_t i = 1; i < kMaxSeekPoints; i += 2) {
+                seekPoints_[i / 2] = seekPoints_[i];
+            }
+            seekPoints_.resize(kMaxSeekPoints / 2);
+            seekStep_ *= 2;
+        }
+    }
+
+    // The encoder's skip samples: its delay on the first packet, the padding on the last.
+    // Decoders drop the delay after their own 528 + 1 samples.
+    if (skipSamples) {
+        padding_ = std::max(static_cast<int>(readLe32(skipSamples + 4)) + 528 + 1, 0);
+        if (delay_ == 0) {
+            delay_ = std::max(static_cast<int>(readLe32(skipSamples)) - 528 - 1, 0);
+        }
+    } else {
+        padding_ = 0;
+    }
+
+    append(data, size);
+    return failed_ ? -1 : 0;
+}
+
+int Mp3Writer::close() {
+    if (!open_) {
+        return 0;
+    }
+    open_ = false;
+
+    if (!failed_) {
+        flush();
+        finishXingFrame();
+        writeAt(xingPosition_, xingFrame_.data(), xingFrame_.size());
+    }
+    buffer_.clear();
+    if (writer_) {
+        writer_->close(file_);
+        file_ = -1;
+        writer_ = nullptr;
+    } else if (fd_ >= 0) {
+        if (::close(fd_) < 0 && !failed_) {
+            LogLine(kLogError) << "Error closing " << path_ << ": " << strerror(errno);
+            failed_ = true;
+        }
+        fd_ = -1;
+    }
+    return failed_ ? -1 : 0;
+}
+
+void Mp3Writer::append(const uint8_t* data, size_t size) {
+    if (buffer_.size() + size > bufferSize_) {
+        flush();
+    }
+    buffer_.insert(buffer_.end(), data, data + size);
+}
+
+void Mp3Writer::flush() {
+    if (buffer_.empty()) {
+        return;
+    }
+    size_t size = buffer_.size();
+    writeAt(position_, buffer_.data(), size);
+    position_ += static_cast<int64_t>(size);
+    buffer_.clear();
+}
+
+void Mp3Writer::writeAt(int64_t offset, const uint8_t* data, size_t size) {
+    if (writer_) {
+        if (data == buffer_.data()) {
+            // Hand the buffer itself over and start a new one
+            if (!writer_->write(file_, offset, buffer_)) {
+                bytesDropped_ += size;
+            }
+            buffer_.reserve(bufferSize_);
+        } else {
+            std::vector<uint8_t> chunk(data, data + size);
+            if (!writer_->write(file_, offset, chunk)) {
+                bytesDropped_ += size;
+            }
+        }
+        return;
+    }
+    while (size > 0 && !failed_) {
+        ssize_t written = pwrite(fd_, data, size, offset);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LogLine(kLogError) << "Error writing " << path_ << ": " << strerror(errno);
+            failed_ = true;
+            break;
+        }
+        data += written;
+        size -= written;
+        offset += written;
+    }
+}
+
+void Mp3Writer::finishXingFrame() {
+    uint8_t* xing = &xingFrame_[xingOffset_];
+    if (!variableBitrate_) {
+        memcpy(xing, "Info", 4);
+    }
+    putBe32(xing + kXingFramesOffset, static_cast<uint32_t>(frames_));
+    putBe32(xing + kXingBytesOffset, static_cast<uint32_t>(audioBytes_));
+    // Entry i is where i percent of the frames end, in 256ths of the stream; the first is
+    // always 0
+    xing[kXingTocOffset] = 0;
+    for (size_t i = 1; i < kXingTocSize; ++i) {
+        size_t j = i * seekPoints_.size() / kXingTocSize;
+        uint64_t point = j < seekPoints_.size() ? seekPoints_[j] : 0;
+        xing[kXingTocOffset + i] =
+            static_cast<uint8_t>(std::min<uint64_t>(256 * point / audioBytes_, 255));
+    }
+
+    int delay = std::min(delay_, (1 << 12) - 1);
+    int padding = std::min(padding_, (1 << 12) - 1);
+    xing[kLameDelayOffset] = static_cast<uint8_t>(delay >> 4);
+    xing[kLameDelayOffset + 1] = static_cast<uint8_t>(((delay & 0x0f) << 4) | (padding >> 8));
+    xing[kLameDelayOffset + 2] = static_cast<uint8_t>(padding);
+    putBe32(xing + kLameMusicLengthOffset, static_cast<uint32_t>(audioBytes_));
+    putBe16(xing + kLameMusicCrcOffset, audioCrc_);
+    putBe16(xing + kLameTagCrcOffset,
+            av_crc(crcTable(), 0, xingFrame_.data(), kLameTagCrcCoverage));
+}
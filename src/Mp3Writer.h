@@ -0,0 +1,96 @@
+#ifndef MP3_WRITER_H
+#define MP3_WRITER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "DiskWriter.h"
+
+struct AVCodecParameters;
+struct AVPacket;
+
+// Writes an MP3 file from encoded frames without libavformat. The file is the one libavformat's
+// mp3 muxer writes for the same packets, byte for byte (bench/mp3_writer_bench checks it): an
+// ID3v2.4 tag naming the encoder, a silent Xing/LAME frame, then the frames as given. The
+// frames are appended to one large buffer, so a packet costs a memcpy and a look at its
+// header; the buffer goes to the file when full. At close the Xing frame is rewritten with the
+// frame and byte counts, the seek table (TOC) and the LAME tag's lengths and CRCs, and is
+// named "Info" when every frame has the same bitrate.
+//
+// The file is written directly, or through a DiskWriter so the caller never waits for the
+// disk. Not thread-safe.
+class Mp3Writer {
+  public:
+    static const size_t kDefaultBufferSize = 1 << 20;
+
+    explicit Mp3Writer(size_t bufferSize = kDefaultBufferSize);
+    ~Mp3Writer();
+
+    // Creates path and starts the stream with the codec parameters' sample rate, channels and
+    // bitrate. Returns -1 on failure.
+    int open(const std::string& path, const AVCodecParameters* codecParameters);
+    // The same, with the file written by writer
+    int open(DiskWriter& writer, const std::string& path,
+             const AVCodecParameters* codecParameters);
+    // Appends a packet of whole MP3 frames
+    int write(const uint8_t* data, size_t size);
+    // The same, and takes the encoder delay and padding for the LAME tag from the packet's
+    // skip samples, as the muxer does
+    int write(const AVPacket* packet);
+    // Writes what is buffered and the final Xing frame, and closes the file. Returns -1 if
+    // a write failed.
+    int close();
+
+    bool isOpen() const { return open_; }
+    uint64_t framesWritten() const { return frames_; }
+    // Bytes the DiskWriter dropped because its queue was full
+    uint64_t bytesDropped() const { return bytesDropped_; }
+
+  private:
+    // The Xing frame's seek table samples the running byte count every step_ frames; when
+    // the samples fill it, every other one is dropped and the step doubles
+    static const size_t kMaxSeekPoints = 400;
+
+    size_t bufferSize_;
+    std::vector<uint8_t> buffer_;
+    std::string path_;
+    int fd_;
+    DiskWriter* writer_;
+    int file_;  // DiskWriter file id
+    bool open_;
+    bool failed_;
+    int64_t position_;  // file offset of buffer_[0]
+    uint64_t bytesDropped_;
+
+    std::vector<uint8_t> xingFrame_;
+    int64_t xingPosition_;  // file offset of the Xing frame
+    size_t xingOffset_;     // of the "Xing" tag within the frame
+    int initialBitrate_;    // kbit/s of the first frame, 0 before it
+    bool variableBitrate_;
+    uint64_t frames_;
+    uint64_t audioBytes_;  // the Xing frame and the frames after it
+    uint16_t audioCrc_;
+    std::vector<uint64_t> seekPoints_;
+    uint64_t seekStep_;
+    uint64_t seekSeen_;
+    int delay_;    // encoder delay and padding for the LAME tag, in samples
+    int padding_;
+
+    Mp3Writer(const Mp3Writer&);
+    Mp3Writer& operator=(const Mp3Writer&);
+
+    int start(const std::string& path, const AVCodecParameters* codecParameters);
+    // skipSamples is the packet's AV_PKT_DATA_SKIP_SAMPLES side data, or null
+    int writeFrames(const uint8_t* data, size_t size, const uint8_t* skipSamples);
+    // Builds the silent frame the Xing header rides in, false for a format MP3 cannot carry
+    bool buildXingFrame(const AVCodecParameters* codecParameters);
+    void append(const uint8_t* data, size_t size);
+    void flush();
+    // Writes data at offset, past what has been flushed
+    void writeAt(int64_t offset, const uint8_t* data, size_t size);
+    void finishXingFrame();
+};
+
+#endif  // MP3_WRITER_H
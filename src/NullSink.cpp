@@ -0,0 +1,28 @@
+#include "NullSink.h"
+
+#include <iostream>
+
+NullSink::NullSink() : packetCount_(0), byteCount_(0) {}
+
+int NullSink::open(const AVCodecParameters* /*codecParameters*/, AVRational /*timeBase*/) {
+    packetCount_ = 0;
+    byteCount_ = 0;
+    return 0;
+}
+
+int NullSink::write(const AVPacket* packet) {
+    packetCount_++;
+    byteCount_ += packet->size;
+    return 0;
+}
+
+void NullSink::close() {
+    std::cout << "Null sink discarded " << packetCount_ << " packets (" << byteCount_
+              << " bytes)" << std::endl;
+}
+
+std::string NullSink::description() const { return "null"; }
+
+int64_t NullSink::packetCount() const { return packetCount_; }
+
+int64_t NullSink::byteCount() const { return byteCount_; }
@@ -0,0 +1,27 @@
+#ifndef NULL_SINK_H
+#define NULL_SINK_H
+
+#include <cstdint>
+#include <string>
+
+#include "PacketSink.h"
+
+// Discards packets; useful to measure encoding throughput without I/O
+class NullSink : public PacketSink {
+  public:
+    NullSink();
+
+    int open(const AVCodecParameters* codecParameters, AVRational timeBase) override;
+    int write(const AVPacket* packet) override;
+    void close() override;
+    std::string description() const override;
+
+    int64_t packetCount() const;
+    int64_t byteCount() const;
+
+  private:
+    int64_t packetCount_;
+    int64_t byteCount_;
+};
+
+#endif  // NULL_SINK_H
@@ -0,0 +1,162 @@
+#include "OutputSpec.h"
+
+#include <algorithm>
+#include <cctype>
+#include <sstream>
+#include <vector>
+
+extern "C" {
+#include <libavutil/channel_layout.h>
+}
+
+// Parses "320k", "128000" or "1.5m" as bits per second
+static bool parseBitRate(const std::string& text, int64_t& bitRate) {
+    if (text.empty()) {
+        return false;
+    }
+
+    double multiplier = 1.0;
+    std::string number = text;
+    char suffix = text[text.size() - 1];
+    if (suffix == 'k' || suffix == 'K') {
+        multiplier = 1000.0;
+        number = text.substr(0, text.size() - 1);
+    } else if (suffix == 'm' || suffix == 'M') {
+        multiplier = 1000000.0;
+        number = text.substr(0, text.size() - 1);
+    }
+
+    try {
+        size_t used = 0;
+        double value = std::stod(number, &used);
+        if (used != number.size() || value <= 0) {
+            return false;
+        }
+        bitRate = static_cast<int64_t>(value * multiplier);
+    } catch (const std::exception& e) {
+        return false;
+    }
+    return true;
+}
+
+static bool parsePositiveInt(const std::string& text, int& value) {
+    try {
+        size_t used = 0;
+        value = std::stoi(text, &used);
+        return used == text.size() && value > 0;
+    } catch (const std::exception& e) {
+        return false;
+    }
+}
+
+bool OutputSpec::parse(const std::string& text, OutputSpec& spec) {
+    std::vector<std::string> fields;
+    std::stringstream stream(text);
+    std::string field;
+    while (std::getline(stream, field, ':')) {
+        fields.push_back(field);
+    }
+    if (fields.empty() || fields.size() > 5 || fields[0].empty()) {
+        return false;
+    }
+
+    OutputSpec parsed;
+    parsed.codecId = codecIdForExtension(fields[0]);
+    if (parsed.codecId == AV_CODEC_ID_NONE) {
+        return false;
+    }
+    parsed.sampleFormat = defaultSampleFormat(parsed.codecId);
+
+    if (fields.size() > 1 && !parseBitRate(fields[1], parsed.bitRate)) {
+        return false;
+    }
+    if (fields.size() > 2 && !parsePositiveInt(fields[2], parsed.sampleRate)) {
+        return false;
+    }
+    if (fields.size() > 3 && !parsePositiveInt(fields[3], parsed.channels)) {
+        return false;
+    }
+    if (fields.size() > 4) {
+        parsed.sampleFormat = av_get_sample_fmt(fields[4].c_str());
+        if (parsed.sampleFormat == AV_SAMPLE_FMT_NONE) {
+            return false;
+        }
+    }
+
+    spec = parsed;
+    return true;
+}
+
+AVSampleFormat OutputSpec::defaultSampleFormat(AVCodecID codecId) {
+    if (codecId == AV_CODEC_ID_AAC || codecId == AV_CODEC_ID_VORBIS) {
+        return AV_SAMPLE_FMT_FLTP;  // AAC and Vorbis require fltp
+    } else if (codecId == AV_CODEC_ID_PCM_S16LE || codecId == AV_CODEC_ID_FLAC) {
+        return AV_SAMPLE_FMT_S16;  // WAV and FLAC take packed s16
+    } else {
+        return AV_SAMPLE_FMT_S16P;  // For MP3 encoding
+    }
+}
+
+AVCodecID OutputSpec::codecIdForExtension(const std::string& extension) {
+    std::string ext = extension;
+    std::transform(ext.begin(), ext.end(), ext.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+
+    if (ext == "mp3") {
+        return AV_CODEC_ID_MP3;
+    } else if (ext == "wav") {
+        return AV_CODEC_ID_PCM_S16LE;
+    } else if (ext == "flac") {
+        return AV_CODEC_ID_FLAC;
+    } else if (ext == "ogg" || ext == "oga") {
+        return AV_CODEC_ID_VORBIS;
+    } else if (ext == "m4a" || ext == "mp4" || ext == "aac") {
+        return AV_CODEC_ID_AAC;
+    }
+    return AV_CODEC_ID_NONE;
+}
+
+std::string OutputSpec::fileExtension() const {
+    switch (codecId) {
+        case AV_CODEC_ID_PCM_S16LE:
+            return "wav";
+        case AV_CODEC_ID_AAC:
+            return "aac";
+        case AV_CODEC_ID_FLAC:
+            return "flac";
+        case AV_CODEC_ID_VORBIS:
+            return "ogg";
+        case AV_CODEC_ID_MP3:
+        default:
+            return "mp3";
+    }
+}
+
+bool OutputSpec::sameAudioFormat(const OutputSpec& other) const {
+    return sampleRate == other.sampleRate && channels == other.channels &&
+           sampleFormat == other.sampleFormat;
+}
+
+bool OutputSpec::matchesStream(const AVCodecParameters* codecParameters) const {
+    return codecParameters && codecParameters->codec_id == codecId &&
+           codecParameters->bit_rate == bitRate && codecParameters->sample_rate == sampleRate &&
+           codecParameters->ch_layout.nb_channels == channels;
+}
+
+void OutputSpec::fillCodecParameters(AVCodecParameters* codecParameters) const {
+    codecParameters->codec_type = AVMEDIA_TYPE_AUDIO;
+    codecParameters->codec_id = codecId;
+    codecParameters->bit_rate = bitRate;
+    codecParameters->sample_rate = sampleRate;
+    codecParameters->format = sampleFormat;
+    av_channel_layout_uninit(&codecParameters->ch_layout);
+    av_channel_layout_default(&codecParameters->ch_layout, channels);
+}
+
+std::string OutputSpec::toString() const {
+    std::stringstream stream;
+    const char* formatName = av_get_sample_fmt_name(sampleFormat);
+    stream << avcodec_get_name(codecId) << " " << bitRate / 1000 << "k " << sampleRate << " Hz "
+           << channels << "ch " << (formatName ? formatName : "?");
+    return stream.str();
+}
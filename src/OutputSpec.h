@@ -0,0 +1,61 @@
+#ifndef OUTPUT_SPEC_H
+#define OUTPUT_SPEC_H
+
+#include <cstdint>
+#include <string>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <libavcodec/avcodec.h>
+#include <libavutil/samplefmt.h>
+#ifdef __cplusplus
+}
+#endif
+
+// Format of one encoded output (rendition). Every component that produces or consumes the
+// output stream (Resampler, FrameEncoder, the sinks, UdpServer) takes its rate, channel
+// count, sample format and bitrate from here.
+struct OutputSpec {
+    AVCodecID codecId;
+    int64_t bitRate;
+    int sampleRate;
+    int channels;
+    AVSampleFormat sampleFormat;  // what the encoder takes and the resampler produces
+
+    OutputSpec()
+        : codecId(AV_CODEC_ID_MP3),
+          bitRate(320000),
+          sampleRate(48000),
+          channels(2),
+          sampleFormat(AV_SAMPLE_FMT_S16P) {}
+
+    // Parses "<codec>[:<bitrate>[:<sample_rate>[:<channels>[:<sample_format>]]]]", e.g.
+    // "mp3:128k" or "aac:192k:44100:2:fltp". The codec is given by its file extension (mp3,
+    // aac, flac, ...); the sample format defaults to defaultSampleFormat() of the codec.
+    static bool parse(const std::string& text, OutputSpec& spec);
+
+    // Sample format the encoder for codecId is opened with unless the spec names another
+    static AVSampleFormat defaultSampleFormat(AVCodecID codecId);
+
+    // Codec for a file extension without the dot, AV_CODEC_ID_NONE if unknown
+    static AVCodecID codecIdForExtension(const std::string& extension);
+
+    // File extension without the dot, e.g. "mp3"
+    std::string fileExtension() const;
+
+    // Same resampled input: sample rate, channel count and sample format
+    bool sameAudioFormat(const OutputSpec& other) const;
+
+    // The stream already has this codec, bitrate, sample rate and channel count, so its
+    // packets can be copied instead of re-encoded. The bitrate of an MP3 stream is the one
+    // of its first frame, or its average; check FrameReader::isConstantBitrateMp3() as well.
+    bool matchesStream(const AVCodecParameters* codecParameters) const;
+
+    // Codec parameters of the encoded stream, for muxers that get packets without an encoder
+    void fillCodecParameters(AVCodecParameters* codecParameters) const;
+
+    std::string toString() const;
+};
+
+#endif  // OUTPUT_SPEC_H
@@ -0,0 +1,28 @@
+#include "PacketAggregation.h"
+
+void appendAggregated(std::vector<uint8_t>& payload, const uint8_t* data, size_t size) {
+    payload.push_back(static_cast<uint8_t>(size >> 8));
+    payload.push_back(static_cast<uint8_t>(size & 0xff));
+    payload.insert(payload.end(), data, data + size);
+}
+
+bool splitAggregated(const uint8_t* data, size_t size,
+                     std::vector<std::pair<const uint8_t*, size_t> >& packets) {
+    size_t count = packets.size();
+    size_t offset = 0;
+    while (offset + kAggregateLengthSize <= size) {
+        size_t length = (static_cast<size_t>(data[offset]) << 8) | data[offset + 1];
+        offset += kAggregateLengthSize;
+        if (length == 0 || length > size - offset) {
+            packets.resize(count);
+            return false;
+        }
+        packets.push_back(std::make_pair(data + offset, length));
+        offset += length;
+    }
+    if (offset != size || size == 0) {
+        packets.resize(count);
+        return false;
+    }
+    return true;
+}
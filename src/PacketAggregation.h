@@ -0,0 +1,27 @@
+#ifndef PACKET_AGGREGATION_H
+#define PACKET_AGGREGATION_H
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Framing of several encoded packets in one datagram payload: every packet is preceded by
+// its length as a 16-bit big-endian number, and the lengths add up to the payload size.
+// With RTP the payload follows the RTP header (and the RFC 2250 header for MPEG audio) of
+// the datagram, whose timestamp is the first packet's.
+static const int kAggregateLengthSize = 2;
+static const size_t kAggregateMaxPacketSize = 0xffff;
+// IPv4 and UDP headers, the part of the MTU that is not payload
+static const int kUdpIpv4Overhead = 28;
+
+// Appends one packet, size <= kAggregateMaxPacketSize, to an aggregated payload
+void appendAggregated(std::vector<uint8_t>& payload, const uint8_t* data, size_t size);
+
+// Appends the packets of an aggregated payload to packets, as pointers into data. Returns
+// false and leaves packets as it was when the lengths do not add up to size, which means
+// the payload is not aggregated.
+bool splitAggregated(const uint8_t* data, size_t size,
+                     std::vector<std::pair<const uint8_t*, size_t> >& packets);
+
+#endif  // PACKET_AGGREGATION_H
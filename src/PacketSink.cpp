@@ -0,0 +1,69 @@
+#include "PacketSink.h"
+
+#include <unistd.h>
+
+#include <vector>
+
+#include "FileSink.h"
+#include "MemorySink.h"
+#include "NullSink.h"
+#include "PipeSink.h"
+#include "UdpSink.h"
+
+std::unique_ptr<PacketSink> createPacketSink(const std::string& description) {
+    return createPacketSink(description, UdpSinkOptions());
+}
+
+std::unique_ptr<PacketSink> createPacketSink(const std::string& description,
+                                             const UdpSinkOptions& udpOptions) {
+    size_t colon = description.find(':');
+    std::string type = description.substr(0, colon);
+    std::string argument = (colon != std::string::npos) ? description.substr(colon + 1) : "";
+
+    if (type == "file" && !argument.empty()) {
+        return std::unique_ptr<PacketSink>(new FileSink(argument));
+    } else if (type == "udp" || type == "rtp") {
+        std::vector<std::string> fields;
+        size_t start = 0;
+        size_t end;
+        while ((end = argument.find(':', start)) != std::string::npos) {
+            fields.push_back(argument.substr(start, end - start));
+            start = end + 1;
+        }
+        fields.push_back(argument.substr(start));
+        if (fields.size() < 2 || fields.size() > 4 || fields[0].empty()) {
+            return nullptr;
+        }
+        int port;
+        UdpSinkOptions options = udpOptions;
+        options.transport =
+            type == "rtp" ? UdpSinkOptions::kTransportRtp : UdpSinkOptions::kTransportRaw;
+        try {
+            port = std::stoi(fields[1]);
+            if (fields.size() > 2) {
+                options.batchSize = std::stoi(fields[2]);
+            }
+            if (fields.size() > 3) {
+                options.flushIntervalMs = std::stoi(fields[3]);
+            }
+        } catch (const std::exception& e) {
+            return nullptr;
+        }
+        return std::unique_ptr<PacketSink>(new UdpSink(fields[0], port, options));
+    } else if (type == "pipe" && argument == "-") {
+        // The stream takes over stdout; console output moves to stderr
+        int fd = dup(STDOUT_FILENO);
+        if (fd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+            return nullptr;
+        }
+        return std::unique_ptr<PacketSink>(new PipeSink(fd));
+    } else if (type == "pipe" && !argument.empty()) {
+        return std::unique_ptr<PacketSink>(new PipeSink(argument));
+    } else if (type == "memory") {
+        return std::unique_ptr<PacketSink>(new MemorySink());
+    } else if (type == "null") {
+        return std::unique_ptr<PacketSink>(new NullSink());
+    }
+
+    return nullptr;
+}
@@ -0,0 +1,50 @@
+#ifndef PACKET_SINK_H
+#define PACKET_SINK_H
+
+#include <memory>
+#include <string>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#ifdef __cplusplus
+}
+#endif
+
+// Destination for encoded packets. AudioProcessor hands every packet to each registered
+// sink once, by reference: a sink must not modify or keep the packet after write() returns
+// (use av_packet_ref() to hold on to it).
+class PacketSink {
+  public:
+    virtual ~PacketSink() {}
+
+    // Called once before the first packet with the parameters of the encoded stream
+    virtual int open(const AVCodecParameters* codecParameters, AVRational timeBase) = 0;
+    virtual int write(const AVPacket* packet) = 0;
+    // Finishes the output; called once after the last packet, also after a failed write
+    virtual void close() = 0;
+
+    virtual std::string description() const = 0;
+};
+
+struct UdpSinkOptions;
+
+// Creates a sink from a command line description:
+//   file:<path>        muxed file, container chosen from the extension
+//   udp:<ip>:<port>[:<batch>[:<flush_ms>]]
+//                      one datagram per packet, empty datagram at the end, sent in
+//                      sendmmsg() batches (see UdpSink)
+//   rtp:<ip>:<port>[:<batch>[:<flush_ms>]]
+//                      the same with an RTP header in every datagram
+//   pipe:<path>|-      raw elementary stream to a FIFO, file or stdout
+//   memory             raw elementary stream kept in memory
+//   null               discards packets
+// Returns nullptr for an unknown description.
+std::unique_ptr<PacketSink> createPacketSink(const std::string& description);
+// UDP and RTP sinks start from udpOptions, the batch fields of the description override it
+std::unique_ptr<PacketSink> createPacketSink(const std::string& description,
+                                             const UdpSinkOptions& udpOptions);
+
+#endif  // PACKET_SINK_H
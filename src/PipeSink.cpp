@@ -0,0 +1,54 @@
+#include "PipeSink.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <iostream>
+
+PipeSink::PipeSink(const std::string& path) : path_(path), fd_(-1) {}
+
+PipeSink::PipeSink(int fd) : path_("fd:" + std::to_string(fd)), fd_(fd) {}
+
+PipeSink::~PipeSink() { close(); }
+
+int PipeSink::open(const AVCodecParameters* /*codecParameters*/, AVRational /*timeBase*/) {
+    if (fd_ >= 0) {
+        return 0;
+    }
+
+    // Blocks until a reader opens the FIFO
+    fd_ = ::open(path_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd_ < 0) {
+        std::cerr << "Could not open pipe " << path_ << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+int PipeSink::write(const AVPacket* packet) {
+    const uint8_t* data = packet->data;
+    size_t remaining = packet->size;
+    while (remaining > 0) {
+        ssize_t written = ::write(fd_, data, remaining);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << "Error writing to pipe " << path_ << std::endl;
+            return -1;
+        }
+        data += written;
+        remaining -= written;
+    }
+    return 0;
+}
+
+void PipeSink::close() {
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+}
+
+std::string PipeSink::description() const { return "pipe:" + path_; }
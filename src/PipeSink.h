@@ -0,0 +1,26 @@
+#ifndef PIPE_SINK_H
+#define PIPE_SINK_H
+
+#include <string>
+
+#include "PacketSink.h"
+
+// Writes the raw elementary stream to a FIFO, a plain file or an already open descriptor
+class PipeSink : public PacketSink {
+  public:
+    explicit PipeSink(const std::string& path);
+    // Takes ownership of fd
+    explicit PipeSink(int fd);
+    ~PipeSink();
+
+    int open(const AVCodecParameters* codecParameters, AVRational timeBase) override;
+    int write(const AVPacket* packet) override;
+    void close() override;
+    std::string description() const override;
+
+  private:
+    std::string path_;
+    int fd_;
+};
+
+#endif  // PIPE_SINK_H
@@ -0,0 +1,295 @@
+#include "PolyphaseResampler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define POLYPHASE_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+namespace {
+
+const int kMaxPhases = 1024;
+// Passband edge relative to the input Nyquist frequency and Kaiser window shape, the same
+// trade-off as the swr defaults (cutoff 0.97, beta 9)
+const double kCutoff = 0.97;
+const double kKaiserBeta = 9.0;
+
+int greatestCommonDivisor(int a, int b) {
+    while (b != 0) {
+        int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// Zeroth order modified Bessel function of the first kind
+double besselI0(double x) {
+    double sum = 1.0;
+    double term = 1.0;
+    for (int k = 1; k < 50; ++k) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+        if (term < sum * 1e-12) {
+            break;
+        }
+    }
+    return sum;
+}
+
+float dotProductScalar(const float* coefficients, const float* samples) {
+    float sum0 = 0.0f, sum1 = 0.0f, sum2 = 0.0f, sum3 = 0.0f;
+    for (int i = 0; i < PolyphaseResampler::kTapsPerPhase; i += 4) {
+        sum0 += coefficients[i] * samples[i];
+        sum1 += coefficients[i + 1] * samples[i + 1];
+        sum2 += coefficients[i + 2] * samples[i + 2];
+        sum3 += coefficients[i + 3] * samples[i + 3];
+    }
+    return (sum0 + sum1) + (sum2 + sum3);
+}
+
+#ifdef POLYPHASE_X86_KERNELS
+__attribute__((target("sse2"))) float dotProductSse2(const float* coefficients,
+                                                      const float* samples) {
+    __m128 sum0 = _mm_setzero_ps();
+    __m128 sum1 = _mm_setzero_ps();
+    for (int i = 0; i < PolyphaseResampler::kTapsPerPhase; i += 8) {
+        sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(coefficients + i),
+                                           _mm_loadu_ps(samples + i)));
+        sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(coefficients + i + 4),
+                                           _mm_loadu_ps(samples + i + 4)));
+    }
+    __m128 sum = _mm_add_ps(sum0, sum1);
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+    return _mm_cvtss_f32(sum);
+}
+
+__attribute__((target("avx2,fma"))) float dotProductAvx2(const float* coefficients,
+                                                          const float* samples) {
+    __m256 sum0 = _mm256_setzero_ps();
+    __m256 sum1 = _mm256_setzero_ps();
+    for (int i = 0; i < PolyphaseResampler::kTapsPerPhase; i += 16) {
+        sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(coefficients + i), _mm256_loadu_ps(samples + i),
+                               sum0);
+        sum1 = _mm256_fmadd_ps(_mm256_loadu_ps(coefficients + i + 8),
+                               _mm256_loadu_ps(samples + i + 8), sum1);
+    }
+    __m256 sum256 = _mm256_add_ps(sum0, sum1);
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(sum256), _mm256_extractf128_ps(sum256, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+    return _mm_cvtss_f32(sum);
+}
+#endif
+
+}  // namespace
+
+PolyphaseResampler::PolyphaseResampler()
+    : upFactor_(1),
+      downFactor_(1),
+      channels_(0),
+      kernel_(kKernelScalar),
+      dotProduct_(dotProductScalar),
+      buffered_(0),
+      readIndex_(0),
+      phase_(0),
+      inputSamples_(0),
+      outputPosition_(0) {}
+
+bool PolyphaseResampler::supportsRates(int inSampleRate, int outSampleRate) {
+    if (inSampleRate <= 0 || outSampleRate < inSampleRate) {
+        return false;
+    }
+    int divisor = greatestCommonDivisor(inSampleRate, outSampleRate);
+    return outSampleRate / divisor <= kMaxPhases;
+}
+
+PolyphaseResampler::Kernel PolyphaseResampler::detectKernel() {
+#ifdef POLYPHASE_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return kKernelAvx2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return kKernelSse2;
+    }
+#endif
+    return kKernelScalar;
+}
+
+const char* PolyphaseResampler::kernelName(Kernel kernel) {
+    switch (kernel) {
+        case kKernelAvx2:
+            return "avx2";
+        case kKernelSse2:
+            return "sse2";
+        default:
+            return "scalar";
+    }
+}
+
+int PolyphaseResampler::init(int inSampleRate, int outSampleRate, int channels, Kernel kernel) {
+    if (!supportsRates(inSampleRate, outSampleRate) || channels <= 0) {
+        return -1;
+    }
+
+    int divisor = greatestCommonDivisor(inSampleRate, outSampleRate);
+    upFactor_ = outSampleRate / divisor;
+    downFactor_ = inSampleRate / divisor;
+    channels_ = channels;
+
+    // A kernel the build or the CPU lacks falls back to the next slower one
+    Kernel available = detectKernel();
+    kernel_ = std::min(kernel, available);
+    dotProduct_ = dotProductScalar;
+#ifdef POLYPHASE_X86_KERNELS
+    if (kernel_ == kKernelAvx2) {
+        dotProduct_ = dotProductAvx2;
+    } else if (kernel_ == kKernelSse2) {
+        dotProduct_ = dotProductSse2;
+    }
+#endif
+
+    buildCoefficients();
+    history_.assign(channels_, std::vector<float>());
+    reset();
+    return 0;
+}
+
+void PolyphaseResampler::reset() {
+    // Output sample 0 is centred on input sample 0, half a filter of silence goes before it
+    buffered_ = kTapsPerPhase / 2 - 1;
+    for (int ch = 0; ch < channels_; ++ch) {
+        history_[ch].assign(std::max<size_t>(history_[ch].size(), buffered_), 0.0f);
+    }
+    readIndex_ = 0;
+    phase_ = 0;
+    inputSamples_ = 0;
+    outputPosition_ = 0;
+}
+
+// Phase p holds taps p, p + L, p + 2L, ... of the prototype low-pass, stored in reverse so
+// that the dot product runs forward over the input window.
+void PolyphaseResampler::buildCoefficients() {
+    const int length = upFactor_ * kTapsPerPhase;
+    const double centre = length / 2.0;
+    const double i0Beta = besselI0(kKaiserBeta);
+
+    std::vector<double> prototype(length);
+    for (int n = 0; n < length; ++n) {
+        double offset = n - centre;
+        double t = offset / upFactor_;  // in input samples
+        double x = M_PI * kCutoff * t;
+        double sinc = std::fabs(x) < 1e-9 ? 1.0 : std::sin(x) / x;
+        double r = offset / centre;
+        double window = besselI0(kKaiserBeta * std::sqrt(std::max(0.0, 1.0 - r * r))) / i0Beta;
+        prototype[n] = kCutoff * sinc * window;
+    }
+
+    coefficients_.assign(upFactor_ * kTapsPerPhase, 0.0f);
+    for (int p = 0; p < upFactor_; ++p) {
+        // Unity gain at DC for every phase
+        double sum = 0.0;
+        for (int j = 0; j < kTapsPerPhase; ++j) {
+            sum += prototype[p + j * upFactor_];
+        }
+        float* phase = &coefficients_[p * kTapsPerPhase];
+        for (int i = 0; i < kTapsPerPhase; ++i) {
+            phase[i] = static_cast<float>(prototype[p + (kTapsPerPhase - 1 - i) * upFactor_] / sum);
+        }
+    }
+}
+
+int PolyphaseResampler::maxOutputSamples(int inSamples) const {
+    int64_t available = buffered_ - readIndex_ + inSamples;
+    return static_cast<int>(available * upFactor_ / downFactor_) + 1;
+}
+
+void PolyphaseResampler::append(const float* const* input, int inSamples) {
+    for (int ch = 0; ch < channels_; ++ch) {
+        std::vector<float>& history = history_[ch];
+        if (history.size() < static_cast<size_t>(buffered_ + inSamples)) {
+            history.resize(buffered_ + inSamples);
+        }
+        if (input) {
+            std::memcpy(&history[buffered_], input[ch], inSamples * sizeof(float));
+        } else {
+            std::fill(history.begin() + buffered_, history.begin() + buffered_ + inSamples, 0.0f);
+        }
+    }
+    buffered_ += inSamples;
+}
+
+// Channels > 0 fixes the channel count at compile time so the channel loop unrolls, 0 takes
+// it from channels_
+template <int Channels>
+int PolyphaseResampler::produceChannels(float* const* output, int maxOut) {
+    const int channels = Channels > 0 ? Channels : channels_;
+    const float* coefficients = coefficients_.data();
+    int count = 0;
+    while (count < maxOut && readIndex_ + kTapsPerPhase <= buffered_) {
+        const float* phase = coefficients + phase_ * kTapsPerPhase;
+        for (int ch = 0; ch < channels; ++ch) {
+            output[ch][count] = dotProduct_(phase, &history_[ch][readIndex_]);
+        }
+        count++;
+
+        phase_ += downFactor_;
+        readIndex_ += phase_ / upFactor_;
+        phase_ %= upFactor_;
+    }
+    return count;
+}
+
+int PolyphaseResampler::produce(float* const* output, int maxOut) {
+    int count;
+    switch (channels_) {
+        case 1:
+            count = produceChannels<1>(output, maxOut);
+            break;
+        case 2:
+            count = produceChannels<2>(output, maxOut);
+            break;
+        default:
+            count = produceChannels<0>(output, maxOut);
+            break;
+    }
+    outputPosition_ += count;
+
+    // Keep only the samples later windows still need
+    int consumed = std::min(readIndex_, buffered_);
+    if (consumed > 0) {
+        for (int ch = 0; ch < channels_; ++ch) {
+            std::memmove(&history_[ch][0], &history_[ch][consumed],
+                         (buffered_ - consumed) * sizeof(float));
+        }
+        buffered_ -= consumed;
+        readIndex_ -= consumed;
+    }
+    return count;
+}
+
+int PolyphaseResampler::process(const float* const* input, int inSamples, float* const* output,
+                                int maxOut) {
+    if (inSamples > 0) {
+        append(input, inSamples);
+        inputSamples_ += inSamples;
+    }
+    return produce(output, maxOut);
+}
+
+int PolyphaseResampler::flush(float* const* output, int maxOut) {
+    int64_t total = (inputSamples_ * upFactor_ + downFactor_ - 1) / downFactor_;
+    int64_t remaining = total - outputPosition_;
+    if (remaining <= 0) {
+        return 0;
+    }
+
+    // Silence after the end lets the last windows complete
+    append(nullptr, kTapsPerPhase);
+    return produce(output, static_cast<int>(std::min<int64_t>(remaining, maxOut)));
+}
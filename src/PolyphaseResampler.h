@@ -0,0 +1,72 @@
+#ifndef POLYPHASE_RESAMPLER_H
+#define POLYPHASE_RESAMPLER_H
+
+#include <cstdint>
+#include <vector>
+
+// Rational-ratio sample rate converter on planar float samples: a Kaiser-windowed sinc
+// polyphase FIR with one precomputed coefficient table per output phase.
+//
+// For an up/down ratio L/M (44100 -> 48000 is 160/147) output sample k is the dot product of
+// phase (k * M) % L with kTapsPerPhase consecutive input samples, so there is no per-sample
+// interpolation and the inner loop is a straight multiply-add that the SSE2 and AVX2 kernels
+// run 4 or 8 taps at a time. The kernel is picked once at runtime from the CPU features.
+//
+// Output sample k lines up with input time k * M / L; the filter delay is compensated by
+// priming the history with zeros, and flush() pads the tail so that exactly
+// ceil(inputSamples * L / M) samples come out in total.
+class PolyphaseResampler {
+  public:
+    enum Kernel { kKernelScalar, kKernelSse2, kKernelAvx2 };
+
+    static const int kTapsPerPhase = 32;
+
+    PolyphaseResampler();
+
+    // Whether the reduced ratio is small enough for a coefficient table, which holds for the
+    // usual 8000..48000 Hz rates (e.g. 22050, 32000, 44100 -> 48000)
+    static bool supportsRates(int inSampleRate, int outSampleRate);
+    // Fastest kernel this CPU can run
+    static Kernel detectKernel();
+    static const char* kernelName(Kernel kernel);
+
+    int init(int inSampleRate, int outSampleRate, int channels, Kernel kernel = detectKernel());
+    void reset();
+
+    // Upper bound of the samples process() writes for inSamples more input
+    int maxOutputSamples(int inSamples) const;
+    // Converts inSamples samples of every channel and writes up to maxOut samples per channel,
+    // returns the number written. Call with maxOut >= maxOutputSamples(inSamples).
+    int process(const float* const* input, int inSamples, float* const* output, int maxOut);
+    // Writes the remaining output after the last input, returns the number written
+    int flush(float* const* output, int maxOut);
+
+    // Output samples produced since init() or reset()
+    int64_t outputPosition() const { return outputPosition_; }
+    Kernel kernel() const { return kernel_; }
+
+  private:
+    typedef float (*DotProduct)(const float* coefficients, const float* samples);
+
+    int upFactor_;    // L
+    int downFactor_;  // M
+    int channels_;
+    Kernel kernel_;
+    DotProduct dotProduct_;
+    std::vector<float> coefficients_;  // kTapsPerPhase per phase, phase after phase
+
+    std::vector<std::vector<float> > history_;
+    int buffered_;    // samples per channel in history_
+    int readIndex_;   // first input sample of the next output's window
+    int phase_;       // (k * M) % L of the next output
+    int64_t inputSamples_;
+    int64_t outputPosition_;
+
+    void buildCoefficients();
+    void append(const float* const* input, int inSamples);
+    int produce(float* const* output, int maxOut);
+    template <int Channels>
+    int produceChannels(float* const* output, int maxOut);
+};
+
+#endif  // POLYPHASE_RESAMPLER_H
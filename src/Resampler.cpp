@@ -2,18 +2,87 @@
 
 #include <iostream>
 
-Resampler::Resampler() : swrContext_(nullptr), resampledFrame_(nullptr) {}
+#include "Log.h"
+
+Resampler::Resampler()
+    : backend_(kBackendSwr),
+      swrContext_(nullptr),
+      resampledFrame_(nullptr),
+      frameCapacity_(0),
+      bufferPool_(nullptr),
+      poolBufferSize_(0),
+      targetSampleFormat_(AV_SAMPLE_FMT_NONE),
+      inSampleRate_(0),
+      outSampleRate_(0),
+      outChannels_(0),
+      passThrough_(false),
+      frameSize_(0),
+      filledSamples_(0),
+      outputSamples_(0),
+      pendingFrame_(nullptr),
+      draining_(false),
+      usePolyphase_(false),
+      inputToFloat_(nullptr),
+      outputFromFloat_(nullptr),
+      inputConverter_(nullptr),
+      outputConverter_(nullptr) {}
 
 Resampler::~Resampler() { closeResampler(); }
 
-int Resampler::initializeResampler(AVCodecParameters* inputCodecParameters,
-                                   AVSampleFormat targetSampleFormat) {
-    if (!inputCodecParameters) {
+bool Resampler::parseBackend(const std::string& name, Backend& backend) {
+    if (name == "swr") {
+        backend = kBackendSwr;
+    } else if (name == "polyphase") {
+        backend = kBackendPolyphase;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char* Resampler::backendName(Backend backend) {
+    return backend == kBackendPolyphase ? "polyphase" : "swr";
+}
+
+void Resampler::setBackend(Backend backend) { backend_ = backend; }
+
+void Resampler::setFrameSize(int frameSize) { frameSize_ = frameSize > 0 ? frameSize : 0; }
+
+int Resampler::initializeResampler(const AVCodecContext* decoderContext, const OutputSpec& spec) {
+    if (!decoderContext) {
         return -1;
     }
 
-    // Save target sample format
-    this->targetSampleFormat_ = targetSampleFormat;
+    // Save target format
+    targetSampleFormat_ = spec.sampleFormat;
+    inSampleRate_ = decoderContext->sample_rate;
+    outSampleRate_ = spec.sampleRate;
+    outChannels_ = spec.channels;
+
+    // Nothing to convert, hand the decoded frames on by reference
+    AVChannelLayout outLayout;
+    av_channel_layout_default(&outLayout, outChannels_);
+    passThrough_ = decoderContext->sample_fmt == targetSampleFormat_ &&
+                   decoderContext->sample_rate == outSampleRate_ &&
+                   av_channel_layout_compare(&decoderContext->ch_layout, &outLayout) == 0;
+    filledSamples_ = 0;
+    outputSamples_ = 0;
+    pendingFrame_ = nullptr;
+    draining_ = false;
+    if (passThrough_) {
+        return 0;
+    }
+
+    if (backend_ == kBackendPolyphase) {
+        if (PolyphaseResampler::supportsRates(inSampleRate_, outSampleRate_)) {
+            return initializePolyphase(decoderContext);
+        }
+        std::cerr << "Polyphase resampler does not support " << inSampleRate_ << " -> "
+                  << outSampleRate_ << " Hz, using swr" << std::endl;
+    }
+
+    // Passed with no samples to take what swr still holds without draining it
+    noInput_.assign(FFMAX(decoderContext->ch_layout.nb_channels, 1), nullptr);
 
     // Allocate resample context
     swrContext_ = swr_alloc();
@@ -22,18 +91,17 @@ int Resampler::initializeResampler(AVCodecParameters* inputCodecParameters,
         return -1;
     }
 
-    // Set options for resampling to 48000 Hz, stereo
-    av_opt_set_chlayout(swrContext_, "in_chlayout", &inputCodecParameters->ch_layout, 0);
-    av_opt_set_int(swrContext_, "in_sample_rate", inputCodecParameters->sample_rate, 0);
-    av_opt_set_sample_fmt(swrContext_, "in_sample_fmt",
-                          (AVSampleFormat)inputCodecParameters->format, 0);
+    // Set options for resampling to the output rate and channel count
+    av_opt_set_chlayout(swrContext_, "in_chlayout", &decoderContext->ch_layout, 0);
+    av_opt_set_int(swrContext_, "in_sample_rate", decoderContext->sample_rate, 0);
+    av_opt_set_sample_fmt(swrContext_, "in_sample_fmt", decoderContext->sample_fmt, 0);
 
     AVChannelLayout outChLayout;
-    av_channel_layout_default(&outChLayout, 2);
+    av_channel_layout_default(&outChLayout, outChannels_);
     av_opt_set_chlayout(swrContext_, "out_chlayout", &outChLayout, 0);
-    av_opt_set_int(swrContext_, "out_sample_rate", 48000, 0);
+    av_opt_set_int(swrContext_, "out_sample_rate", outSampleRate_, 0);
     // Use appropriate sample format based on codec requirements
-    av_opt_set_sample_fmt(swrContext_, "out_sample_fmt", targetSampleFormat, 0);
+    av_opt_set_sample_fmt(swrContext_, "out_sample_fmt", targetSampleFormat_, 0);
 
     // Initialize resample context
     if (swr_init(swrContext_) < 0) {
@@ -48,15 +116,8 @@ int Resampler::initializeResampler(AVCodecParameters* inputCodecParameters,
         return -1;
     }
 
-    resampledFrame_->sample_rate = 48000;
-    resampledFrame_->nb_samples = 1024;  // Default value, will be adjusted as needed
-    resampledFrame_->format = targetSampleFormat_;
-
-    AVChannelLayout chLayout;
-    av_channel_layout_default(&chLayout, 2);
-    resampledFrame_->ch_layout = chLayout;
-
-    if (av_frame_get_buffer(resampledFrame_, 0) < 0) {
+    // Default size, grown as needed
+    if (allocateOutputFrame(1024) < 0) {
         std::cerr << "Could not allocate resampled frame samples" << std::endl;
         return -1;
     }
@@ -64,71 +125,311 @@ int Resampler::initializeResampler(AVCodecParameters* inputCodecParameters,
     return 0;
 }
 
-AVFrame* Resampler::resampleFrame(AVFrame* inputFrame) {
-    if (!swrContext_ || !inputFrame) {
+// Allocates a same-rate SwrContext that only converts sample format and channel layout
+static SwrContext* allocateConverter(const AVChannelLayout* inLayout, AVSampleFormat inFormat,
+                                     const AVChannelLayout* outLayout, AVSampleFormat outFormat,
+                                     int sampleRate) {
+    SwrContext* converter = nullptr;
+    if (swr_alloc_set_opts2(&converter, outLayout, outFormat, sampleRate, inLayout, inFormat,
+                            sampleRate, 0, nullptr) < 0 ||
+        swr_init(converter) < 0) {
+        swr_free(&converter);
         return nullptr;
     }
+    return converter;
+}
 
-    // Calculate destination samples
-    int dst_nb_samples =
-        av_rescale_rnd(swr_get_delay(swrContext_, inputFrame->sample_rate) + inputFrame->nb_samples,
-                       48000, inputFrame->sample_rate, AV_ROUND_UP);
+// Makes every plane hold at least nbSamples floats and returns the plane pointers
+static float* const* growPlanes(std::vector<std::vector<float> >& planes,
+                                std::vector<float*>& pointers, int channels, int nbSamples) {
+    planes.resize(channels);
+    pointers.resize(channels);
+    for (int ch = 0; ch < channels; ++ch) {
+        if (planes[ch].size() < static_cast<size_t>(nbSamples)) {
+            planes[ch].resize(nbSamples);
+        }
+        pointers[ch] = planes[ch].data();
+    }
+    return pointers.data();
+}
 
-    if (dst_nb_samples > resampledFrame_->nb_samples) {
-        av_frame_free(&resampledFrame_);
-        resampledFrame_ = av_frame_alloc();
-        resampledFrame_->sample_rate = 48000;
-        resampledFrame_->nb_samples = dst_nb_samples;
-        resampledFrame_->format = this->targetSampleFormat_;
+int Resampler::initializePolyphase(const AVCodecContext* decoderContext) {
+    if (polyphase_.init(inSampleRate_, outSampleRate_, outChannels_) < 0) {
+        std::cerr << "Failed to initialize polyphase resampler" << std::endl;
+        return -1;
+    }
 
-        AVChannelLayout chLayout;
-        av_channel_layout_default(&chLayout, 2);
-        resampledFrame_->ch_layout = chLayout;
+    AVChannelLayout outLayout;
+    av_channel_layout_default(&outLayout, outChannels_);
+    bool sameLayout = av_channel_layout_compare(&decoderContext->ch_layout, &outLayout) == 0;
+    if (sameLayout && decoderContext->sample_fmt != AV_SAMPLE_FMT_FLTP) {
+        inputToFloat_ = toFloatConverter(decoderContext->sample_fmt, outChannels_);
+    }
+    if ((!sameLayout || decoderContext->sample_fmt != AV_SAMPLE_FMT_FLTP) && !inputToFloat_) {
+        inputConverter_ = allocateConverter(&decoderContext->ch_layout, decoderContext->sample_fmt,
+                                            &outLayout, AV_SAMPLE_FMT_FLTP, inSampleRate_);
+        if (!inputConverter_) {
+            std::cerr << "Failed to initialize input conversion" << std::endl;
+            return -1;
+        }
+    }
+    if (targetSampleFormat_ != AV_SAMPLE_FMT_FLTP) {
+        outputFromFloat_ = fromFloatConverter(targetSampleFormat_, outChannels_);
+    }
+    if (targetSampleFormat_ != AV_SAMPLE_FMT_FLTP && !outputFromFloat_) {
+        outputConverter_ = allocateConverter(&outLayout, AV_SAMPLE_FMT_FLTP, &outLayout,
+                                             targetSampleFormat_, outSampleRate_);
+        if (!outputConverter_) {
+            std::cerr << "Failed to initialize output conversion" << std::endl;
+            return -1;
+        }
+    }
 
-        if (av_frame_get_buffer(resampledFrame_, 0) < 0) {
+    resampledFrame_ = av_frame_alloc();
+    if (!resampledFrame_ || allocateOutputFrame(1024) < 0) {
+        std::cerr << "Could not allocate resampled frame" << std::endl;
+        return -1;
+    }
+
+    usePolyphase_ = true;
+    std::cout << "Resampling " << inSampleRate_ << " -> " << outSampleRate_
+              << " Hz with the polyphase resampler ("
+              << PolyphaseResampler::kernelName(polyphase_.kernel()) << ")" << std::endl;
+    return 0;
+}
+
+// Makes resampledFrame_ writable with room for nbSamples samples
+int Resampler::prepareOutputFrame(int nbSamples) {
+    // A consumer may still hold a reference to the previous output, never write into it
+    if (nbSamples > frameCapacity_ || !av_frame_is_writable(resampledFrame_)) {
+        if (allocateOutputFrame(FFMAX(nbSamples, frameCapacity_)) < 0) {
             std::cerr << "Could not allocate resampled frame samples" << std::endl;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Gives resampledFrame_ new sample buffers for nbSamples samples. The buffers come from a pool,
+// so once consumers have released their references to earlier output nothing is allocated.
+int Resampler::allocateOutputFrame(int nbSamples) {
+    int linesize = 0;
+    if (av_samples_get_buffer_size(&linesize, outChannels_, nbSamples, targetSampleFormat_, 0) <
+        0) {
+        return -1;
+    }
+    int planes = av_sample_fmt_is_planar(targetSampleFormat_) ? outChannels_ : 1;
+
+    av_frame_unref(resampledFrame_);
+    resampledFrame_->sample_rate = outSampleRate_;
+    resampledFrame_->nb_samples = nbSamples;
+    resampledFrame_->format = targetSampleFormat_;
+    av_channel_layout_default(&resampledFrame_->ch_layout, outChannels_);
+
+    if (planes > AV_NUM_DATA_POINTERS) {
+        // Too many planes for frame->buf, let FFmpeg set up extended_buf
+        if (av_frame_get_buffer(resampledFrame_, 0) < 0) {
+            return -1;
+        }
+        frameCapacity_ = nbSamples;
+        return 0;
+    }
+
+    if (!bufferPool_ || linesize > poolBufferSize_) {
+        // Buffers still in use keep the old pool alive until they are released
+        av_buffer_pool_uninit(&bufferPool_);
+        bufferPool_ = av_buffer_pool_init(linesize, nullptr);
+        if (!bufferPool_) {
+            return -1;
+        }
+        poolBufferSize_ = linesize;
+    }
+
+    for (int i = 0; i < planes; ++i) {
+        resampledFrame_->buf[i] = av_buffer_pool_get(bufferPool_);
+        if (!resampledFrame_->buf[i]) {
+            av_frame_unref(resampledFrame_);
+            return -1;
+        }
+        resampledFrame_->data[i] = resampledFrame_->buf[i]->data;
+    }
+    resampledFrame_->extended_data = resampledFrame_->data;
+    resampledFrame_->linesize[0] = linesize;
+
+    frameCapacity_ = nbSamples;
+    return 0;
+}
+
+int Resampler::sendFrame(AVFrame* inputFrame) {
+    if (draining_) {
+        std::cerr << "Resampler already drained" << std::endl;
+        return -1;
+    }
+    if (!inputFrame) {
+        draining_ = true;
+        return 0;
+    }
+    pendingFrame_ = inputFrame;
+    return 0;
+}
+
+AVFrame* Resampler::receiveFrame() {
+    if (passThrough_) {
+        AVFrame* inputFrame = pendingFrame_;
+        pendingFrame_ = nullptr;
+        if (!inputFrame) {
+            return nullptr;
+        }
+        if (inputFrame->format != targetSampleFormat_ ||
+            inputFrame->sample_rate != outSampleRate_ ||
+            inputFrame->ch_layout.nb_channels != outChannels_) {
+            static LogLimiter formatErrors;
+            LogLine(kLogError, &formatErrors)
+                << "Decoded format changed, cannot pass frame through";
             return nullptr;
         }
+        inputFrame->pts = outputSamples_;
+        outputSamples_ += inputFrame->nb_samples;
+        return inputFrame;
+    }
+
+    if (!resampledFrame_) {
+        return nullptr;
     }
 
-    // Perform resampling
-    int ret = swr_convert(swrContext_, resampledFrame_->data, dst_nb_samples,
-                          (const uint8_t**)inputFrame->data, inputFrame->nb_samples);
+    // Fill the rest of the current frame, or take everything the input converts to
+    int inSamples = pendingFrame_ ? pendingFrame_->nb_samples : 0;
+    int wanted;
+    if (frameSize_ > 0) {
+        wanted = frameSize_ - filledSamples_;
+    } else if (usePolyphase_) {
+        wanted = polyphase_.maxOutputSamples(pendingFrame_ ? inSamples
+                                                           : PolyphaseResampler::kTapsPerPhase);
+    } else {
+        wanted = swr_get_out_samples(swrContext_, inSamples);
+    }
+    if (wanted <= 0) {
+        pendingFrame_ = nullptr;
+        return nullptr;
+    }
+    if (filledSamples_ == 0 && prepareOutputFrame(wanted) < 0) {
+        return nullptr;
+    }
 
+    int ret = usePolyphase_ ? convertPolyphase(filledSamples_, wanted)
+                            : convertSwr(filledSamples_, wanted);
     if (ret < 0) {
-        std::cerr << "Error while converting" << std::endl;
+        static LogLimiter convertErrors;
+        LogLine(kLogError, &convertErrors) << "Error while converting";
         return nullptr;
     }
+    filledSamples_ += ret;
 
-    resampledFrame_->nb_samples = ret;
-    resampledFrame_->pts = av_rescale_q(swr_next_pts(swrContext_, INT64_MIN),
-                                        (AVRational){1, 48000}, (AVRational){1, 48000});
+    // A partial frame waits for more input, unless the input has ended
+    if (filledSamples_ == 0 || (frameSize_ > 0 && filledSamples_ < frameSize_ && !draining_)) {
+        return nullptr;
+    }
 
+    resampledFrame_->nb_samples = filledSamples_;
+    resampledFrame_->pts = outputSamples_;
+    outputSamples_ += filledSamples_;
+    filledSamples_ = 0;
     return resampledFrame_;
 }
 
-AVFrame* Resampler::flushResampler() {
-    if (!swrContext_) {
-        return nullptr;
+// Plane pointers into resampledFrame_ at sample offset
+uint8_t* const* Resampler::outputAt(int offset) {
+    bool planar = av_sample_fmt_is_planar(targetSampleFormat_);
+    int planes = planar ? outChannels_ : 1;
+    int step = av_get_bytes_per_sample(targetSampleFormat_) * (planar ? 1 : outChannels_);
+    outputOffsets_.resize(planes);
+    for (int i = 0; i < planes; ++i) {
+        outputOffsets_[i] = resampledFrame_->extended_data[i] + offset * step;
+    }
+    return outputOffsets_.data();
+}
+
+// Converts the pending input into resampledFrame_ from offset on, at most maxSamples samples.
+// swr buffers the input that does not fit and hands it out on the next call.
+int Resampler::convertSwr(int offset, int maxSamples) {
+    const uint8_t* const* input = draining_ ? nullptr : noInput_.data();
+    int inSamples = 0;
+    if (pendingFrame_) {
+        input = pendingFrame_->extended_data;
+        inSamples = pendingFrame_->nb_samples;
+        pendingFrame_ = nullptr;
     }
+    return swr_convert(swrContext_, outputAt(offset), maxSamples, input, inSamples);
+}
 
-    // Flush the resampler
-    int ret =
-        swr_convert(swrContext_, resampledFrame_->data, resampledFrame_->nb_samples, nullptr, 0);
-    if (ret <= 0) {
-        return nullptr;
+// Same for the polyphase backend, which keeps unconverted input in its history
+int Resampler::convertPolyphase(int offset, int maxSamples) {
+    AVFrame* inputFrame = pendingFrame_;
+    pendingFrame_ = nullptr;
+
+    const float* const* input = nullptr;
+    int inSamples = 0;
+    if (inputFrame && inputToFloat_) {
+        inSamples = inputFrame->nb_samples;
+        float* const* planes = growPlanes(inputPlanes_, inputPointers_, outChannels_, inSamples);
+        inputToFloat_(inputFrame->extended_data, planes, outChannels_, inSamples);
+        input = planes;
+    } else if (inputFrame && inputConverter_) {
+        float* const* planes =
+            growPlanes(inputPlanes_, inputPointers_, outChannels_, inputFrame->nb_samples);
+        inSamples = swr_convert(inputConverter_, reinterpret_cast<uint8_t* const*>(planes),
+                                inputFrame->nb_samples, inputFrame->extended_data,
+                                inputFrame->nb_samples);
+        if (inSamples < 0) {
+            return inSamples;
+        }
+        input = planes;
+    } else if (inputFrame) {
+        input = reinterpret_cast<const float* const*>(inputFrame->extended_data);
+        inSamples = inputFrame->nb_samples;
     }
 
-    resampledFrame_->nb_samples = ret;
-    return resampledFrame_;
+    // Planar float output goes straight into the frame, anything else is converted after
+    bool convertOutput = outputFromFloat_ || outputConverter_;
+    float* const* output =
+        convertOutput ? growPlanes(outputPlanes_, outputPointers_, outChannels_, maxSamples)
+                      : reinterpret_cast<float* const*>(outputAt(offset));
+    int produced = (!inputFrame && draining_)
+                       ? polyphase_.flush(output, maxSamples)
+                       : polyphase_.process(input, inSamples, output, maxSamples);
+    if (outputFromFloat_ && produced > 0) {
+        outputFromFloat_(output, outputAt(offset), outChannels_, produced);
+    } else if (outputConverter_ && produced > 0) {
+        int ret = swr_convert(outputConverter_, outputAt(offset), produced,
+                              reinterpret_cast<const uint8_t* const*>(output), produced);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+    return produced;
 }
 
 void Resampler::closeResampler() {
     if (swrContext_) {
         swr_free(&swrContext_);
     }
+    swr_free(&inputConverter_);
+    swr_free(&outputConverter_);
+    inputToFloat_ = nullptr;
+    outputFromFloat_ = nullptr;
+    usePolyphase_ = false;
+    pendingFrame_ = nullptr;
+    filledSamples_ = 0;
 
     if (resampledFrame_) {
         av_frame_free(&resampledFrame_);
     }
-}
\ No newline at end of file
+    av_buffer_pool_uninit(&bufferPool_);
+    frameCapacity_ = 0;
+    poolBufferSize_ = 0;
+    passThrough_ = false;
+}
+
+bool Resampler::isPassThrough() const { return passThrough_; }
+
+bool Resampler::isPolyphase() const { return usePolyphase_; }
\ No newline at end of file
@@ -1,12 +1,16 @@
 #ifndef RESAMPLER_H
 #define RESAMPLER_H
 
+#include <string>
+#include <vector>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 #include <libavcodec/avcodec.h>
 #include <libavcodec/packet.h>
 #include <libavformat/avformat.h>
+#include <libavutil/buffer.h>
 #include <libavutil/channel_layout.h>
 #include <libavutil/common.h>
 #include <libavutil/error.h>
@@ -19,21 +23,96 @@ extern "C" {
 }
 #endif
 
+#include "OutputSpec.h"
+#include "PolyphaseResampler.h"
+#include "SampleConvert.h"
+
+// Converts decoded frames to the encoder's sample format, rate and channel count, with the
+// same send/receive pattern as the FFmpeg codecs: sendFrame() one decoded frame (nullptr at
+// the end of input), then receiveFrame() until it returns nullptr.
+//
+// With setFrameSize() every returned frame holds exactly that many samples, except the last
+// one after the end of input, so an encoder with a fixed frame size can take them as they
+// are. The converter writes straight into those frames and keeps the remainder buffered
+// inside the SwrContext (or the polyphase history) until the next call, so every output
+// sample is written once. Without a frame size each input frame gives one frame of whatever
+// length it converts to.
+//
+// Returned frames belong to the resampler and stay valid until the next call. If the
+// decoder output already has the target format the resampler is a pass-through:
+// receiveFrame() returns the sent frame itself with only its pts set, and no SwrContext is
+// created.
+//
+// The rate conversion runs in libswresample, or with kBackendPolyphase in PolyphaseResampler
+// for the upsampling ratios it supports (other ratios still use swr). The polyphase backend
+// works on planar float. Sample format conversion into and out of it runs in the templated
+// loops of SampleConvert.h when the channel layout already matches; swr only steps in for a
+// layout change or a format those loops do not cover.
 class Resampler {
   public:
+    enum Backend { kBackendSwr, kBackendPolyphase };
+
     Resampler();
     ~Resampler();
 
-    int initializeResampler(AVCodecParameters* inputCodecParameters,
-                            AVSampleFormat targetSampleFormat = AV_SAMPLE_FMT_FLTP);
-    AVFrame* resampleFrame(AVFrame* inputFrame);
-    AVFrame* flushResampler();
+    // "swr" or "polyphase"
+    static bool parseBackend(const std::string& name, Backend& backend);
+    static const char* backendName(Backend backend);
+    // Takes effect at the next initializeResampler()
+    void setBackend(Backend backend);
+    // Samples per returned frame, usually the encoder's frame_size; 0 (the default) keeps the
+    // converted length of each input frame
+    void setFrameSize(int frameSize);
+
+    // Converts from what decoderContext produces to the rate, channels and sample format of spec
+    int initializeResampler(const AVCodecContext* decoderContext, const OutputSpec& spec);
+    // inputFrame must stay valid until receiveFrame() returns nullptr; nullptr drains
+    int sendFrame(AVFrame* inputFrame);
+    // pts of the returned frame counts output samples from the start of the stream
+    AVFrame* receiveFrame();
     void closeResampler();
+    bool isPassThrough() const;
+    bool isPolyphase() const;
 
   private:
+    Backend backend_;
     SwrContext* swrContext_;
     AVFrame* resampledFrame_;
+    int frameCapacity_;  // samples the buffers of resampledFrame_ can hold
+    AVBufferPool* bufferPool_;
+    int poolBufferSize_;
     AVSampleFormat targetSampleFormat_;
+    int inSampleRate_;
+    int outSampleRate_;
+    int outChannels_;
+    bool passThrough_;
+
+    int frameSize_;
+    int filledSamples_;      // samples already in resampledFrame_
+    int64_t outputSamples_;  // samples returned so far
+    AVFrame* pendingFrame_;  // sent and not yet handed to the converter
+    bool draining_;
+    std::vector<const uint8_t*> noInput_;
+    std::vector<uint8_t*> outputOffsets_;
+
+    // Polyphase backend, with format/layout conversion into and out of planar float when needed
+    bool usePolyphase_;
+    PolyphaseResampler polyphase_;
+    ToFloatFunction inputToFloat_;
+    FromFloatFunction outputFromFloat_;
+    SwrContext* inputConverter_;
+    SwrContext* outputConverter_;
+    std::vector<std::vector<float> > inputPlanes_;
+    std::vector<float*> inputPointers_;
+    std::vector<std::vector<float> > outputPlanes_;
+    std::vector<float*> outputPointers_;
+
+    int allocateOutputFrame(int nbSamples);
+    int initializePolyphase(const AVCodecContext* decoderContext);
+    int prepareOutputFrame(int nbSamples);
+    uint8_t* const* outputAt(int offset);
+    int convertSwr(int offset, int maxSamples);
+    int convertPolyphase(int offset, int maxSamples);
 };
 
-#endif  // RESAMPLER_H
\ No newline at end of file
+#endif  // RESAMPLER_H
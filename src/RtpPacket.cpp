@@ -0,0 +1,124 @@
+#include "RtpPacket.h"
+
+#include <random>
+
+extern "C" {
+#include <libavutil/mathematics.h>
+}
+
+uint8_t rtpPayloadType(AVCodecID codecId) {
+    if (codecId == AV_CODEC_ID_MP3 || codecId == AV_CODEC_ID_MP2) {
+        return kRtpPayloadTypeMpa;
+    }
+    return kRtpPayloadTypeDynamic;
+}
+
+int writeRtpHeader(const RtpHeader& header, uint8_t* out) {
+    out[0] = 0x80;  // version 2, no padding, no extension, no CSRC
+    out[1] = (header.marker ? 0x80 : 0x00) | (header.payloadType & 0x7f);
+    out[2] = header.sequence >> 8;
+    out[3] = header.sequence & 0xff;
+    out[4] = header.timestamp >> 24;
+    out[5] = (header.timestamp >> 16) & 0xff;
+    out[6] = (header.timestamp >> 8) & 0xff;
+    out[7] = header.timestamp & 0xff;
+    out[8] = header.ssrc >> 24;
+    out[9] = (header.ssrc >> 16) & 0xff;
+    out[10] = (header.ssrc >> 8) & 0xff;
+    out[11] = header.ssrc & 0xff;
+    if (header.payloadType != kRtpPayloadTypeMpa) {
+        return kRtpHeaderSize;
+    }
+
+    // RFC 2250 MPEG audio header: 16 bits MBZ, 16 bits fragment offset
+    out[12] = 0;
+    out[13] = 0;
+    out[14] = 0;
+    out[15] = 0;
+    return kRtpHeaderSize + kRtpMpaHeaderSize;
+}
+
+int parseRtpHeader(const uint8_t* data, size_t length, RtpHeader& header) {
+    if (length < static_cast<size_t>(kRtpHeaderSize) || (data[0] >> 6) != 2) {
+        return -1;
+    }
+
+    header.marker = (data[1] & 0x80) != 0;
+    header.payloadType = data[1] & 0x7f;
+    header.sequence = static_cast<uint16_t>((data[2] << 8) | data[3]);
+    header.timestamp = (static_cast<uint32_t>(data[4]) << 24) | (data[5] << 16) |
+                       (data[6] << 8) | data[7];
+    header.ssrc = (static_cast<uint32_t>(data[8]) << 24) | (data[9] << 16) | (data[10] << 8) |
+                  data[11];
+
+    size_t offset = kRtpHeaderSize + (data[0] & 0x0f) * 4;  // CSRC list
+    if (data[0] & 0x10) {
+        // Header extension: 16 bits profile data, 16 bits length in 32-bit words
+        if (length < offset + 4) {
+            return -1;
+        }
+        offset += 4 + ((data[offset + 2] << 8) | data[offset + 3]) * 4;
+    }
+    if (header.payloadType == kRtpPayloadTypeMpa) {
+        offset += kRtpMpaHeaderSize;
+    }
+    if (data[0] & 0x20) {
+        // Padding, the last byte holds its length
+        size_t padding = data[length - 1];
+        if (padding > length) {
+            return -1;
+        }
+        length -= padding;
+    }
+    if (offset > length) {
+        return -1;
+    }
+    return static_cast<int>(offset);
+}
+
+RtpPacketizer::RtpPacketizer()
+    : payloadType_(kRtpPayloadTypeMpa),
+      timeBase_{1, kRtpClockRate},
+      ssrc_(0),
+      sequence_(0),
+      timestampOffset_(0),
+      nextTimestamp_(0),
+      first_(true) {}
+
+void RtpPacketizer::init(AVCodecID codecId, AVRational timeBase) {
+    std::random_device device;
+    std::mt19937 random(device());
+    payloadType_ = rtpPayloadType(codecId);
+    timeBase_ = timeBase;
+    ssrc_ = random();
+    sequence_ = static_cast<uint16_t>(random());
+    timestampOffset_ = random();
+    nextTimestamp_ = 0;
+    first_ = true;
+}
+
+int RtpPacketizer::writeHeader(const AVPacket* packet, uint8_t* out) {
+    int64_t timestamp = advanceTimestamp(packet);
+
+    RtpHeader header;
+    header.marker = first_;  // start of the stream
+    header.payloadType = payloadType_;
+    header.sequence = sequence_++;
+    header.timestamp = static_cast<uint32_t>(timestamp) + timestampOffset_;
+    header.ssrc = ssrc_;
+    first_ = false;
+    return writeRtpHeader(header, out);
+}
+
+void RtpPacketizer::continueDatagram(const AVPacket* packet) { advanceTimestamp(packet); }
+
+// Timestamp of the packet on the RTP clock, without the offset
+int64_t RtpPacketizer::advanceTimestamp(const AVPacket* packet) {
+    const AVRational clock = {1, kRtpClockRate};
+    int64_t timestamp = nextTimestamp_;
+    if (packet->pts != AV_NOPTS_VALUE) {
+        timestamp = av_rescale_q(packet->pts, timeBase_, clock);
+    }
+    nextTimestamp_ = timestamp + av_rescale_q(packet->duration, timeBase_, clock);
+    return timestamp;
+}
@@ -0,0 +1,77 @@
+#ifndef RTP_PACKET_H
+#define RTP_PACKET_H
+
+#include <cstddef>
+#include <cstdint>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <libavcodec/avcodec.h>
+#ifdef __cplusplus
+}
+#endif
+
+// RTP (RFC 3550) framing of encoded packets, one packet per datagram. MPEG audio (MP2/MP3)
+// uses the RFC 2250 payload format: static payload type 14 and a 4-byte header (zero, and
+// the fragment offset, always 0 here because frames are not split) before the frame. Other
+// codecs use the dynamic payload type 96 with the packet as the whole payload. Timestamps
+// run at 90 kHz for every codec.
+struct RtpHeader {
+    bool marker;
+    uint8_t payloadType;
+    uint16_t sequence;
+    uint32_t timestamp;
+    uint32_t ssrc;
+};
+
+static const int kRtpHeaderSize = 12;
+static const int kRtpMpaHeaderSize = 4;
+static const int kRtpMaxHeaderSize = kRtpHeaderSize + kRtpMpaHeaderSize;
+static const int kRtpClockRate = 90000;
+static const uint8_t kRtpPayloadTypeMpa = 14;
+static const uint8_t kRtpPayloadTypeDynamic = 96;
+
+// Payload type a stream of codecId is sent with
+uint8_t rtpPayloadType(AVCodecID codecId);
+
+// Writes the RTP header, and the RFC 2250 header for payload type 14, to out, which must
+// hold kRtpMaxHeaderSize bytes. Returns the number of bytes written.
+int writeRtpHeader(const RtpHeader& header, uint8_t* out);
+
+// Parses the headers at the start of a datagram. Returns the offset of the payload, or -1
+// if the datagram is not RTP version 2 or too short.
+int parseRtpHeader(const uint8_t* data, size_t length, RtpHeader& header);
+
+// Sender side state of one RTP stream: a random SSRC, and sequence number and timestamp
+// starting at random values as RFC 3550 recommends
+class RtpPacketizer {
+  public:
+    RtpPacketizer();
+
+    // timeBase is the time base of the packet timestamps
+    void init(AVCodecID codecId, AVRational timeBase);
+
+    // Writes the headers for the next packet to out (kRtpMaxHeaderSize bytes), returns
+    // their size. The timestamp is taken from the packet pts, or continues from the
+    // previous packet's duration when the packet has no pts.
+    int writeHeader(const AVPacket* packet, uint8_t* out);
+    // Accounts for a packet sent in the same datagram as the previous one, which has no
+    // header of its own: advances the timestamp but not the sequence number
+    void continueDatagram(const AVPacket* packet);
+
+    uint32_t ssrc() const { return ssrc_; }
+
+  private:
+    uint8_t payloadType_;
+    AVRational timeBase_;
+    uint32_t ssrc_;
+    uint16_t sequence_;
+    uint32_t timestampOffset_;
+    int64_t nextTimestamp_;  // 90 kHz, without the offset
+    bool first_;
+
+    int64_t advanceTimestamp(const AVPacket* packet);
+};
+
+#endif  // RTP_PACKET_H
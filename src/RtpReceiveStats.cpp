@@ -0,0 +1,120 @@
+#include "RtpReceiveStats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+
+RtpReceiveStats::RtpReceiveStats() : seen_(kDuplicateWindow / 64) { reset(); }
+
+void RtpReceiveStats::reset() {
+    started_ = false;
+    ssrc_ = 0;
+    firstSequence_ = 0;
+    highestSequence_ = 0;
+    std::fill(seen_.begin(), seen_.end(), 0);
+    received_ = 0;
+    reordered_ = 0;
+    duplicates_ = 0;
+    jitter_ = 0.0;
+    lastTimestamp_ = 0;
+    lastArrival_ = 0.0;
+}
+
+int64_t RtpReceiveStats::extendSequence(uint16_t sequence) const {
+    if (!started_) {
+        return sequence;
+    }
+    int16_t delta = static_cast<int16_t>(sequence - static_cast<uint16_t>(highestSequence_));
+    return highestSequence_ + delta;
+}
+
+RtpReceiveStats::Arrival RtpReceiveStats::update(const RtpHeader& header, double arrivalSeconds) {
+    int64_t sequence = extendSequence(header.sequence);
+    if (!started_) {
+        started_ = true;
+        ssrc_ = header.ssrc;
+        // Start well above zero so that a reordered first packet still extends upwards
+        sequence += 1 << 16;
+        firstSequence_ = sequence;
+        highestSequence_ = sequence;
+        testAndSet(sequence);
+        received_ = 1;
+        lastTimestamp_ = header.timestamp;
+        lastArrival_ = arrivalSeconds;
+        return kArrivalInOrder;
+    }
+
+    if (sequence <= highestSequence_ - kDuplicateWindow) {
+        // Older than the window, cannot tell a duplicate from a very late packet
+        received_++;
+        reordered_++;
+        return kArrivalReordered;
+    }
+    if (sequence > highestSequence_) {
+        advanceWindow(sequence);
+    }
+    if (testAndSet(sequence)) {
+        duplicates_++;
+        return kArrivalDuplicate;
+    }
+    received_++;
+    if (sequence < firstSequence_) {
+        firstSequence_ = sequence;
+    }
+
+    // D(i, j) of RFC 3550 6.4.1, arrival spacing minus timestamp spacing
+    double transitDelta = (arrivalSeconds - lastArrival_) * kRtpClockRate -
+                          static_cast<int32_t>(header.timestamp - lastTimestamp_);
+    jitter_ += (std::fabs(transitDelta) - jitter_) / 16.0;
+    lastTimestamp_ = header.timestamp;
+    lastArrival_ = arrivalSeconds;
+
+    if (sequence < highestSequence_) {
+        reordered_++;
+        return kArrivalReordered;
+    }
+    return kArrivalInOrder;
+}
+
+uint64_t RtpReceiveStats::expected() const {
+    return started_ ? static_cast<uint64_t>(highestSequence_ - firstSequence_ + 1) : 0;
+}
+
+int64_t RtpReceiveStats::lost() const {
+    return static_cast<int64_t>(expected()) - static_cast<int64_t>(received_);
+}
+
+std::string RtpReceiveStats::toString() const {
+    std::ostringstream stream;
+    uint64_t expectedPackets = expected();
+    double lossPercent = expectedPackets ? 100.0 * lost() / expectedPackets : 0.0;
+    stream << "ssrc " << std::hex << std::setw(8) << std::setfill('0') << ssrc_ << std::dec
+           << ": " << received_ << " of " << expectedPackets << " packets, " << lost()
+           << " lost (" << std::fixed << std::setprecision(2) << lossPercent << "%), "
+           << reordered_ << " reordered, " << duplicates_ << " duplicates, jitter "
+           << std::setprecision(1) << jitterSeconds() * 1000.0 << " ms";
+    return stream.str();
+}
+
+// Returns whether the bit of sequence was already set
+bool RtpReceiveStats::testAndSet(int64_t sequence) {
+    uint64_t index = static_cast<uint64_t>(sequence) % kDuplicateWindow;
+    uint64_t mask = uint64_t(1) << (index % 64);
+    bool wasSet = (seen_[index / 64] & mask) != 0;
+    seen_[index / 64] |= mask;
+    return wasSet;
+}
+
+// Clears the bits the window slides over
+void RtpReceiveStats::advanceWindow(int64_t highestSequence) {
+    if (highestSequence - highestSequence_ >= kDuplicateWindow) {
+        std::fill(seen_.begin(), seen_.end(), 0);
+    } else {
+        for (int64_t sequence = highestSequence_ + 1; sequence <= highestSequence; ++sequence) {
+            uint64_t index = static_cast<uint64_t>(sequence) % kDuplicateWindow;
+            seen_[index / 64] &= ~(uint64_t(1) << (index % 64));
+        }
+    }
+    highestSequence_ = highestSequence;
+}
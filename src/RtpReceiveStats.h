@@ -0,0 +1,59 @@
+#ifndef RTP_RECEIVE_STATS_H
+#define RTP_RECEIVE_STATS_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "RtpPacket.h"
+
+// Receive statistics of one RTP stream, computed as in RFC 3550 appendix A: 16-bit
+// sequence numbers are extended to 64 bits, loss is expected minus received, and the
+// interarrival jitter is the smoothed difference between arrival spacing and timestamp
+// spacing. Duplicates are recognised within the last kDuplicateWindow sequence numbers.
+class RtpReceiveStats {
+  public:
+    enum Arrival { kArrivalInOrder, kArrivalReordered, kArrivalDuplicate };
+
+    static const int kDuplicateWindow = 1024;
+
+    RtpReceiveStats();
+
+    void reset();
+
+    // Accounts for one packet; arrivalSeconds is from a monotonic clock
+    Arrival update(const RtpHeader& header, double arrivalSeconds);
+
+    // Extended sequence number of a 16-bit one, the candidate closest to the highest seen
+    int64_t extendSequence(uint16_t sequence) const;
+
+    bool started() const { return started_; }
+    uint32_t ssrc() const { return ssrc_; }
+    uint64_t received() const { return received_; }  // without duplicates
+    uint64_t expected() const;
+    int64_t lost() const;
+    uint64_t reordered() const { return reordered_; }
+    uint64_t duplicates() const { return duplicates_; }
+    double jitterSeconds() const { return jitter_ / kRtpClockRate; }
+
+    std::string toString() const;
+
+  private:
+    bool started_;
+    uint32_t ssrc_;
+    int64_t firstSequence_;
+    int64_t highestSequence_;
+    std::vector<uint64_t> seen_;  // bit per sequence number in the duplicate window
+    uint64_t received_;
+    uint64_t reordered_;
+    uint64_t duplicates_;
+
+    double jitter_;  // in timestamp units
+    uint32_t lastTimestamp_;
+    double lastArrival_;
+
+    bool testAndSet(int64_t sequence);
+    void advanceWindow(int64_t highestSequence);
+};
+
+#endif  // RTP_RECEIVE_STATS_H
@@ -0,0 +1,166 @@
+#ifndef SAMPLE_CONVERT_H
+#define SAMPLE_CONVERT_H
+
+#include <cstdint>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <libavutil/samplefmt.h>
+#ifdef __cplusplus
+}
+#endif
+
+// Conversion between the sample formats decoders and encoders use (s16, s32 and float,
+// packed or planar) and the planar float PolyphaseResampler works on, for the same channel
+// layout. The loops are templates on sample type, layout and channel count; mono and stereo
+// are instantiated with the channel count as a constant, so the per-sample channel loop is
+// unrolled and the packed (de)interleave vectorises. Other channel counts use the generic
+// instance (Channels == 0) with the count taken at runtime.
+
+typedef void (*ToFloatFunction)(const uint8_t* const* input, float* const* output, int channels,
+                                int nbSamples);
+typedef void (*FromFloatFunction)(const float* const* input, uint8_t* const* output,
+                                  int channels, int nbSamples);
+
+template <typename Sample>
+struct SampleTraits;
+
+template <>
+struct SampleTraits<int16_t> {
+    static float toFloat(int16_t sample) { return sample * (1.0f / 32768.0f); }
+    static int16_t fromFloat(float value) {
+        value *= 32768.0f;
+        value = value < -32768.0f ? -32768.0f : (value > 32767.0f ? 32767.0f : value);
+        // Round half away from zero, which unlike lrintf() vectorises
+        return static_cast<int16_t>(value + (value < 0.0f ? -0.5f : 0.5f));
+    }
+};
+
+template <>
+struct SampleTraits<int32_t> {
+    static float toFloat(int32_t sample) { return sample * (1.0f / 2147483648.0f); }
+    static int32_t fromFloat(float value) {
+        double scaled = value * 2147483648.0;
+        scaled = scaled < -2147483648.0 ? -2147483648.0
+                                        : (scaled > 2147483647.0 ? 2147483647.0 : scaled);
+        return static_cast<int32_t>(scaled + (scaled < 0.0 ? -0.5 : 0.5));
+    }
+};
+
+template <>
+struct SampleTraits<float> {
+    static float toFloat(float sample) { return sample; }
+    static float fromFloat(float value) { return value; }
+};
+
+template <typename Sample, bool Planar, int Channels>
+struct SampleConverter {
+    static void toFloat(const uint8_t* const* input, float* const* output, int channels,
+                        int nbSamples) {
+        const int count = Channels > 0 ? Channels : channels;
+        if (Planar) {
+            for (int ch = 0; ch < count; ++ch) {
+                const Sample* in = reinterpret_cast<const Sample*>(input[ch]);
+                float* out = output[ch];
+                for (int i = 0; i < nbSamples; ++i) {
+                    out[i] = SampleTraits<Sample>::toFloat(in[i]);
+                }
+            }
+            return;
+        }
+        const Sample* in = reinterpret_cast<const Sample*>(input[0]);
+        for (int i = 0; i < nbSamples; ++i) {
+            for (int ch = 0; ch < count; ++ch) {
+                output[ch][i] = SampleTraits<Sample>::toFloat(in[i * count + ch]);
+            }
+        }
+    }
+
+    static void fromFloat(const float* const* input, uint8_t* const* output, int channels,
+                          int nbSamples) {
+        const int count = Channels > 0 ? Channels : channels;
+        if (Planar) {
+            for (int ch = 0; ch < count; ++ch) {
+                const float* in = input[ch];
+                Sample* out = reinterpret_cast<Sample*>(output[ch]);
+                for (int i = 0; i < nbSamples; ++i) {
+                    out[i] = SampleTraits<Sample>::fromFloat(in[i]);
+                }
+            }
+            return;
+        }
+        Sample* out = reinterpret_cast<Sample*>(output[0]);
+        for (int i = 0; i < nbSamples; ++i) {
+            for (int ch = 0; ch < count; ++ch) {
+                out[i * count + ch] = SampleTraits<Sample>::fromFloat(input[ch][i]);
+            }
+        }
+    }
+};
+
+template <typename Sample, bool Planar>
+inline ToFloatFunction selectToFloat(int channels) {
+    switch (channels) {
+        case 1:
+            return SampleConverter<Sample, Planar, 1>::toFloat;
+        case 2:
+            return SampleConverter<Sample, Planar, 2>::toFloat;
+        default:
+            return SampleConverter<Sample, Planar, 0>::toFloat;
+    }
+}
+
+template <typename Sample, bool Planar>
+inline FromFloatFunction selectFromFloat(int channels) {
+    switch (channels) {
+        case 1:
+            return SampleConverter<Sample, Planar, 1>::fromFloat;
+        case 2:
+            return SampleConverter<Sample, Planar, 2>::fromFloat;
+        default:
+            return SampleConverter<Sample, Planar, 0>::fromFloat;
+    }
+}
+
+// Converter from format to planar float, nullptr if there is none for the format
+inline ToFloatFunction toFloatConverter(AVSampleFormat format, int channels) {
+    switch (format) {
+        case AV_SAMPLE_FMT_S16:
+            return selectToFloat<int16_t, false>(channels);
+        case AV_SAMPLE_FMT_S16P:
+            return selectToFloat<int16_t, true>(channels);
+        case AV_SAMPLE_FMT_S32:
+            return selectToFloat<int32_t, false>(channels);
+        case AV_SAMPLE_FMT_S32P:
+            return selectToFloat<int32_t, true>(channels);
+        case AV_SAMPLE_FMT_FLT:
+            return selectToFloat<float, false>(channels);
+        case AV_SAMPLE_FMT_FLTP:
+            return selectToFloat<float, true>(channels);
+        default:
+            return nullptr;
+    }
+}
+
+// Converter from planar float to format, nullptr if there is none for the format
+inline FromFloatFunction fromFloatConverter(AVSampleFormat format, int channels) {
+    switch (format) {
+        case AV_SAMPLE_FMT_S16:
+            return selectFromFloat<int16_t, false>(channels);
+        case AV_SAMPLE_FMT_S16P:
+            return selectFromFloat<int16_t, true>(channels);
+        case AV_SAMPLE_FMT_S32:
+            return selectFromFloat<int32_t, false>(channels);
+        case AV_SAMPLE_FMT_S32P:
+            return selectFromFloat<int32_t, true>(channels);
+        case AV_SAMPLE_FMT_FLT:
+            return selectFromFloat<float, false>(channels);
+        case AV_SAMPLE_FMT_FLTP:
+            return selectFromFloat<float, true>(channels);
+        default:
+            return nullptr;
+    }
+}
+
+#endif  // SAMPLE_CONVERT_H
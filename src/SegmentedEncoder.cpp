@@ -0,0 +1,302 @@
+#include "SegmentedEncoder.h"
+
+#include <algorithm>
+#include <iostream>
+#include <thread>
+
+#include "AudioProcessor.h"
+#include "FrameDecoder.h"
+#include "FrameEncoder.h"
+#include "FrameReader.h"
+#include "Resampler.h"
+
+SegmentedEncoder::SegmentedEncoder(const std::string& inputFilePath, int segmentCount)
+    : inputFilePath_(inputFilePath),
+      segmentCount_(segmentCount),
+      resamplerBackend_(Resampler::kBackendSwr) {}
+
+void SegmentedEncoder::setResamplerBackend(Resampler::Backend backend) {
+    resamplerBackend_ = backend;
+}
+
+int SegmentedEncoder::plannedSegmentCount(AVFormatContext* formatContext, const OutputSpec& spec,
+                                          int requestedSegments) {
+    if (!formatContext || requestedSegments < 2 || formatContext->duration == AV_NOPTS_VALUE) {
+        return 0;
+    }
+    // Splicing needs frames that decode on their own, which only MP3 without its bit
+    // reservoir gives
+    if (spec.codecId != AV_CODEC_ID_MP3) {
+        return 0;
+    }
+    if (!formatContext->pb || !(formatContext->pb->seekable & AVIO_SEEKABLE_NORMAL)) {
+        return 0;
+    }
+
+    int64_t maxSegments = formatContext->duration / (kMinSegmentSeconds * (int64_t)AV_TIME_BASE);
+    int segments = static_cast<int>(std::min<int64_t>(requestedSegments, maxSegments));
+    return segments >= 2 ? segments : 0;
+}
+
+// Passes the part of frame inside [feedStart, feedEnd) to the encoder. position is the output
+// sample index of the first sample of frame.
+static int feedEncoder(FrameEncoder& encoder, AVFrame* frame, int64_t position,
+                       int64_t feedStart, int64_t feedEnd) {
+    int64_t frameEnd = position + frame->nb_samples;
+    if (frameEnd <= feedStart || position >= feedEnd) {
+        return 0;
+    }
+
+    int skip = static_cast<int>(std::max<int64_t>(0, feedStart - position));
+    int keep = static_cast<int>(std::min(frameEnd, feedEnd) - position) - skip;
+    if (skip == 0 && keep == frame->nb_samples) {
+        frame->pts = position;
+        return encoder.encodeFrame(frame);
+    }
+
+    // Encode a view of the wanted samples without copying them
+    AVFrame* view = av_frame_alloc();
+    if (!view || av_frame_ref(view, frame) < 0) {
+        av_frame_free(&view);
+        return -1;
+    }
+
+    AVSampleFormat format = static_cast<AVSampleFormat>(frame->format);
+    int bytesPerSample = av_get_bytes_per_sample(format);
+    int channels = frame->ch_layout.nb_channels;
+    if (av_sample_fmt_is_planar(format)) {
+        for (int ch = 0; ch < channels; ++ch) {
+            view->extended_data[ch] += skip * bytesPerSample;
+        }
+    } else {
+        view->extended_data[0] += skip * bytesPerSample * channels;
+    }
+    view->nb_samples = keep;
+    view->pts = position + skip;
+
+    int ret = encoder.encodeFrame(view);
+    av_frame_free(&view);
+    return ret;
+}
+
+int SegmentedEncoder::encodeSegment(Segment& segment, const OutputSpec& spec) {
+    FrameReader reader;
+    FrameDecoder decoder;
+    Resampler resampler;
+    FrameEncoder encoder;
+
+    if (reader.openInputFile(inputFilePath_) < 0 ||
+        decoder.initializeDecoder(reader.getFormatContext(), spec.sampleFormat) < 0) {
+        return -1;
+    }
+
+    encoder.setBitReservoir(false);
+    if (encoder.initializeEncoder(spec) < 0) {
+        return -1;
+    }
+
+    resampler.setBackend(resamplerBackend_);
+    AVCodecContext* encoderContext = encoder.getCodecContext();
+    resampler.setFrameSize(encoderContext->frame_size);
+    if (resampler.initializeResampler(decoder.getCodecContext(), spec) < 0) {
+        return -1;
+    }
+
+    // Output samples fed to the encoder and the packets that belong to this segment. Encoder
+    // packet timestamps run initial_padding samples ahead of the audio they carry.
+    const int64_t preroll = kEncoderPrerollFrames * (int64_t)encoderContext->frame_size;
+    const int64_t feedStart = segment.first ? 0 : segment.start - preroll;
+    const int64_t feedEnd = segment.last ? INT64_MAX : segment.end + preroll;
+    const int64_t padding = encoderContext->initial_padding;
+    const AVRational outputTimeBase = {1, spec.sampleRate};
+
+    AVFormatContext* formatContext = reader.getFormatContext();
+    int streamIndex = decoder.getStreamIndex();
+    AVStream* stream = formatContext->streams[streamIndex];
+    int64_t startTime = stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0;
+
+    if (!segment.first) {
+        int64_t target = av_rescale(feedStart, AV_TIME_BASE, spec.sampleRate) - kDecoderPrerollUs;
+        if (av_seek_frame(formatContext, -1, std::max<int64_t>(0, target),
+                          AVSEEK_FLAG_BACKWARD) < 0) {
+            std::cerr << "Could not seek to segment start " << segment.start << std::endl;
+            return -1;
+        }
+    }
+
+    auto collectPackets = [&]() {
+        while (encoder.hasEncodedPackets()) {
+            PacketHandle packet = encoder.getNextEncodedPacket();
+            if (!packet) {
+                continue;
+            }
+            int64_t pts = av_rescale_q(packet->pts, encoderContext->time_base, outputTimeBase);
+            bool keep = (segment.first || pts >= segment.start - padding) &&
+                        (segment.last || pts < segment.end - padding);
+            if (keep) {
+                segment.packets.push_back(std::move(packet));
+            }
+        }
+    };
+
+    // Feeds every frame the resampler has ready
+    int64_t position = AV_NOPTS_VALUE;
+    auto feedResampledFrames = [&]() {
+        AVFrame* resampledFrame;
+        while ((resampledFrame = resampler.receiveFrame())) {
+            if (feedEncoder(encoder, resampledFrame, position, feedStart, feedEnd) < 0) {
+                return -1;
+            }
+            position += resampledFrame->nb_samples;
+            collectPackets();
+        }
+        return 0;
+    };
+
+    // Places and resamples one decoded frame
+    auto feedDecodedFrame = [&](AVFrame* decodedFrame) {
+        if (position == AV_NOPTS_VALUE) {
+            int64_t pts = decodedFrame->best_effort_timestamp;
+            if (pts == AV_NOPTS_VALUE) {
+                if (!segment.first) {
+                    std::cerr << "Segment start has no timestamp" << std::endl;
+                    return -1;
+                }
+                pts = startTime;
+            }
+            position = av_rescale_q(pts - startTime, stream->time_base, outputTimeBase);
+        }
+
+        if (resampler.sendFrame(decodedFrame) < 0) {
+            return 0;
+        }
+        return feedResampledFrames();
+    };
+
+    // Takes every frame the decoder has ready until the segment is covered
+    FramePool framePool(1);
+    FrameHandle decodedFrame = framePool.acquire();
+    auto receiveFrames = [&]() {
+        while ((position == AV_NOPTS_VALUE || position < feedEnd) &&
+               decoder.receiveFrame(decodedFrame.get()) >= 0) {
+            if (feedDecodedFrame(decodedFrame.get()) < 0) {
+                return -1;
+            }
+        }
+        return 0;
+    };
+
+    bool endOfInput = false;
+    while (position == AV_NOPTS_VALUE || position < feedEnd) {
+        PacketHandle packet = reader.readFrame();
+        if (!packet) {
+            endOfInput = true;
+            break;
+        }
+        if (packet->stream_index != streamIndex) {
+            continue;
+        }
+
+        if (decoder.sendPacket(packet.get()) < 0) {
+            continue;
+        }
+        packet.reset();
+        if (receiveFrames() < 0) {
+            return -1;
+        }
+    }
+
+    if (endOfInput && decoder.sendPacket(nullptr) >= 0 && receiveFrames() < 0) {
+        return -1;
+    }
+
+    if (position != AV_NOPTS_VALUE && position < feedEnd && resampler.sendFrame(nullptr) >= 0 &&
+        feedResampledFrames() < 0) {
+        return -1;
+    }
+
+    if (encoder.flushEncoder() < 0) {
+        return -1;
+    }
+    collectPackets();
+    return 0;
+}
+
+int SegmentedEncoder::run(AVFormatContext* formatContext, const OutputSpec& spec,
+                          const PacketCallback& onPacket) {
+    int segmentCount = plannedSegmentCount(formatContext, spec, segmentCount_);
+    if (segmentCount == 0) {
+        std::cerr << "Input cannot be split into segments" << std::endl;
+        return -1;
+    }
+
+    // Cut on the frame grid of the encoder the segments will open
+    FrameEncoder probe;
+    probe.setBitReservoir(false);
+    if (probe.initializeEncoder(spec) < 0 || probe.getCodecContext()->frame_size <= 0) {
+        std::cerr << "Encoder for " << spec.toString() << " cannot be split into segments"
+                  << std::endl;
+        return -1;
+    }
+    const int64_t frameSize = probe.getCodecContext()->frame_size;
+    probe.closeEncoder();
+
+    int64_t totalSamples = av_rescale(formatContext->duration, spec.sampleRate, AV_TIME_BASE);
+    int64_t framesPerSegment = (totalSamples / frameSize + segmentCount - 1) / segmentCount;
+    int64_t segmentSamples = std::max<int64_t>(1, framesPerSegment) * frameSize;
+
+    segments_.resize(segmentCount);
+    for (int i = 0; i < segmentCount; ++i) {
+        Segment& segment = segments_[i];
+        segment.start = i * segmentSamples;
+        segment.end = (i + 1) * segmentSamples;
+        segment.first = (i == 0);
+        segment.last = (i == segmentCount - 1);
+        segment.result = -1;
+        segment.done = false;
+    }
+
+    std::cout << "Encoding " << segmentCount << " segments of "
+              << segmentSamples / static_cast<double>(spec.sampleRate) << " s in parallel"
+              << std::endl;
+
+    std::vector<std::thread> workers;
+    for (int i = 0; i < segmentCount; ++i) {
+        workers.push_back(std::thread([this, i, &spec] {
+            int result = encodeSegment(segments_[i], spec);
+            {
+                std::lock_guard<std::mutex> lock(doneMutex_);
+                segments_[i].result = result;
+                segments_[i].done = true;
+            }
+            doneCondition_.notify_all();
+        }));
+    }
+
+    // Deliver each segment as soon as it and all earlier ones are finished
+    int result = 0;
+    for (int i = 0; i < segmentCount; ++i) {
+        Segment& segment = segments_[i];
+        {
+            std::unique_lock<std::mutex> lock(doneMutex_);
+            doneCondition_.wait(lock, [&segment] { return segment.done; });
+        }
+
+        if (segment.result < 0) {
+            std::cerr << "Failed to encode segment " << i << std::endl;
+            result = -1;
+        }
+        for (size_t p = 0; p < segment.packets.size(); ++p) {
+            if (result == 0) {
+                onPacket(segment.packets[p].get());
+            }
+            segment.packets[p].reset();
+        }
+        segment.packets.clear();
+    }
+
+    for (size_t i = 0; i < workers.size(); ++i) {
+        workers[i].join();
+    }
+    return result;
+}
@@ -0,0 +1,78 @@
+#ifndef SEGMENTED_ENCODER_H
+#define SEGMENTED_ENCODER_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/samplefmt.h>
+#ifdef __cplusplus
+}
+#endif
+
+#include "AVObjectPool.h"
+#include "OutputSpec.h"
+#include "Resampler.h"
+
+// Encodes one long input as several time segments in parallel and stitches the MP3 frames.
+//
+// Segment boundaries sit on the frame grid of the output encoder (1152 samples for MPEG-1
+// Layer III, 576 below 32 kHz). Every segment seeks to a little before its start, decodes and
+// resamples from there, and feeds the encoder kEncoderPrerollFrames frames early so that the
+// encoder delay and the MDCT overlap are covered by audio that is thrown away. Because every
+// encoder starts on the same grid, packet n of every segment covers the same output samples
+// as the serial encode would, so the segments are joined by packet timestamp. The bit
+// reservoir is disabled so that no kept frame depends on the bytes of a discarded one; only
+// MP3 allows that, so other codecs are not split.
+class SegmentedEncoder {
+  public:
+    typedef std::function<void(AVPacket*)> PacketCallback;
+
+    SegmentedEncoder(const std::string& inputFilePath, int segmentCount);
+
+    // Number of segments the opened input can be split into for spec, or 0 if it cannot be
+    // split (not MP3, unknown duration, not seekable, or too short)
+    static int plannedSegmentCount(AVFormatContext* formatContext, const OutputSpec& spec,
+                                   int requestedSegments);
+
+    void setResamplerBackend(Resampler::Backend backend);
+
+    // Encodes all segments and passes the stitched packets to onPacket in output order, on
+    // the calling thread. onPacket does not take ownership.
+    int run(AVFormatContext* formatContext, const OutputSpec& spec,
+            const PacketCallback& onPacket);
+
+  private:
+    static const int kEncoderPrerollFrames = 4;
+    static const int64_t kDecoderPrerollUs = 500000;
+    static const int kMinSegmentSeconds = 10;
+
+    struct Segment {
+        int64_t start;  // first output sample kept
+        int64_t end;    // first output sample of the next segment
+        bool first;
+        bool last;
+        std::vector<PacketHandle> packets;
+        int result;
+        bool done;
+    };
+
+    std::string inputFilePath_;
+    int segmentCount_;
+    Resampler::Backend resamplerBackend_;
+    std::vector<Segment> segments_;
+    std::mutex doneMutex_;
+    std::condition_variable doneCondition_;
+
+    int encodeSegment(Segment& segment, const OutputSpec& spec);
+};
+
+#endif  // SEGMENTED_ENCODER_H
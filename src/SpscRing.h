@@ -0,0 +1,115 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Fixed-capacity single-producer/single-consumer ring buffer.
+// tryPush() may only be called from one thread and tryPop()/waitPop() from one other thread
+// (or both from the same thread). Both are wait-free; waitPop() spins briefly and then sleeps
+// until the producer publishes an item. The capacity is rounded up to a power of two.
+template <typename T>
+class SpscRing {
+  public:
+    explicit SpscRing(size_t capacity)
+        : mask_(roundUpPowerOfTwo(capacity) - 1),
+          slots_(mask_ + 1),
+          head_(0),
+          cachedTail_(0),
+          tail_(0),
+          cachedHead_(0),
+          consumerWaiting_(false) {}
+
+    // Moves item into the ring; it is left untouched if the ring is full
+    bool tryPush(T& item) {
+        const size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - cachedHead_ > mask_) {
+            cachedHead_ = head_.load(std::memory_order_acquire);
+            if (tail - cachedHead_ > mask_) {
+                return false;
+            }
+        }
+        slots_[tail & mask_] = std::move(item);
+        tail_.store(tail + 1, std::memory_order_release);
+
+        // Pairs with the fence in waitPop(): either the consumer sees the new tail or we see
+        // that it is about to sleep
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (consumerWaiting_.load(std::memory_order_relaxed)) {
+            std::lock_guard<std::mutex> lock(waitMutex_);
+            waitCondition_.notify_one();
+        }
+        return true;
+    }
+
+    bool tryPop(T& item) {
+        const size_t head = head_.load(std::memory_order_relaxed);
+        if (head == cachedTail_) {
+            cachedTail_ = tail_.load(std::memory_order_acquire);
+            if (head == cachedTail_) {
+                return false;
+            }
+        }
+        item = std::move(slots_[head & mask_]);
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    void waitPop(T& item) {
+        for (int spin = 0; spin < kSpinCount; ++spin) {
+            if (tryPop(item)) {
+                return;
+            }
+            std::this_thread::yield();
+        }
+
+        std::unique_lock<std::mutex> lock(waitMutex_);
+        consumerWaiting_.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        while (!tryPop(item)) {
+            waitCondition_.wait(lock);
+        }
+        consumerWaiting_.store(false, std::memory_order_relaxed);
+    }
+
+    // Only exact when called from the consumer thread
+    bool empty() const {
+        return head_.load(std::memory_order_relaxed) == tail_.load(std::memory_order_acquire);
+    }
+
+    size_t capacity() const { return mask_ + 1; }
+
+  private:
+    static const int kSpinCount = 64;
+    static const size_t kCacheLine = 64;
+
+    static size_t roundUpPowerOfTwo(size_t value) {
+        size_t result = 2;
+        while (result < value) {
+            result <<= 1;
+        }
+        return result;
+    }
+
+    const size_t mask_;
+    std::vector<T> slots_;
+
+    // Consumer-owned line
+    alignas(kCacheLine) std::atomic<size_t> head_;
+    size_t cachedTail_;
+
+    // Producer-owned line
+    alignas(kCacheLine) std::atomic<size_t> tail_;
+    size_t cachedHead_;
+
+    alignas(kCacheLine) std::atomic<bool> consumerWaiting_;
+    std::mutex waitMutex_;
+    std::condition_variable waitCondition_;
+};
+
+#endif  // SPSC_RING_H
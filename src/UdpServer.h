@@ -1,21 +1,66 @@
 #ifndef UDP_SERVER_H
 #define UDP_SERVER_H
 
-#include <string>
+#include <atomic>
+#include <memory>
+#include <vector>
 
+#include "DiskWriter.h"
+#include "OutputSpec.h"
+#include "UdpSession.h"
+#include "UdpWorker.h"
+
+// Receives any number of transmissions at once on one or more ports, whose sockets stay
+// bound for the life of the server and are read in batches (see DatagramReceiver.h).
+// Datagrams are demultiplexed into sessions (see UdpSession.h) by source address, or with
+// RTP by SSRC, so a sender may change address mid-stream. Each session writes its own file
+// and ends with an empty datagram from its sender or after UdpWorker::kIdleTimeoutSeconds
+// without a datagram.
+//
+// The receiving runs on worker threads, each with an epoll loop over the ports (see
+// UdpWorker.h). With more than one worker the ports are shared with SO_REUSEPORT and every
+// worker is pinned to a core of its own. The disk is written from a thread of its own (see
+// DiskWriter.h), so storage latency does not hold up receiving.
 class UdpServer {
   public:
-    UdpServer();
+    // spec describes the stream the sender encodes, it sets the muxer and the file extension
+    explicit UdpServer(const OutputSpec& spec = OutputSpec());
     ~UdpServer();
 
+    // Datagrams carry an RTP header (see RtpPacket.h): duplicates are dropped, and loss,
+    // reordering and jitter are reported per session. Lost packets are rebuilt from the
+    // FEC packets of the stream, if the sender adds them (see FecCodec.h). Off by default.
+    void setRtp(bool enabled);
+    // Datagrams carry several packets each, framed as in PacketAggregation.h (the sender's
+    // --udp-mtu). A datagram that does not parse as such is written as one packet.
+    void setAggregated(bool enabled);
+    // Bounds of the RTP jitter buffer's adaptive delay: packets are released in sequence
+    // order, and a missing packet is waited for that long before it is given up
+    void setJitterDelay(double minSeconds, double maxSeconds);
+    // Datagrams taken from a socket per recvmmsg() call, see DatagramReceiver.h
+    void setBatchSize(int datagrams);
+    // Receive threads, 1 by default
+    void setWorkers(int workers);
+    // How the files are written, see DiskWriter.h
+    void setDiskWriter(const DiskWriterOptions& options);
+
+    // Receives on every port until stop(), then closes the open sessions and finishes their
+    // files. Returns -1 if a port cannot be bound or a socket fails.
+    int start(const std::vector<int>& ports);
     int start(int port);
+    // Makes start() return; only writes an eventfd, so it is async-signal-safe and may be
+    // called from any thread, also before start() runs
     void stop();
 
   private:
-    bool running_;
-    int socket_fd_;
-
-    std::string generateOutputFileName() const;
+    OutputSpec spec_;
+    UdpSessionOptions options_;
+    int batchSize_;
+    int workerCount_;
+    DiskWriterOptions diskOptions_;
+    std::atomic<int> nextSessionId_;
+    int stopFd_;  // eventfd every worker's epoll loop watches
+    std::vector<std::unique_ptr<UdpWorker> > workers_;
 };
 
-#endif  // UDP_SERVER_H
\ No newline at end of file
+#endif  // UDP_SERVER_H
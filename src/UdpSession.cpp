@@ -0,0 +1,316 @@
+#include "UdpSession.h"
+
+#include <arpa/inet.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <sstream>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#ifdef __cplusplus
+}
+#endif
+
+#include "Log.h"
+#include "PacketAggregation.h"
+
+// Size of the AVIOContext or Mp3Writer buffer, the output reaches the DiskWriter in such chunks
+static const int kIoBufferSize = 64 * 1024;
+
+UdpSession::UdpSession(int id, const OutputSpec& spec, const UdpSessionOptions& options,
+                       DiskWriter& writer, const sockaddr_in& source, double now)
+    : id_(id),
+      spec_(spec),
+      options_(options),
+      writer_(writer),
+      source_(source),
+      lastArrival_(now),
+      closed_(false),
+      formatContext_(nullptr),
+      mp3Writer_(kIoBufferSize),
+      outputOpened_(false),
+      packet_(av_packet_alloc()),
+      packetsWritten_(0),
+      file_(-1),
+      position_(0),
+      fileSize_(0),
+      bytesDropped_(0),
+      jitterBuffer_(options.minJitterDelay, options.maxJitterDelay) {}
+
+UdpSession::~UdpSession() {
+    close("server stopped");
+    av_packet_free(&packet_);
+}
+
+bool UdpSession::receive(const uint8_t* data, size_t size, const sockaddr_in& source,
+                         double now) {
+    source_ = source;
+    lastArrival_ = now;
+    return writePayload(data, size);
+}
+
+bool UdpSession::receiveRtp(const RtpHeader& header, int offset, const uint8_t* data,
+                            size_t size, const sockaddr_in& source, double now) {
+    source_ = source;
+    lastArrival_ = now;
+    if (header.payloadType == kRtpPayloadTypeFec) {
+        // The packets it rebuilds join the jitter buffer as if they had arrived now
+        recovered_.clear();
+        fecDecoder_.addRepair(data, size, recovered_);
+        for (size_t i = 0; i < recovered_.size(); ++i) {
+            RtpHeader rebuilt;
+            int rebuiltOffset =
+                parseRtpHeader(recovered_[i].data(), recovered_[i].size(), rebuilt);
+            if (rebuiltOffset >= 0 &&
+                rtpStats_.update(rebuilt, now) != RtpReceiveStats::kArrivalDuplicate) {
+                jitterBuffer_.insert(rtpStats_.extendSequence(rebuilt.sequence), now,
+                                     recovered_[i].data() + rebuiltOffset,
+                                     recovered_[i].size() - rebuiltOffset, released_);
+            }
+        }
+    } else if (rtpStats_.update(header, now) != RtpReceiveStats::kArrivalDuplicate) {
+        fecDecoder_.addMedia(data, size);
+        jitterBuffer_.insert(rtpStats_.extendSequence(header.sequence), now, data + offset,
+                             size - offset, released_);
+    }
+    jitterBuffer_.adapt(rtpStats_.jitterSeconds());
+    jitterBuffer_.release(now, released_);
+    return writeReleased();
+}
+
+bool UdpSession::release(double now) {
+    jitterBuffer_.release(now, released_);
+    return writeReleased();
+}
+
+void UdpSession::close(const std::string& reason) {
+    if (closed_) {
+        return;
+    }
+    closed_ = true;
+
+    // What the jitter buffer still holds, in order, skipping the gaps
+    jitterBuffer_.flush(released_);
+    writeReleased();
+
+    std::string prefix = name() + ": ";
+    LogLine(kLogInfo) << prefix << reason;
+    if (formatContext_ || mp3Writer_.isOpen()) {
+        if (formatContext_) {
+            av_write_trailer(formatContext_);
+        }
+        closeOutput();
+        LogLine(kLogInfo) << prefix << packetsWritten_ << " packets saved to " << outputFileName_;
+        if (bytesDropped_ > 0) {
+            LogLine(kLogWarning) << prefix << bytesDropped_
+                                 << " bytes dropped, the disk did not keep up";
+        }
+    } else if (!outputOpened_) {
+        LogLine(kLogInfo) << prefix << "No data received, not creating file";
+    }
+    if (options_.rtp && rtpStats_.started()) {
+        LogLine(kLogInfo) << prefix << "RTP " << rtpStats_.toString();
+        LogLine(kLogInfo) << prefix << "Jitter buffer: " << jitterBuffer_.toString();
+    }
+    if (fecDecoder_.repairsReceived() > 0) {
+        LogLine(kLogInfo) << prefix << "FEC: " << fecDecoder_.toString();
+    }
+}
+
+std::string UdpSession::name() const {
+    std::ostringstream stream;
+    stream << "Session " << id_ << " (" << inet_ntoa(source_.sin_addr) << ":"
+           << ntohs(source_.sin_port) << ")";
+    return stream.str();
+}
+
+bool UdpSession::openOutput() {
+    outputOpened_ = true;
+    outputFileName_ = generateOutputFileName();
+
+    if (spec_.codecId == AV_CODEC_ID_MP3) {
+        AVCodecParameters* codecParameters = avcodec_parameters_alloc();
+        if (!codecParameters) {
+            return false;
+        }
+        spec_.fillCodecParameters(codecParameters);
+        int ret = mp3Writer_.open(writer_, outputFileName_, codecParameters);
+        avcodec_parameters_free(&codecParameters);
+        if (ret < 0) {
+            return false;
+        }
+        LogLine(kLogInfo) << name() << ": Writing received data to: " << outputFileName_;
+        return true;
+    }
+
+    // Initialize format context for output
+    avformat_alloc_output_context2(&formatContext_, nullptr, nullptr, outputFileName_.c_str());
+    if (!formatContext_) {
+        LogLine(kLogError) << "Could not create output context";
+        return false;
+    }
+
+    // Create output stream with the codec parameters of the stream the sender encodes
+    AVStream* outStream = avformat_new_stream(formatContext_, nullptr);
+    if (!outStream) {
+        LogLine(kLogError) << "Failed allocating output stream";
+        return false;
+    }
+    spec_.fillCodecParameters(outStream->codecpar);
+
+    // Open output file, written by the DiskWriter thread through our own AVIOContext
+    if (!(formatContext_->oformat->flags & AVFMT_NOFILE)) {
+        file_ = writer_.open(outputFileName_);
+        if (file_ < 0) {
+            return false;
+        }
+        unsigned char* buffer = static_cast<unsigned char*>(av_malloc(kIoBufferSize));
+        formatContext_->pb = avio_alloc_context(buffer, kIoBufferSize, 1, this, nullptr,
+                                                &UdpSession::writeOutput, &UdpSession::seekOutput);
+        if (!formatContext_->pb) {
+            av_free(buffer);
+            LogLine(kLogError) << "Could not allocate output context";
+            return false;
+        }
+        formatContext_->flags |= AVFMT_FLAG_CUSTOM_IO;
+    }
+
+    // Write header
+    if (avformat_write_header(formatContext_, nullptr) < 0) {
+        LogLine(kLogError) << "Error occurred when opening output file";
+        return false;
+    }
+
+    LogLine(kLogInfo) << name() << ": Writing received data to: " << outputFileName_;
+    return true;
+}
+
+bool UdpSession::writePayload(const uint8_t* payload, size_t size) {
+    if (!outputOpened_ && !openOutput()) {
+        // Drop what was set up, close() only finalizes a file whose header was written
+        closeOutput();
+        return false;
+    }
+    if (!formatContext_ && !mp3Writer_.isOpen()) {
+        return false;
+    }
+
+    static LogLimiter writeErrors;
+
+    // An aggregated datagram carries several packets
+    packets_.clear();
+    if (!options_.aggregated || !splitAggregated(payload, size, packets_)) {
+        packets_.push_back(std::make_pair(payload, size));
+    }
+    for (size_t i = 0; i < packets_.size(); ++i) {
+        if (mp3Writer_.isOpen()) {
+            if (mp3Writer_.write(packets_[i].first, packets_[i].second) < 0) {
+                LogLine(kLogError, &writeErrors) << name() << ": Error writing frame";
+            } else {
+                packetsWritten_++;
+            }
+            continue;
+        }
+        // The muxer reads the bytes where they are, in the receive buffer or the jitter
+        // buffer's copy, since a packet without buf is not reference counted
+        packet_->data = const_cast<uint8_t*>(packets_[i].first);
+        packet_->size = static_cast<int>(packets_[i].second);
+        if (av_write_frame(formatContext_, packet_) < 0) {
+            LogLine(kLogError, &writeErrors) << name() << ": Error writing frame";
+        } else {
+            packetsWritten_++;
+        }
+        packet_->data = nullptr;
+        packet_->size = 0;
+    }
+    return true;
+}
+
+void UdpSession::closeOutput() {
+    if (mp3Writer_.isOpen()) {
+        mp3Writer_.close();
+        bytesDropped_ += mp3Writer_.bytesDropped();
+    }
+    if (formatContext_) {
+        if (formatContext_->pb && (formatContext_->flags & AVFMT_FLAG_CUSTOM_IO)) {
+            avio_flush(formatContext_->pb);
+            av_freep(&formatContext_->pb->buffer);
+            avio_context_free(&formatContext_->pb);
+        }
+        avformat_free_context(formatContext_);
+        formatContext_ = nullptr;
+    }
+    if (file_ >= 0) {
+        writer_.close(file_);
+        file_ = -1;
+    }
+}
+
+// AVIOContext write callback: hands the bytes to the DiskWriter at the current position
+int UdpSession::writeOutput(void* opaque, const uint8_t* buffer, int size) {
+    UdpSession* session = static_cast<UdpSession*>(opaque);
+    std::vector<uint8_t> chunk(buffer, buffer + size);
+    if (!session->writer_.write(session->file_, session->position_, chunk)) {
+        session->bytesDropped_ += size;
+    }
+    session->position_ += size;
+    session->fileSize_ = std::max(session->fileSize_, session->position_);
+    return size;
+}
+
+// AVIOContext seek callback, for the muxers that rewrite their header in the trailer
+int64_t UdpSession::seekOutput(void* opaque, int64_t offset, int whence) {
+    UdpSession* session = static_cast<UdpSession*>(opaque);
+    switch (whence & ~AVSEEK_FORCE) {
+        case SEEK_SET:
+            break;
+        case SEEK_CUR:
+            offset += session->position_;
+            break;
+        case SEEK_END:
+            offset += session->fileSize_;
+            break;
+        case AVSEEK_SIZE:
+            return session->fileSize_;
+        default:
+            return -1;
+    }
+    if (offset < 0) {
+        return -1;
+    }
+    session->position_ = offset;
+    return offset;
+}
+
+// Writes the packets the jitter buffer released
+bool UdpSession::writeReleased() {
+    bool written = true;
+    for (size_t i = 0; i < released_.size() && written; ++i) {
+        written = writePayload(released_[i].data, released_[i].size);
+    }
+    released_.clear();
+    return written;
+}
+
+std::string UdpSession::generateOutputFileName() const {
+    // Get current time; workers open sessions concurrently, so not into localtime()'s
+    // shared buffer
+    time_t now = time(0);
+    struct tm timeinfo;
+    localtime_r(&now, &timeinfo);
+
+    // Format time string
+    char buffer[80];
+    strftime(buffer, sizeof(buffer), "%Y%m%d_%H%M%S", &timeinfo);
+
+    // Create file name; the session id keeps files of sessions started in the same second apart
+    std::ostringstream fileName;
+    fileName << buffer << "_" << id_ << "_recv." << spec_.fileExtension();
+    return fileName.str();
+}
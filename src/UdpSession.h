@@ -0,0 +1,109 @@
+#ifndef UDP_SESSION_H
+#define UDP_SESSION_H
+
+#include <netinet/in.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "DiskWriter.h"
+#include "FecCodec.h"
+#include "JitterBuffer.h"
+#include "Mp3Writer.h"
+#include "OutputSpec.h"
+#include "RtpPacket.h"
+#include "RtpReceiveStats.h"
+
+struct AVFormatContext;
+struct AVPacket;
+
+// How UdpServer reads the datagrams of every session
+struct UdpSessionOptions {
+    bool rtp;               // datagrams carry an RTP header, see UdpServer::setRtp
+    bool aggregated;        // datagrams carry several packets, see UdpServer::setAggregated
+    double minJitterDelay;  // bounds of the jitter buffer's delay, in seconds
+    double maxJitterDelay;
+
+    UdpSessionOptions()
+        : rtp(false), aggregated(false), minJitterDelay(0.05), maxJitterDelay(2.0) {}
+};
+
+// One transmission UdpServer receives: the datagrams of one sender, or with RTP those of one
+// stream, written to an output file of their own. With RTP the session keeps its own receive
+// statistics, FEC decoder and jitter buffer. The file is created with the first packet
+// written, so a session that never gets one leaves no file behind. An MP3 stream is written
+// by Mp3Writer; other formats are muxed from the buffer the packets were received into,
+// without copying. Either way the output goes to the file through a DiskWriter, so the
+// receive thread never waits for the disk.
+//
+// Times are seconds on the server's monotonic clock.
+class UdpSession {
+  public:
+    UdpSession(int id, const OutputSpec& spec, const UdpSessionOptions& options,
+               DiskWriter& writer, const sockaddr_in& source, double now);
+    ~UdpSession();
+
+    // A datagram of the session. Return false if the output file cannot be written.
+    bool receive(const uint8_t* data, size_t size, const sockaddr_in& source, double now);
+    // The same for an RTP datagram, whose header the server has parsed to find the session.
+    // offset is where the payload starts.
+    bool receiveRtp(const RtpHeader& header, int offset, const uint8_t* data, size_t size,
+                    const sockaddr_in& source, double now);
+    // Writes the packets the jitter buffer stops waiting for at now
+    bool release(double now);
+    // Writes what the jitter buffer still holds, closes the file and reports the session
+    void close(const std::string& reason);
+
+    int id() const { return id_; }
+    const sockaddr_in& source() const { return source_; }  // of the latest datagram
+    double lastArrival() const { return lastArrival_; }
+    // When release() next has something to do, or a negative value if nothing waits
+    double deadline() const { return jitterBuffer_.nextDeadline(); }
+    // "Session 3 (192.168.1.20:50000)"
+    std::string name() const;
+
+  private:
+    int id_;
+    OutputSpec spec_;
+    UdpSessionOptions options_;
+    DiskWriter& writer_;
+    sockaddr_in source_;
+    double lastArrival_;
+    bool closed_;
+
+    AVFormatContext* formatContext_;
+    Mp3Writer mp3Writer_;  // instead of formatContext_ for MP3
+    std::string outputFileName_;
+    bool outputOpened_;  // tried, formatContext_ stays null and mp3Writer_ closed if that failed
+    AVPacket* packet_;   // points at the bytes of the packet being written, owns none
+    uint64_t packetsWritten_;
+    int file_;               // DiskWriter file id
+    int64_t position_;       // where the muxer writes next
+    int64_t fileSize_;
+    uint64_t bytesDropped_;  // by the DiskWriter, its queue was full
+
+    RtpReceiveStats rtpStats_;
+    FecDecoder fecDecoder_;
+    JitterBuffer jitterBuffer_;
+    std::vector<std::vector<uint8_t> > recovered_;
+    PacketList released_;
+    std::vector<std::pair<const uint8_t*, size_t> > packets_;
+
+    UdpSession(const UdpSession&);
+    UdpSession& operator=(const UdpSession&);
+
+    bool openOutput();
+    // Closes the Mp3Writer or frees the muxer, and queues the close of the file
+    void closeOutput();
+    static int writeOutput(void* opaque, const uint8_t* buffer, int size);
+    static int64_t seekOutput(void* opaque, int64_t offset, int whence);
+    // Writes one datagram payload, split into its packets when aggregated
+    bool writePayload(const uint8_t* payload, size_t size);
+    bool writeReleased();
+    std::string generateOutputFileName() const;
+};
+
+#endif  // UDP_SESSION_H
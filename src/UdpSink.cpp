@@ -0,0 +1,538 @@
+#include "UdpSink.h"
+
+#include <linux/net_tstamp.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#include "Log.h"
+#include "PacketAggregation.h"
+
+#ifdef SO_TXTIME
+static const size_t kControlSize = CMSG_SPACE(sizeof(uint64_t));
+#else
+static const size_t kControlSize = 0;
+#endif
+
+bool UdpSinkOptions::parsePacing(const std::string& name, Pacing& pacing) {
+    if (name == "off") {
+        pacing = kPacingOff;
+    } else if (name == "bucket") {
+        pacing = kPacingTokenBucket;
+    } else if (name == "txtime") {
+        pacing = kPacingTxTime;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+UdpSink::UdpSink(const std::string& serverIp, int serverPort, const UdpSinkOptions& options)
+    : serverIp_(serverIp),
+      serverPort_(serverPort),
+      udpSocket_(-1),
+      sendError_(false),
+      options_(options),
+      timeBase_{1, 1},
+      lastPts_(AV_NOPTS_VALUE),
+      batchSize_(std::max(options.batchSize, 1)),
+      flushInterval_(std::max(options.flushIntervalMs, 0)),
+      head_(0),
+      queued_(0),
+      packetsWritten_(0),
+      datagramsSent_(0),
+      sendCalls_(0),
+      aggregateBudget_(options.mtu > 0 ? std::max(options.mtu - kUdpIpv4Overhead, 1) : 0),
+      aggregateDelay_(std::max(options.aggregateMs, 0)),
+      aggregateHeaderLength_(0),
+      aggregateCount_(0),
+      aggregateCost_(0.0),
+      paced_(options.pacing != UdpSinkOptions::kPacingOff && options.pacingSpeed > 0.0),
+      txTime_(false),
+      burst_(0),
+      scheduled_(0),
+      stopping_(false),
+      flushThreadIdle_(false) {
+    memset(&udpServerAddr_, 0, sizeof(udpServerAddr_));
+}
+
+UdpSink::~UdpSink() { close(); }
+
+int UdpSink::open(const AVCodecParameters* codecParameters, AVRational timeBase) {
+    // Create UDP socket
+    udpSocket_ = socket(AF_INET, SOCK_DGRAM, 0);
+    if (udpSocket_ < 0) {
+        std::cerr << "Failed to create UDP socket" << std::endl;
+        return -1;
+    }
+
+    // Set up server address
+    udpServerAddr_.sin_family = AF_INET;
+    udpServerAddr_.sin_port = htons(serverPort_);
+    udpServerAddr_.sin_addr.s_addr = inet_addr(serverIp_.c_str());
+    if (connect(udpSocket_, (struct sockaddr*)&udpServerAddr_, sizeof(udpServerAddr_)) < 0) {
+        std::cerr << "Failed to connect UDP socket to " << serverIp_ << ":" << serverPort_
+                  << std::endl;
+        ::close(udpSocket_);
+        udpSocket_ = -1;
+        return -1;
+    }
+
+    timeBase_ = timeBase;
+    lastPts_ = AV_NOPTS_VALUE;
+    txTime_ = paced_ && options_.pacing == UdpSinkOptions::kPacingTxTime && enableTxTime();
+    burst_ = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double, std::milli>(options_.pacingBurstMs / options_.pacingSpeed));
+    theoreticalTime_ = Clock::time_point();
+    scheduled_ = 0;
+
+    int capacity = paced_ ? std::max(batchSize_, static_cast<int>(kPacedQueueDepth)) : batchSize_;
+    slots_.assign(capacity, Datagram());
+    iovecs_.assign(batchSize_, iovec());
+    messages_.assign(batchSize_, mmsghdr());
+    controls_.assign(batchSize_ * kControlSize, 0);
+    head_ = 0;
+    queued_ = 0;
+    aggregateCount_ = 0;
+    stopping_ = false;
+    if (options_.transport == UdpSinkOptions::kTransportRtp) {
+        rtpPacketizer_.init(codecParameters ? codecParameters->codec_id : AV_CODEC_ID_NONE,
+                            timeBase);
+    } else if (options_.fec.scheme != kFecNone) {
+        std::cerr << "Warning: FEC needs the RTP transport, sending without it" << std::endl;
+        options_.fec = FecOptions();
+    }
+    fecEncoder_.init(options_.fec);
+    if (paced_) {
+        flushThread_ = std::thread(&UdpSink::paceLoop, this);
+    } else if (batchSize_ > 1 || aggregateBudget_ > 0) {
+        flushThread_ = std::thread(&UdpSink::flushLoop, this);
+    }
+
+    std::cout << "UDP client initialized to send to " << serverIp_ << ":" << serverPort_
+              << " in batches of up to " << batchSize_ << " datagrams";
+    if (options_.transport == UdpSinkOptions::kTransportRtp) {
+        std::cout << ", RTP ssrc " << std::hex << rtpPacketizer_.ssrc() << std::dec;
+    }
+    if (aggregateBudget_ > 0) {
+        std::cout << ", packing packets into " << options_.mtu << "-byte datagrams within "
+                  << aggregateDelay_.count() << " ms";
+    }
+    if (fecEncoder_.enabled()) {
+        std::cout << ", FEC " << options_.fec.toString();
+    }
+    if (paced_) {
+        std::cout << ", paced at " << options_.pacingSpeed << "x real time"
+                  << (txTime_ ? " with SO_TXTIME" : "");
+    }
+    std::cout << std::endl;
+    return 0;
+}
+
+int UdpSink::write(const AVPacket* packet) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!packet || sendError_) {
+        sendError_ = true;
+        return -1;
+    }
+
+    packetsWritten_++;
+    if (aggregateBudget_ > 0) {
+        if (aggregatePacket(packet, packetCost(packet), lock) < 0) {
+            sendError_ = true;
+            return -1;
+        }
+        return 0;
+    }
+
+    uint8_t header[kRtpMaxHeaderSize];
+    int headerLength = 0;
+    if (options_.transport == UdpSinkOptions::kTransportRtp) {
+        headerLength = rtpPacketizer_.writeHeader(packet, header);
+    }
+    if (queueDatagram(header, headerLength, packet->data, packet->size, packetCost(packet),
+                      lock) < 0) {
+        sendError_ = true;
+        return -1;
+    }
+    if (fecEncoder_.add(header, headerLength, packet->data, packet->size) &&
+        queueRepairs(lock) < 0) {
+        sendError_ = true;
+        return -1;
+    }
+    return 0;
+}
+
+void UdpSink::close() {
+    if (udpSocket_ < 0) {
+        return;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (!sendError_ && queueAggregate(lock) < 0) {
+            sendError_ = true;
+        }
+        if (!sendError_ && fecEncoder_.finish() && queueRepairs(lock) < 0) {
+            sendError_ = true;
+        }
+        // A paced end marker goes out after the rest of the queue, at its turn
+        if (paced_ && !sendError_ && queueDatagram(nullptr, 0, nullptr, 0, 0.0, lock) < 0) {
+            sendError_ = true;
+        }
+        stopping_ = true;
+    }
+    queuedCondition_.notify_one();
+    if (flushThread_.joinable()) {
+        flushThread_.join();
+    }
+
+    // Send what is still queued and the end marker, if no error occurred
+    if (!sendError_) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if ((paced_ || queueDatagram(nullptr, 0, nullptr, 0, 0.0, lock) >= 0) &&
+            flushQueue(queued_) >= 0) {
+            std::cout << "End marker sent to UDP server (" << packetsWritten_ << " packets in "
+                      << datagramsSent_ << " datagrams in " << sendCalls_ << " sendmmsg calls)"
+                      << std::endl;
+        } else {
+            std::cerr << "Failed to send end marker to UDP server" << std::endl;
+        }
+    }
+
+    ::close(udpSocket_);
+    udpSocket_ = -1;
+}
+
+std::string UdpSink::description() const {
+    return "udp:" + serverIp_ + ":" + std::to_string(serverPort_);
+}
+
+bool UdpSink::enableTxTime() {
+#ifdef SO_TXTIME
+    struct sock_txtime config;
+    memset(&config, 0, sizeof(config));
+    config.clockid = CLOCK_MONOTONIC;  // the clock of std::chrono::steady_clock on Linux
+    if (setsockopt(udpSocket_, SOL_SOCKET, SO_TXTIME, &config, sizeof(config)) == 0) {
+        return true;
+    }
+#endif
+    std::cerr << "SO_TXTIME is not available, pacing with the token bucket only" << std::endl;
+    return false;
+}
+
+// Media time the packet covers: its duration, or the pts step from the previous packet
+double UdpSink::packetCost(const AVPacket* packet) {
+    int64_t duration = packet->duration;
+    if (duration <= 0 && packet->pts != AV_NOPTS_VALUE && lastPts_ != AV_NOPTS_VALUE) {
+        duration = packet->pts - lastPts_;
+    }
+    if (packet->pts != AV_NOPTS_VALUE) {
+        lastPts_ = packet->pts;
+    }
+    return duration > 0 ? duration * av_q2d(timeBase_) : 0.0;
+}
+
+int UdpSink::queueDatagram(const uint8_t* header, size_t headerLength, const uint8_t* data,
+                           size_t length, double cost, std::unique_lock<std::mutex>& lock) {
+    Datagram* slot = reserveSlot(lock);
+    if (!slot) {
+        return -1;
+    }
+    // The slot keeps its capacity, so once warmed up queueing does not allocate
+    slot->bytes.assign(header, header + headerLength);
+    slot->bytes.insert(slot->bytes.end(), data, data + length);
+    slot->cost = cost;
+    return commitSlot();
+}
+
+// The slot after the queued datagrams, once there is room for it
+UdpSink::Datagram* UdpSink::reserveSlot(std::unique_lock<std::mutex>& lock) {
+    if (udpSocket_ < 0) {
+        return nullptr;
+    }
+    int capacity = static_cast<int>(slots_.size());
+    if (paced_) {
+        // The pacer makes room at the paced rate
+        spaceCondition_.wait(lock, [this, capacity] { return queued_ < capacity || sendError_; });
+        if (sendError_) {
+            return nullptr;
+        }
+    }
+    return &slots_[(head_ + queued_) % capacity];
+}
+
+// Queues the reserved slot
+int UdpSink::commitSlot() {
+    if (queued_ == 0) {
+        deadline_ = Clock::now() + flushInterval_;
+        // A flush thread already waiting for a deadline picks up the new one when it wakes
+        if (flushThreadIdle_) {
+            queuedCondition_.notify_one();
+        }
+    }
+    queued_++;
+
+    if (!paced_ && queued_ == batchSize_) {
+        return flushQueue(queued_);
+    }
+    return 0;
+}
+
+// Queues the repair datagrams of the group the encoder just completed. They take no media
+// time, the pacer sends them together with the next packet.
+int UdpSink::queueRepairs(std::unique_lock<std::mutex>& lock) {
+    for (int i = 0; i < fecEncoder_.repairCount(); ++i) {
+        const std::vector<uint8_t>& repair = fecEncoder_.repair(i);
+        if (queueDatagram(nullptr, 0, repair.data(), repair.size(), 0.0, lock) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Adds the packet to the datagram being filled, queueing that first if the packet does not
+// fit or the datagram has waited long enough. A packet too big to share a datagram gets one
+// of its own.
+int UdpSink::aggregatePacket(const AVPacket* packet, double cost,
+                             std::unique_lock<std::mutex>& lock) {
+    size_t size = static_cast<size_t>(packet->size);
+    if (size > kAggregateMaxPacketSize) {
+        std::cerr << "Packet of " << size << " bytes is too large to aggregate" << std::endl;
+        return -1;
+    }
+    if (aggregateCount_ > 0 &&
+        (aggregate_.size() + kAggregateLengthSize + size > aggregateBudget_ ||
+         Clock::now() >= aggregateDeadline_) &&
+        queueAggregate(lock) < 0) {
+        return -1;
+    }
+
+    bool rtp = options_.transport == UdpSinkOptions::kTransportRtp;
+    if (aggregateCount_ == 0) {
+        uint8_t header[kRtpMaxHeaderSize];
+        aggregateHeaderLength_ = rtp ? rtpPacketizer_.writeHeader(packet, header) : 0;
+        aggregate_.assign(header, header + aggregateHeaderLength_);
+        aggregateCost_ = 0.0;
+        aggregateDeadline_ = Clock::now() + aggregateDelay_;
+        // The flush thread waits for the earlier of its deadlines
+        queuedCondition_.notify_one();
+    } else if (rtp) {
+        rtpPacketizer_.continueDatagram(packet);
+    }
+    appendAggregated(aggregate_, packet->data, size);
+    aggregateCount_++;
+    aggregateCost_ += cost;
+
+    // Not even an empty packet would fit any more
+    if (aggregate_.size() + kAggregateLengthSize >= aggregateBudget_) {
+        return queueAggregate(lock);
+    }
+    return 0;
+}
+
+// Queues the datagram being filled, and its FEC repair datagrams when it completes a group.
+// The datagram is swapped into its queue slot rather than copied.
+int UdpSink::queueAggregate(std::unique_lock<std::mutex>& lock) {
+    if (aggregateCount_ == 0) {
+        return 0;
+    }
+    // Only write() fills aggregate_, so it stays as it is if reserveSlot() has to wait
+    aggregateCount_ = 0;
+    bool groupComplete = fecEncoder_.add(aggregate_.data(), aggregateHeaderLength_,
+                                         aggregate_.data() + aggregateHeaderLength_,
+                                         aggregate_.size() - aggregateHeaderLength_);
+    Datagram* slot = reserveSlot(lock);
+    if (!slot) {
+        return -1;
+    }
+    slot->bytes.swap(aggregate_);
+    slot->cost = aggregateCost_;
+    if (commitSlot() < 0 || (groupComplete && queueRepairs(lock) < 0)) {
+        return -1;
+    }
+    return 0;
+}
+
+// Queue slots queueAggregate() may need: the datagram and a group's repair datagrams. The
+// pacer only queues a datagram when they are free, so that it never waits for itself.
+int UdpSink::aggregateRoom() const {
+    return 1 + (fecEncoder_.enabled() ? options_.fec.parityCount : 0);
+}
+
+// Sends the first count queued datagrams, count <= batchSize_
+int UdpSink::flushQueue(int count) {
+    int capacity = static_cast<int>(slots_.size());
+    for (int i = 0; i < count; ++i) {
+        Datagram& datagram = slots_[(head_ + i) % capacity];
+        iovecs_[i].iov_base = datagram.bytes.data();
+        iovecs_[i].iov_len = datagram.bytes.size();
+        memset(&messages_[i], 0, sizeof(messages_[i]));
+        messages_[i].msg_hdr.msg_iov = &iovecs_[i];
+        messages_[i].msg_hdr.msg_iovlen = 1;
+#ifdef SO_TXTIME
+        if (txTime_) {
+            uint8_t* control = &controls_[i * kControlSize];
+            memset(control, 0, kControlSize);
+            messages_[i].msg_hdr.msg_control = control;
+            messages_[i].msg_hdr.msg_controllen = kControlSize;
+            struct cmsghdr* cmsg = CMSG_FIRSTHDR(&messages_[i].msg_hdr);
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_TXTIME;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(uint64_t));
+            uint64_t releaseNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                     datagram.release.time_since_epoch())
+                                     .count();
+            memcpy(CMSG_DATA(cmsg), &releaseNs, sizeof(releaseNs));
+        }
+#endif
+    }
+
+    int sent = 0;
+    int refused = 0;
+    int result = 0;
+    while (sent < count) {
+        int ret = sendmmsg(udpSocket_, &messages_[sent], count - sent, 0);
+        sendCalls_++;
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        // A connected socket reports an earlier ICMP port unreachable on the next send.
+        // Nobody listening is not an error for a stream (sendto() ignored it too); reporting
+        // the error clears it, so the same datagrams are sent again.
+        if (ret < 0 && errno == ECONNREFUSED && refused++ < count) {
+            continue;
+        }
+        if (ret < 0) {
+            std::cerr << "Failed to send UDP data: " << strerror(errno) << std::endl;
+            result = -1;
+            count = queued_;  // nothing queued goes out any more
+            break;
+        }
+        for (int i = sent; i < sent + ret; ++i) {
+            if (messages_[i].msg_len != iovecs_[i].iov_len) {
+                static LogLimiter incompleteSends;
+                LogLine(kLogWarning, &incompleteSends)
+                    << "Warning: Incomplete UDP data sent. Sent " << messages_[i].msg_len
+                    << " out of " << iovecs_[i].iov_len << " bytes";
+            }
+        }
+        sent += ret;
+        datagramsSent_ += ret;
+    }
+
+    head_ = (head_ + count) % capacity;
+    queued_ -= count;
+    scheduled_ = std::max(scheduled_ - count, 0);
+    spaceCondition_.notify_one();
+    return result;
+}
+
+// Gives the first unscheduled datagram its release time. Virtual scheduling form of the
+// token bucket (GCRA): theoreticalTime_ is when the bucket would be empty; a datagram may
+// go a burst before it, but never before now.
+void UdpSink::scheduleNext(Clock::time_point now) {
+    int capacity = static_cast<int>(slots_.size());
+    Datagram& datagram = slots_[(head_ + scheduled_) % capacity];
+    if (theoreticalTime_ < now) {
+        theoreticalTime_ = now;
+    }
+    datagram.release = std::max(now, theoreticalTime_ - burst_);
+    theoreticalTime_ += std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(datagram.cost / options_.pacingSpeed));
+    scheduled_++;
+}
+
+// Sends a partial batch once its oldest datagram reaches the deadline, and a partly filled
+// aggregate datagram once its first packet has waited aggregateDelay_
+void UdpSink::flushLoop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stopping_) {
+        if (queued_ == 0 && aggregateCount_ == 0) {
+            flushThreadIdle_ = true;
+            queuedCondition_.wait(lock);
+            flushThreadIdle_ = false;
+            continue;
+        }
+        Clock::time_point wakeup = queued_ > 0 ? deadline_ : aggregateDeadline_;
+        if (aggregateCount_ > 0) {
+            wakeup = std::min(wakeup, aggregateDeadline_);
+        }
+        if (queuedCondition_.wait_until(lock, wakeup) != std::cv_status::timeout) {
+            continue;
+        }
+        Clock::time_point now = Clock::now();
+        // A datagram held for its latency cap goes out at once, not after another deadline
+        bool aggregateDue = aggregateCount_ > 0 && now >= aggregateDeadline_;
+        if (aggregateDue && queueAggregate(lock) < 0) {
+            sendError_ = true;
+        }
+        if (queued_ > 0 && (aggregateDue || now >= deadline_) && flushQueue(queued_) < 0) {
+            sendError_ = true;
+        }
+    }
+}
+
+// Releases datagrams on the token bucket schedule; with SO_TXTIME up to one burst early,
+// carrying their release time. Drains the queue before it returns at close().
+void UdpSink::paceLoop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    Clock::duration lookahead = txTime_ ? burst_ : Clock::duration(0);
+    int capacity = static_cast<int>(slots_.size());
+    while (!sendError_) {
+        if (aggregateCount_ > 0 && Clock::now() >= aggregateDeadline_ &&
+            queued_ + aggregateRoom() <= capacity && queueAggregate(lock) < 0) {
+            sendError_ = true;
+            break;
+        }
+        if (queued_ == 0) {
+            if (stopping_) {
+                break;
+            }
+            flushThreadIdle_ = true;
+            if (aggregateCount_ > 0) {
+                queuedCondition_.wait_until(lock, aggregateDeadline_);
+            } else {
+                queuedCondition_.wait(lock);
+            }
+            flushThreadIdle_ = false;
+            continue;
+        }
+
+        Clock::time_point now = Clock::now();
+        int count = 0;
+        while (count < queued_ && count < batchSize_) {
+            if (count == scheduled_) {
+                scheduleNext(now);
+            }
+            if (slots_[(head_ + count) % capacity].release > now + lookahead) {
+                break;
+            }
+            count++;
+        }
+        if (count > 0) {
+            if (flushQueue(count) < 0) {
+                sendError_ = true;
+            }
+            continue;
+        }
+
+        // New datagrams only join the back of the queue, nothing to wake up for but a
+        // datagram being filled
+        Clock::time_point wakeup = slots_[head_].release - lookahead;
+        if (aggregateCount_ > 0) {
+            wakeup = std::min(wakeup, aggregateDeadline_);
+        }
+        queuedCondition_.wait_until(lock, wakeup);
+    }
+
+    // After an error the queue is dropped so that writers and close() do not wait for it
+    head_ = 0;
+    queued_ = 0;
+    scheduled_ = 0;
+    spaceCondition_.notify_all();
+}
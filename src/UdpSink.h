@@ -0,0 +1,175 @@
+#ifndef UDP_SINK_H
+#define UDP_SINK_H
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "FecCodec.h"
+#include "PacketSink.h"
+#include "RtpPacket.h"
+
+// How UdpSink frames and sends datagrams
+struct UdpSinkOptions {
+    enum Transport {
+        kTransportRaw,  // the bare packet bytes
+        kTransportRtp   // RTP header before the packet, see RtpPacket.h
+    };
+
+    enum Pacing {
+        kPacingOff,          // as fast as packets come
+        kPacingTokenBucket,  // released by a userspace token bucket at the media rate
+        kPacingTxTime        // the same schedule, handed to the kernel early with SO_TXTIME
+    };
+
+    Transport transport;
+    int batchSize;        // datagrams per sendmmsg(), 1 sends every packet on its own
+    int flushIntervalMs;  // longest a queued datagram waits for its batch to fill
+    Pacing pacing;
+    double pacingSpeed;  // media seconds sent per second, 1.0 is real time
+    int pacingBurstMs;   // media time that may go out at once, ahead of the schedule
+    FecOptions fec;      // repair datagrams, kTransportRtp only
+    int mtu;             // packs packets into datagrams of up to this size, 0 sends one each
+    int aggregateMs;     // longest the first packet of a datagram waits for more to join it
+
+    UdpSinkOptions()
+        : transport(kTransportRaw),
+          batchSize(16),
+          flushIntervalMs(5),
+          pacing(kPacingOff),
+          pacingSpeed(1.0),
+          pacingBurstMs(40),
+          mtu(0),
+          aggregateMs(20) {}
+
+    // "off", "bucket" or "txtime"
+    static bool parsePacing(const std::string& name, Pacing& pacing);
+};
+
+// Sends each packet as one UDP datagram and an empty datagram as end marker. With
+// kTransportRtp every datagram starts with an RTP header carrying a sequence number, the
+// packet pts on a 90 kHz clock and a random SSRC per stream; the end marker stays empty.
+// FEC then queues the repair datagrams of each group right after its last packet (see
+// FecCodec.h), and those of the last, partial group before the end marker.
+//
+// With an MTU, as many whole packets as fit in mtu bytes of IP datagram are sent together,
+// framed as in PacketAggregation.h, with one RTP header for them all. A datagram is queued
+// when the next packet does not fit or when its first packet has waited aggregateMs; the
+// flush thread (or pacer) enforces that deadline when no packet comes.
+//
+// The socket is connect()ed to the server, so the kernel resolves the route once instead of
+// on every datagram. Datagrams are copied into a queue of batchSize slots and handed to the
+// kernel with one sendmmsg() when the queue is full, when the oldest queued datagram has
+// waited flushIntervalMs (checked by a flush thread), and at close(). A batch size of 1
+// sends every packet as it comes, without the flush thread.
+//
+// With pacing, a pacer thread releases datagrams at the rate of their media duration times
+// pacingSpeed instead. The schedule is a token bucket in its virtual scheduling form: each
+// datagram may leave pacingBurstMs / pacingSpeed before its theoretical time, and a
+// sender that fell behind starts again from now rather than catching up in one burst.
+// Datagrams that are due together still share one sendmmsg(). kPacingTxTime passes the
+// release time of each datagram to the kernel (SO_TXTIME on CLOCK_MONOTONIC, which the fq
+// qdisc honours) up to one burst ahead, so the timing no longer depends on the pacer
+// waking up on time. The queue then holds kPacedQueueDepth datagrams and write() blocks
+// while it is full, which slows the encoder down to the paced rate.
+class UdpSink : public PacketSink {
+  public:
+    static const int kPacedQueueDepth = 64;
+
+    UdpSink(const std::string& serverIp, int serverPort,
+            const UdpSinkOptions& options = UdpSinkOptions());
+    ~UdpSink();
+
+    int open(const AVCodecParameters* codecParameters, AVRational timeBase) override;
+    int write(const AVPacket* packet) override;
+    void close() override;
+    std::string description() const override;
+
+    uint64_t packetsWritten() const { return packetsWritten_; }
+    uint64_t datagramsSent() const { return datagramsSent_; }
+    uint64_t sendCalls() const { return sendCalls_; }
+
+  private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Datagram {
+        std::vector<uint8_t> bytes;
+        double cost;                // media seconds, for pacing
+        Clock::time_point release;  // paced send time, once scheduled
+    };
+
+    std::string serverIp_;
+    int serverPort_;
+    int udpSocket_;
+    struct sockaddr_in udpServerAddr_;
+    bool sendError_;
+    UdpSinkOptions options_;
+    RtpPacketizer rtpPacketizer_;
+    FecEncoder fecEncoder_;
+    AVRational timeBase_;
+    int64_t lastPts_;
+
+    int batchSize_;
+    std::chrono::milliseconds flushInterval_;
+    std::vector<Datagram> slots_;  // ring of queued datagrams
+    int head_;
+    int queued_;
+    std::vector<struct iovec> iovecs_;
+    std::vector<struct mmsghdr> messages_;
+    std::vector<uint8_t> controls_;  // SCM_TXTIME control message per batch entry
+    Clock::time_point deadline_;     // when the oldest queued datagram has to go out
+    uint64_t packetsWritten_;
+    uint64_t datagramsSent_;
+    uint64_t sendCalls_;
+
+    // Aggregation
+    size_t aggregateBudget_;  // UDP payload bytes per datagram, 0 when off
+    std::chrono::milliseconds aggregateDelay_;
+    std::vector<uint8_t> aggregate_;  // the datagram being filled, headers included
+    size_t aggregateHeaderLength_;
+    int aggregateCount_;  // packets in aggregate_
+    double aggregateCost_;
+    Clock::time_point aggregateDeadline_;
+
+    // Pacing
+    bool paced_;
+    bool txTime_;
+    Clock::duration burst_;
+    Clock::time_point theoreticalTime_;  // when the bucket is empty again
+    int scheduled_;                      // queued datagrams with a release time
+
+    std::mutex mutex_;
+    std::condition_variable queuedCondition_;
+    std::condition_variable spaceCondition_;
+    std::thread flushThread_;
+    bool stopping_;
+    bool flushThreadIdle_;  // waiting for a datagram rather than for a deadline
+
+    bool enableTxTime();
+    double packetCost(const AVPacket* packet);
+
+    // With mutex_ held
+    int queueDatagram(const uint8_t* header, size_t headerLength, const uint8_t* data,
+                      size_t length, double cost, std::unique_lock<std::mutex>& lock);
+    Datagram* reserveSlot(std::unique_lock<std::mutex>& lock);
+    int commitSlot();
+    int queueRepairs(std::unique_lock<std::mutex>& lock);
+    int aggregatePacket(const AVPacket* packet, double cost, std::unique_lock<std::mutex>& lock);
+    int queueAggregate(std::unique_lock<std::mutex>& lock);
+    int aggregateRoom() const;
+    int flushQueue(int count);
+    void scheduleNext(Clock::time_point now);
+    void flushLoop();
+    void paceLoop();
+};
+
+#endif  // UDP_SINK_H
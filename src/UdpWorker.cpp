@@ -0,0 +1,303 @@
+#include "UdpWorker.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+#include <utility>
+
+#include "DatagramReceiver.h"
+#include "Log.h"
+
+const double UdpWorker::kIdleTimeoutSeconds = 5.0;
+
+// How often sessions are checked for the idle timeout
+static const double kIdleCheckSeconds = 0.5;
+
+// Ready sockets taken per epoll_wait()
+static const int kMaxEvents = 64;
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Session key of a sender without RTP, apart from any SSRC since a server reads one or the
+// other
+static uint64_t addressKey(const sockaddr_in& address) {
+    return (static_cast<uint64_t>(ntohl(address.sin_addr.s_addr)) << 16) |
+           ntohs(address.sin_port);
+}
+
+UdpWorker::UdpWorker(int index, const OutputSpec& spec, const UdpSessionOptions& options,
+                     int batchSize, DiskWriter& writer, std::atomic<int>& nextSessionId,
+                     int stopFd)
+    : index_(index),
+      spec_(spec),
+      options_(options),
+      batchSize_(batchSize),
+      writer_(writer),
+      nextSessionId_(nextSessionId),
+      running_(false),
+      epollFd_(-1),
+      stopFd_(stopFd),
+      rtpInvalid_(0),
+      rtpInvalidReported_(0),
+      bytesReceived_(0) {}
+
+UdpWorker::~UdpWorker() {
+    for (size_t i = 0; i < sockets_.size(); ++i) {
+        close(sockets_[i]);
+    }
+    if (epollFd_ >= 0) {
+        close(epollFd_);
+    }
+}
+
+int UdpWorker::open(const std::vector<int>& ports, bool reusePort) {
+    epollFd_ = epoll_create1(0);
+    if (epollFd_ < 0) {
+        LogLine(kLogError) << "Failed to create the event loop";
+        return -1;
+    }
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    // Level-triggered and never read here, so it wakes every worker and stays set
+    event.data.fd = stopFd_;
+    if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, stopFd_, &event) < 0) {
+        LogLine(kLogError) << "Failed to create the event loop";
+        return -1;
+    }
+
+    for (size_t i = 0; i < ports.size(); ++i) {
+        // Create UDP socket
+        int fd = socket(AF_INET, SOCK_DGRAM, 0);
+        if (fd < 0) {
+            LogLine(kLogError) << "Failed to create socket";
+            return -1;
+        }
+        sockets_.push_back(fd);
+
+        // Every worker binds the port, the kernel picks one socket per sender
+        int enable = 1;
+        if (reusePort && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) < 0) {
+            LogLine(kLogError) << "Failed to set SO_REUSEPORT";
+            return -1;
+        }
+
+        // Set up server address
+        struct sockaddr_in server_addr;
+        memset(&server_addr, 0, sizeof(server_addr));
+        server_addr.sin_family = AF_INET;
+        server_addr.sin_addr.s_addr = INADDR_ANY;
+        server_addr.sin_port = htons(ports[i]);
+
+        // Bind socket, once for every session
+        if (bind(fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
+            LogLine(kLogError) << "Failed to bind socket to port " << ports[i];
+            return -1;
+        }
+
+        event.data.fd = fd;
+        if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &event) < 0) {
+            LogLine(kLogError) << "Failed to watch socket";
+            return -1;
+        }
+    }
+    running_ = true;
+    return 0;
+}
+
+int UdpWorker::run(int core) {
+    if (core >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(core, &cpus);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+            LogLine(kLogWarning) << name() << ": Could not pin to core " << core;
+        }
+    }
+
+    DatagramReceiver receiver(batchSize_);
+    struct epoll_event events[kMaxEvents];
+    std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+    double nextIdleCheck = kIdleCheckSeconds;
+    int result = 0;
+    while (running_) {
+        // Wait for datagrams until sessions are due for the idle check, or until a jitter
+        // buffer gives up a gap before that
+        double now = secondsSince(startTime);
+        double wait = nextIdleCheck - now;
+        for (std::set<uint64_t>::const_iterator it = waiting_.begin(); it != waiting_.end();
+             ++it) {
+            wait = std::min(wait, sessions_[*it]->deadline() - now);
+        }
+        int timeoutMs = static_cast<int>(std::ceil(std::max(wait, 0.0) * 1000.0));
+
+        int ready = epoll_wait(epollFd_, events, kMaxEvents, timeoutMs);
+        if (ready < 0 && errno != EINTR) {
+            LogLine(kLogError) << name() << ": Error waiting for data";
+            result = -1;
+            break;
+        }
+
+        // One batch per ready socket and round, so a busy port does not starve the others;
+        // the sockets stay ready for the next round while datagrams are queued
+        for (int e = 0; e < ready && running_; ++e) {
+            if (events[e].data.fd == stopFd_) {
+                running_ = false;
+                break;
+            }
+            int count = receiver.read(events[e].data.fd);
+            if (count < 0) {
+                LogLine(kLogError) << name() << ": Error receiving data";
+                result = -1;
+                running_ = false;
+                break;
+            }
+            now = secondsSince(startTime);
+            for (int i = 0; i < count; ++i) {
+                const sockaddr_in& client_addr = receiver.source(i);
+                if (receiver.size(i) == 0) {
+                    // End marker, of the sessions of this sender only
+                    closeSessionsFrom(client_addr, "End marker received");
+                    continue;
+                }
+                receiveDatagram(receiver.data(i), receiver.size(i), client_addr, now);
+                bytesReceived_ += receiver.size(i);
+            }
+        }
+
+        now = secondsSince(startTime);
+        releaseDue(now);
+        if (now >= nextIdleCheck) {
+            closeIdle(now);
+            nextIdleCheck = now + kIdleCheckSeconds;
+        }
+    }
+
+    // Finish the files of the sessions still open
+    while (!sessions_.empty()) {
+        closeSession(sessions_.begin(), "Server stopped");
+    }
+    LogLine(kLogInfo) << name() << ": " << receiver.datagrams() << " datagrams ("
+                      << bytesReceived_ << " bytes) received in " << receiver.calls()
+                      << " reads";
+    return result;
+}
+
+std::string UdpWorker::name() const {
+    std::ostringstream stream;
+    stream << "Worker " << index_;
+    return stream.str();
+}
+
+void UdpWorker::receiveDatagram(const uint8_t* data, size_t size, const sockaddr_in& source,
+                                double now) {
+    bool written;
+    uint64_t key;
+    if (options_.rtp) {
+        RtpHeader header;
+        int offset = parseRtpHeader(data, size, header);
+        if (offset < 0) {
+            rtpInvalid_++;
+            return;
+        }
+        key = header.ssrc;
+        UdpSession& session = findSession(key, source, now);
+        written = session.receiveRtp(header, offset, data, size, source, now);
+        updateWaiting(key, session);
+    } else {
+        key = addressKey(source);
+        written = findSession(key, source, now).receive(data, size, source, now);
+    }
+    if (!written) {
+        closeSession(sessions_.find(key), "Output file cannot be written");
+    }
+}
+
+UdpSession& UdpWorker::findSession(uint64_t key, const sockaddr_in& source, double now) {
+    Sessions::iterator it = sessions_.find(key);
+    if (it == sessions_.end()) {
+        std::unique_ptr<UdpSession> session(
+            new UdpSession(nextSessionId_++, spec_, options_, writer_, source, now));
+        {
+            LogLine line(kLogInfo);
+            line << session->name() << ": Started";
+            if (options_.rtp) {
+                line << ", ssrc " << std::hex << std::setw(8) << std::setfill('0') << key;
+            }
+            line << ", " << sessions_.size() + 1 << " sessions open on worker " << index_;
+        }
+        it = sessions_.insert(std::make_pair(key, std::move(session))).first;
+    }
+    return *it->second;
+}
+
+void UdpWorker::closeSession(Sessions::iterator it, const std::string& reason) {
+    it->second->close(reason);
+    waiting_.erase(it->first);
+    sessions_.erase(it);
+}
+
+void UdpWorker::closeSessionsFrom(const sockaddr_in& source, const std::string& reason) {
+    for (Sessions::iterator it = sessions_.begin(); it != sessions_.end();) {
+        const sockaddr_in& address = it->second->source();
+        Sessions::iterator next = it;
+        ++next;
+        if (address.sin_addr.s_addr == source.sin_addr.s_addr &&
+            address.sin_port == source.sin_port) {
+            closeSession(it, reason);
+        }
+        it = next;
+    }
+}
+
+void UdpWorker::updateWaiting(uint64_t key, const UdpSession& session) {
+    if (session.deadline() >= 0.0) {
+        waiting_.insert(key);
+    } else {
+        waiting_.erase(key);
+    }
+}
+
+void UdpWorker::releaseDue(double now) {
+    for (std::set<uint64_t>::iterator it = waiting_.begin(); it != waiting_.end();) {
+        uint64_t key = *it++;
+        Sessions::iterator session = sessions_.find(key);
+        if (session->second->deadline() > now) {
+            continue;
+        }
+        if (session->second->release(now)) {
+            updateWaiting(key, *session->second);
+        } else {
+            closeSession(session, "Output file cannot be written");
+        }
+    }
+}
+
+void UdpWorker::closeIdle(double now) {
+    for (Sessions::iterator it = sessions_.begin(); it != sessions_.end();) {
+        Sessions::iterator next = it;
+        ++next;
+        if (now - it->second->lastArrival() >= kIdleTimeoutSeconds) {
+            closeSession(it, "Timeout reached, assuming end of transmission");
+        }
+        it = next;
+    }
+    if (rtpInvalid_ > rtpInvalidReported_) {
+        LogLine(kLogWarning) << "Ignored " << rtpInvalid_ - rtpInvalidReported_
+                             << " datagrams without an RTP header";
+        rtpInvalidReported_ = rtpInvalid_;
+    }
+}
@@ -0,0 +1,80 @@
+#ifndef UDP_WORKER_H
+#define UDP_WORKER_H
+
+#include <netinet/in.h>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "DiskWriter.h"
+#include "OutputSpec.h"
+#include "UdpSession.h"
+
+// One receive thread of UdpServer: an epoll loop over a socket per port the server listens
+// on, and the sessions (see UdpSession.h) of the datagrams that arrive there. Datagrams are
+// demultiplexed by source address, or with RTP by SSRC. A session ends with an empty
+// datagram from its sender or after kIdleTimeoutSeconds without a datagram.
+//
+// When the server runs several workers, every worker binds its own socket to each port
+// with SO_REUSEPORT and the kernel spreads senders over them by address hash, so a sender
+// always reaches the same worker and its session never leaves that worker's thread and
+// core. Workers share only the DiskWriter and the counter session ids are taken from.
+class UdpWorker {
+  public:
+    static const double kIdleTimeoutSeconds;
+
+    // run() returns once stopFd, an eventfd of the server's, is readable
+    UdpWorker(int index, const OutputSpec& spec, const UdpSessionOptions& options,
+              int batchSize, DiskWriter& writer, std::atomic<int>& nextSessionId, int stopFd);
+    ~UdpWorker();
+
+    // Creates the epoll instance and binds a socket to each port, with SO_REUSEPORT if
+    // reusePort. Returns -1 on failure.
+    int open(const std::vector<int>& ports, bool reusePort);
+    // Receives until the stop eventfd is written, then closes the sessions still open. Pins
+    // the calling thread to core unless it is negative. Returns -1 on a socket error.
+    int run(int core);
+
+    int index() const { return index_; }
+
+  private:
+    typedef std::unordered_map<uint64_t, std::unique_ptr<UdpSession> > Sessions;
+
+    int index_;
+    OutputSpec spec_;
+    UdpSessionOptions options_;
+    int batchSize_;
+    DiskWriter& writer_;
+    std::atomic<int>& nextSessionId_;
+    bool running_;
+    int epollFd_;
+    int stopFd_;  // not owned
+    std::vector<int> sockets_;
+    Sessions sessions_;
+    std::set<uint64_t> waiting_;  // keys of the sessions whose jitter buffer has a deadline
+    uint64_t rtpInvalid_;         // datagrams without a valid RTP header
+    uint64_t rtpInvalidReported_;
+    uint64_t bytesReceived_;  // counted instead of logged per datagram
+
+    UdpWorker(const UdpWorker&);
+    UdpWorker& operator=(const UdpWorker&);
+
+    std::string name() const;
+    void receiveDatagram(const uint8_t* data, size_t size, const sockaddr_in& source,
+                         double now);
+    UdpSession& findSession(uint64_t key, const sockaddr_in& source, double now);
+    void closeSession(Sessions::iterator it, const std::string& reason);
+    // Ends the sessions whose latest datagram came from source
+    void closeSessionsFrom(const sockaddr_in& source, const std::string& reason);
+    // Keeps waiting_ in step with the session's jitter buffer after it ran
+    void updateWaiting(uint64_t key, const UdpSession& session);
+    void releaseDue(double now);
+    void closeIdle(double now);
+};
+
+#endif  // UDP_WORKER_H
@@ -1,6 +1,13 @@
 #include "AudioProcessor.h"
+#include "BatchTranscoder.h"
+#include "Log.h"
+#include "UdpSink.h"
 
 #include <iostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
 extern "C" {
 #include <libavcodec/avcodec.h>
@@ -10,28 +17,222 @@ extern "C" {
 #include <libavutil/samplefmt.h>
 }
 
+static void printUsage(const char* program) {
+    std::cerr << "Usage: " << program
+              << " [options] <input_audio_file> [udp_server_ip] [udp_server_port]" << std::endl;
+    std::cerr << "       " << program << " [options] --batch <directory|list_file>" << std::endl;
+    std::cerr << "Supported formats: MP3, WAV, AAC, FLAC, OGG" << std::endl;
+    std::cerr << "Default UDP server: 127.0.0.1:8080" << std::endl;
+    std::cerr << "Options:" << std::endl;
+    std::cerr << "  --output SPEC   add an encoded output, may be repeated (default: mp3:320k):"
+              << std::endl;
+    std::cerr << "                  <codec>[:<bitrate>[:<sample_rate>[:<channels>[:<format>]]]], "
+                 "e.g. mp3:128k"
+              << std::endl;
+    std::cerr << "  --sink DESC     add a sink to the last output, may be repeated (default: "
+                 "the file <name>_48000.mp3 and the UDP server):"
+              << std::endl;
+    std::cerr << "                  file:<path>, udp|rtp:<ip>:<port>[:<batch>[:<flush_ms>]], "
+                 "pipe:<path>|-, memory, null"
+              << std::endl;
+    std::cerr << "  --pipeline      run each processing stage on its own thread" << std::endl;
+    std::cerr << "  --no-copy       re-encode inputs that already match the output" << std::endl;
+    std::cerr << "  --segments N    encode a long input as N segments in parallel" << std::endl;
+    std::cerr << "  --resampler R   sample rate converter: swr (default) or polyphase"
+              << std::endl;
+    std::cerr << "  --rtp           send the default UDP stream with RTP headers" << std::endl;
+    std::cerr << "  --fec SPEC      FEC packets on the RTP streams, implies --rtp: xor[:K] or "
+                 "rs[:K[:M]], M repair packets per K (default: off; xor 10, rs 10:2)"
+              << std::endl;
+    std::cerr << "  --udp-batch N   datagrams per sendmmsg() of the UDP sinks (default: "
+              << UdpSinkOptions().batchSize << ", 1: one send per packet)" << std::endl;
+    std::cerr << "  --udp-flush-ms MS  longest a datagram waits for its batch (default: "
+              << UdpSinkOptions().flushIntervalMs << ")" << std::endl;
+    std::cerr << "  --udp-mtu BYTES pack several packets into each UDP datagram of up to BYTES"
+              << std::endl;
+    std::cerr << "  --udp-aggregate-ms MS  longest a packet waits for others to share its "
+                 "datagram (default: "
+              << UdpSinkOptions().aggregateMs << ")" << std::endl;
+    std::cerr << "  --pace MODE     UDP pacing at the media rate: off (default), bucket, txtime"
+              << std::endl;
+    std::cerr << "  --pace-speed X  paced media seconds per second (default: 1, real time)"
+              << std::endl;
+    std::cerr << "  --pace-burst-ms MS  media time that may be sent at once (default: "
+              << UdpSinkOptions().pacingBurstMs << ")" << std::endl;
+    std::cerr << "  --batch PATH    transcode every file of a directory or list file" << std::endl;
+    std::cerr << "  --jobs N        number of batch worker threads (default: all cores)"
+              << std::endl;
+    std::cerr << "  --log-level L   debug, info (default), warning, error or off" << std::endl;
+}
+
 int main(int argc, char* argv[]) {
-    if (argc < 2 || argc > 4) {
-        std::cerr << "Usage: " << argv[0] << " <input_audio_file> [udp_server_ip] [udp_server_port]"
-                  << std::endl;
-        std::cerr << "Supported formats: MP3, WAV, AAC, FLAC, OGG" << std::endl;
-        std::cerr << "Default UDP server: 127.0.0.1:8080" << std::endl;
+    bool pipelined = false;
+    bool streamCopy = true;
+    std::string batchInput;
+    int segmentCount = 0;
+    Resampler::Backend resamplerBackend = Resampler::kBackendSwr;
+    int jobCount = static_cast<int>(std::thread::hardware_concurrency());
+    UdpSinkOptions udpOptions;
+    std::vector<OutputSpec> outputs;
+    // Each sink with the index of the output it belongs to
+    std::vector<std::pair<size_t, std::string>> sinkDescriptions;
+    std::vector<std::string> positional;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--pipeline") {
+            pipelined = true;
+        } else if (arg == "--no-copy") {
+            streamCopy = false;
+        } else if (arg == "--segments" && i + 1 < argc) {
+            try {
+                segmentCount = std::stoi(argv[++i]);
+            } catch (const std::exception& e) {
+                std::cerr << "Invalid segment count: " << argv[i] << std::endl;
+                return -1;
+            }
+        } else if (arg == "--resampler" && i + 1 < argc) {
+            if (!Resampler::parseBackend(argv[++i], resamplerBackend)) {
+                std::cerr << "Invalid resampler: " << argv[i] << std::endl;
+                return -1;
+            }
+        } else if (arg == "--rtp") {
+            udpOptions.transport = UdpSinkOptions::kTransportRtp;
+        } else if (arg == "--fec" && i + 1 < argc) {
+            if (!FecOptions::parse(argv[++i], udpOptions.fec)) {
+                std::cerr << "Invalid FEC: " << argv[i] << std::endl;
+                return -1;
+            }
+            if (udpOptions.fec.scheme != kFecNone) {
+                udpOptions.transport = UdpSinkOptions::kTransportRtp;
+            }
+        } else if (arg == "--udp-batch" && i + 1 < argc) {
+            try {
+                udpOptions.batchSize = std::stoi(argv[++i]);
+            } catch (const std::exception& e) {
+                std::cerr << "Invalid UDP batch size: " << argv[i] << std::endl;
+                return -1;
+            }
+        } else if (arg == "--udp-flush-ms" && i + 1 < argc) {
+            try {
+                udpOptions.flushIntervalMs = std::stoi(argv[++i]);
+            } catch (const std::exception& e) {
+                std::cerr << "Invalid UDP flush interval: " << argv[i] << std::endl;
+                return -1;
+            }
+        } else if (arg == "--udp-mtu" && i + 1 < argc) {
+            try {
+                udpOptions.mtu = std::stoi(argv[++i]);
+            } catch (const std::exception& e) {
+                std::cerr << "Invalid UDP MTU: " << argv[i] << std::endl;
+                return -1;
+            }
+        } else if (arg == "--udp-aggregate-ms" && i + 1 < argc) {
+            try {
+                udpOptions.aggregateMs = std::stoi(argv[++i]);
+            } catch (const std::exception& e) {
+                std::cerr << "Invalid UDP aggregation delay: " << argv[i] << std::endl;
+                return -1;
+            }
+        } else if (arg == "--pace" && i + 1 < argc) {
+            if (!UdpSinkOptions::parsePacing(argv[++i], udpOptions.pacing)) {
+                std::cerr << "Invalid pacing: " << argv[i] << std::endl;
+                return -1;
+            }
+        } else if (arg == "--pace-speed" && i + 1 < argc) {
+            try {
+                udpOptions.pacingSpeed = std::stod(argv[++i]);
+            } catch (const std::exception& e) {
+                udpOptions.pacingSpeed = 0.0;
+            }
+            if (udpOptions.pacingSpeed <= 0.0) {
+                std::cerr << "Invalid pacing speed: " << argv[i] << std::endl;
+                return -1;
+            }
+        } else if (arg == "--pace-burst-ms" && i + 1 < argc) {
+            try {
+                udpOptions.pacingBurstMs = std::stoi(argv[++i]);
+            } catch (const std::exception& e) {
+                std::cerr << "Invalid pacing burst: " << argv[i] << std::endl;
+                return -1;
+            }
+        } else if (arg == "--output" && i + 1 < argc) {
+            OutputSpec spec;
+            if (!OutputSpec::parse(argv[++i], spec)) {
+                std::cerr << "Invalid output: " << argv[i] << std::endl;
+                return -1;
+            }
+            outputs.push_back(spec);
+        } else if (arg == "--sink" && i + 1 < argc) {
+            size_t output = outputs.empty() ? 0 : outputs.size() - 1;
+            sinkDescriptions.push_back(std::make_pair(output, std::string(argv[++i])));
+        } else if (arg == "--batch" && i + 1 < argc) {
+            batchInput = argv[++i];
+        } else if (arg == "--jobs" && i + 1 < argc) {
+            try {
+                jobCount = std::stoi(argv[++i]);
+            } catch (const std::exception& e) {
+                std::cerr << "Invalid job count: " << argv[i] << std::endl;
+                return -1;
+            }
+        } else if (arg == "--log-level" && i + 1 < argc) {
+            LogLevel level;
+            if (!Log::parseLevel(argv[++i], level)) {
+                std::cerr << "Invalid log level: " << argv[i] << std::endl;
+                return -1;
+            }
+            Log::setLevel(level);
+        } else if (arg.size() > 2 && arg.compare(0, 2, "--") == 0) {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            printUsage(argv[0]);
+            return -1;
+        } else {
+            positional.push_back(arg);
+        }
+    }
+
+    if (!batchInput.empty()) {
+        if (!positional.empty()) {
+            printUsage(argv[0]);
+            return -1;
+        }
+
+        if (outputs.size() > 1 || !sinkDescriptions.empty()) {
+            std::cerr << "Batch mode takes one --output and no --sink" << std::endl;
+            return -1;
+        }
+
+        BatchTranscoder batch(jobCount);
+        if (!outputs.empty()) {
+            batch.setOutputSpec(outputs[0]);
+        }
+        batch.setPipelined(pipelined);
+        batch.setStreamCopy(streamCopy);
+        batch.setResamplerBackend(resamplerBackend);
+        if (batch.addInputs(batchInput) < 0) {
+            return -1;
+        }
+        return batch.run();
+    }
+
+    if (positional.empty() || positional.size() > 3) {
+        printUsage(argv[0]);
         return -1;
     }
 
-    std::string inputFilePath = argv[1];
+    std::string inputFilePath = positional[0];
     std::string udpServerIp = "127.0.0.1";
     int udpServerPort = 8080;
 
-    if (argc >= 3) {
-        udpServerIp = argv[2];
+    if (positional.size() >= 2) {
+        udpServerIp = positional[1];
     }
 
-    if (argc >= 4) {
+    if (positional.size() >= 3) {
         try {
-            udpServerPort = std::stoi(argv[3]);
+            udpServerPort = std::stoi(positional[2]);
         } catch (const std::exception& e) {
-            std::cerr << "Invalid port number: " << argv[3] << std::endl;
+            std::cerr << "Invalid port number: " << positional[2] << std::endl;
             return -1;
         }
     }
@@ -41,6 +242,29 @@ int main(int argc, char* argv[]) {
 
     // Create audio processor
     AudioProcessor processor;
+    processor.setPipelined(pipelined);
+    processor.setStreamCopy(streamCopy);
+    processor.setSegmentCount(segmentCount);
+    processor.setResamplerBackend(resamplerBackend);
+    processor.setUdpOptions(udpOptions);
+    if (outputs.empty()) {
+        outputs.push_back(OutputSpec());
+    }
+    for (size_t output = 0; output < outputs.size(); ++output) {
+        processor.addOutput(outputs[output]);
+        for (size_t i = 0; i < sinkDescriptions.size(); ++i) {
+            if (sinkDescriptions[i].first != output) {
+                continue;
+            }
+            std::unique_ptr<PacketSink> sink =
+                createPacketSink(sinkDescriptions[i].second, udpOptions);
+            if (!sink) {
+                std::cerr << "Invalid sink: " << sinkDescriptions[i].second << std::endl;
+                return -1;
+            }
+            processor.addSink(std::move(sink));
+        }
+    }
 
     // Process audio file
     int result = processor.processAudio(inputFilePath, udpServerIp, udpServerPort);
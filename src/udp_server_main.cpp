@@ -1,42 +1,174 @@
+#include "Log.h"
 #include "UdpServer.h"
 
+#include <unistd.h>
+
 #include <csignal>
 #include <iostream>
+#include <string>
+#include <vector>
 
 // Global server instance for signal handling
 UdpServer* g_server = nullptr;
 
-// Signal handler for graceful shutdown
+// Signal handler for graceful shutdown: start() returns in main once the open sessions are
+// closed and their files finished. Only async-signal-safe calls here.
 void signalHandler(int signum) {
-    std::cout << "\nInterrupt signal received (" << signum << "). Shutting down..." << std::endl;
+    static const char kMessage[] = "\nInterrupt signal received. Shutting down...\n";
+    ssize_t written = write(STDOUT_FILENO, kMessage, sizeof(kMessage) - 1);
+    (void)written;
 
     if (g_server) {
         g_server->stop();
     }
 
-    exit(signum);
+    // A second signal ends the process at once
+    signal(signum, SIG_DFL);
+}
+
+// Appends the ports of "PORT", "FIRST-LAST" or a comma-separated list of those
+static bool parsePorts(const std::string& value, std::vector<int>& ports) {
+    size_t start = 0;
+    while (start <= value.size()) {
+        size_t end = value.find(',', start);
+        if (end == std::string::npos) {
+            end = value.size();
+        }
+        std::string item = value.substr(start, end - start);
+        size_t dash = item.find('-');
+        int first = 0;
+        int last = 0;
+        try {
+            first = std::stoi(item.substr(0, dash));
+            last = dash == std::string::npos ? first : std::stoi(item.substr(dash + 1));
+        } catch (const std::exception& e) {
+            return false;
+        }
+        if (first <= 0 || last > 65535 || last < first) {
+            return false;
+        }
+        for (int port = first; port <= last; ++port) {
+            ports.push_back(port);
+        }
+        start = end + 1;
+    }
+    return true;
+}
+
+// Parses an integer of at least minimum
+static bool parseInt(const std::string& text, int minimum, int& value) {
+    try {
+        value = std::stoi(text);
+    } catch (const std::exception& e) {
+        return false;
+    }
+    return value >= minimum;
 }
 
 int main(int argc, char* argv[]) {
-    int port = 8080;  // Default port
+    std::vector<int> ports;
+    OutputSpec spec;
+    bool rtp = false;
+    bool aggregated = false;
+    double minJitterMs = 50.0;
+    double maxJitterMs = 2000.0;
+    int batchSize = 32;
+    int workers = 1;
+    DiskWriterOptions disk;
 
-    if (argc > 1) {
-        port = std::stoi(argv[1]);
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--output" && i + 1 < argc) {
+            if (!OutputSpec::parse(argv[++i], spec)) {
+                std::cerr << "Invalid output: " << argv[i] << std::endl;
+                return -1;
+            }
+        } else if (arg == "--rtp") {
+            rtp = true;
+        } else if (arg == "--aggregate") {
+            aggregated = true;
+        } else if (arg == "--batch" && i + 1 < argc) {
+            if (!parseInt(argv[++i], 1, batchSize)) {
+                std::cerr << "Invalid batch size: " << argv[i] << std::endl;
+                return -1;
+            }
+        } else if (arg == "--workers" && i + 1 < argc) {
+            if (!parseInt(argv[++i], 1, workers)) {
+                std::cerr << "Invalid worker count: " << argv[i] << std::endl;
+                return -1;
+            }
+        } else if (arg == "--disk-flush-ms" && i + 1 < argc) {
+            if (!parseInt(argv[++i], 0, disk.flushMs)) {
+                std::cerr << "Invalid disk flush interval: " << argv[i] << std::endl;
+                return -1;
+            }
+        } else if (arg == "--disk-sync-ms" && i + 1 < argc) {
+            // -1 never syncs
+            if (!parseInt(argv[++i], -1, disk.syncMs)) {
+                std::cerr << "Invalid disk sync interval: " << argv[i] << std::endl;
+                return -1;
+            }
+        } else if (arg == "--disk-prealloc-mb" && i + 1 < argc) {
+            int megabytes = 0;
+            if (!parseInt(argv[++i], 0, megabytes)) {
+                std::cerr << "Invalid preallocation size: " << argv[i] << std::endl;
+                return -1;
+            }
+            disk.preallocateBytes = static_cast<size_t>(megabytes) << 20;
+        } else if (arg == "--log-level" && i + 1 < argc) {
+            LogLevel level;
+            if (!Log::parseLevel(argv[++i], level)) {
+                std::cerr << "Invalid log level: " << argv[i] << std::endl;
+                return -1;
+            }
+            Log::setLevel(level);
+        } else if (arg == "--jitter" && i + 1 < argc) {
+            // MIN_MS[:MAX_MS]
+            std::string value = argv[++i];
+            size_t colon = value.find(':');
+            try {
+                minJitterMs = std::stod(value.substr(0, colon));
+                if (colon != std::string::npos) {
+                    maxJitterMs = std::stod(value.substr(colon + 1));
+                }
+            } catch (const std::exception& e) {
+                minJitterMs = -1.0;
+            }
+            if (minJitterMs < 0.0 || maxJitterMs < minJitterMs) {
+                std::cerr << "Invalid jitter buffer delay: " << argv[i] << std::endl;
+                return -1;
+            }
+        } else if (!parsePorts(arg, ports)) {
+            std::cerr << "Invalid port: " << arg << std::endl;
+            return -1;
+        }
+    }
+    if (ports.empty()) {
+        ports.push_back(8080);  // Default port
     }
 
-    std::cout << "Starting UDP server on port " << port << std::endl;
+    std::cout << "Starting UDP server on " << ports.size()
+              << (ports.size() == 1 ? " port" : " ports") << std::endl;
     std::cout << "Press Ctrl+C to stop the server" << std::endl;
 
+    // Create and start UDP server
+    UdpServer server(spec);
+    server.setRtp(rtp);
+    server.setAggregated(aggregated);
+    server.setJitterDelay(minJitterMs / 1000.0, maxJitterMs / 1000.0);
+    server.setBatchSize(batchSize);
+    server.setWorkers(workers);
+    server.setDiskWriter(disk);
+    g_server = &server;
+
     // Register signal handler for graceful shutdown
     signal(SIGINT, signalHandler);
     signal(SIGTERM, signalHandler);
 
-    // Create and start UDP server
-    UdpServer server;
-    g_server = &server;
-
-    int result = server.start(port);
+    int result = server.start(ports);
 
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
     g_server = nullptr;
     return result;
 }
\ No newline at end of file